@@ -0,0 +1,669 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "backlight.h"
+
+static const char* TAG = "backlight";
+
+// Runs are split so that the packed 16-bit accumulators in
+// backlight_analyze cannot overflow (256 * 255 < 65536).
+#define BACKLIGHT_MAX_RUN 256
+
+// corner detection: the screen must be this much brighter than the average
+// and cover at least 1/n of the frame
+#define BACKLIGHT_DETECT_CONTRAST 32
+#define BACKLIGHT_DETECT_MIN_AREA 16
+
+// dominant color: 3 bits each of U and V, as in the camera chroma histogram
+#define BACKLIGHT_HIST_BINS 64
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+
+typedef struct {
+    uint32_t start;     // first framebuffer word (2 pixels) of the run
+    uint32_t words;     // run length in framebuffer words
+} backlight_span_t;
+
+// Maps the unit square (u along the top edge, v down the left edge) onto
+// the screen quadrilateral: x = (a*u + b*v + c) / (g*u + h*v + 1), same
+// for y with d, e, f.
+typedef struct {
+    float a, b, c;
+    float d, e, f;
+    float g, h;
+} homography_t;
+
+// Histogram of one zone, struct of arrays indexed by bin. Only bins listed
+// in touched are non-zero, so clearing it costs as much as the bins used.
+typedef struct {
+    uint32_t weight[BACKLIGHT_HIST_BINS];   // pixel pairs weighted by saturation
+    uint32_t words[BACKLIGHT_HIST_BINS];
+    uint32_t sum_y[BACKLIGHT_HIST_BINS];
+    uint32_t sum_u[BACKLIGHT_HIST_BINS];
+    uint32_t sum_v[BACKLIGHT_HIST_BINS];
+    uint8_t touched[BACKLIGHT_HIST_BINS];
+    size_t touched_count;
+} zone_hist_t;
+
+typedef struct {
+    backlight_layout_t layout;
+    backlight_layout_t pending_layout;
+    backlight_point_t pending_corners[4];
+    bool pending_rectify;
+    backlight_inset_t pending_inset;
+    bool layout_changed;
+    portMUX_TYPE lock;
+    int width;
+    int height;
+    bool rectify;
+    homography_t homography;
+    backlight_point_t corners[4];
+    backlight_inset_t inset;
+    size_t led_count;
+    backlight_span_t* spans;
+    size_t span_count;
+    uint32_t* led_first_span;   // led_count + 1 entries, spans of LED i are [first[i], first[i+1])
+    uint32_t* led_words;        // framebuffer words sampled per LED
+    volatile backlight_mode_t mode;
+    zone_hist_t* hist;          // allocated on first switch to BACKLIGHT_MODE_DOMINANT
+} backlight_state_t;
+
+static backlight_state_t* s_bl = NULL;
+
+// Builder used twice: once with spans == NULL to count, once to fill.
+typedef struct {
+    const backlight_layout_t* layout;
+    const homography_t* homography;     // NULL samples the frame directly
+    int ox, oy;                         // zone origin, i.e. top left inset
+    int width;
+    int height;
+    int words_per_row;
+    backlight_span_t* spans;
+    uint32_t* led_first_span;
+    uint32_t* led_words;
+    size_t span_count;
+    size_t led;
+} span_builder_t;
+
+static void add_run(span_builder_t* b, uint32_t start, uint32_t words)
+{
+    if (b->spans) {
+        b->spans[b->span_count].start = start;
+        b->spans[b->span_count].words = words;
+    }
+    b->span_count++;
+}
+
+// Zone given in screen coordinates: every sample point goes through the
+// homography once, words that follow each other in the frame are merged
+// into one run so backlight_analyze walks the same table either way.
+static void add_rectified_zone(span_builder_t* b, int x0, int y0, int x1, int y1)
+{
+    const homography_t* m = b->homography;
+    const float su = 1.0f / b->width;
+    const float sv = 1.0f / b->height;
+    uint32_t words = 0;
+    if (b->led_first_span) {
+        b->led_first_span[b->led] = b->span_count;
+    }
+    for (int y = y0; y < y1; y += b->layout->row_step) {
+        uint32_t run_start = 0, run_words = 0;
+        float v = (y + 0.5f) * sv;
+        for (int x = x0; x < x1; ++x) {
+            float u = (x + 0.5f) * su;
+            float z = m->g * u + m->h * v + 1.0f;
+            int fx = (int) ((m->a * u + m->b * v + m->c) / z);
+            int fy = (int) ((m->d * u + m->e * v + m->f) / z);
+            if (fx < 0 || fx >= b->width || fy < 0 || fy >= b->height) {
+                continue;
+            }
+            uint32_t word = fy * b->words_per_row + fx / 2;
+            if (run_words > 0) {
+                uint32_t last = run_start + run_words - 1;
+                if (word == last) {
+                    continue;   // screen is smaller than the frame here, don't count it twice
+                }
+                if (word == last + 1 && run_words < BACKLIGHT_MAX_RUN) {
+                    run_words++;
+                    words++;
+                    continue;
+                }
+                add_run(b, run_start, run_words);
+            }
+            run_start = word;
+            run_words = 1;
+            words++;
+        }
+        if (run_words > 0) {
+            add_run(b, run_start, run_words);
+        }
+    }
+    if (b->led_words) {
+        b->led_words[b->led] = words;
+    }
+    b->led++;
+}
+
+static void add_zone(span_builder_t* b, int x0, int y0, int x1, int y1)
+{
+    x0 += b->ox;
+    x1 += b->ox;
+    y0 += b->oy;
+    y1 += b->oy;
+    if (b->homography) {
+        add_rectified_zone(b, x0, y0, x1, y1);
+        return;
+    }
+    int wx0 = x0 / 2;
+    int wx1 = (x1 + 1) / 2;
+    uint32_t words = 0;
+    if (b->led_first_span) {
+        b->led_first_span[b->led] = b->span_count;
+    }
+    for (int y = y0; y < y1 && wx0 < wx1; y += b->layout->row_step) {
+        for (int x = wx0; x < wx1; x += BACKLIGHT_MAX_RUN) {
+            int run = min(BACKLIGHT_MAX_RUN, wx1 - x);
+            add_run(b, y * b->words_per_row + x, run);
+            words += run;
+        }
+    }
+    if (b->led_words) {
+        b->led_words[b->led] = words;
+    }
+    b->led++;
+}
+
+// LED i of n along [a, b), i counted from a
+static inline int seg(int a, int b, int i, int n)
+{
+    return a + (i * (b - a)) / n;
+}
+
+static void build_zones(span_builder_t* b, int w, int h)
+{
+    const backlight_layout_t* l = b->layout;
+    int d = min(l->depth, min(w, h) / 2);
+    int hx0 = 0, hx1 = w;       // horizontal extent of top/bottom zones
+    int vy0 = d, vy1 = h - d;   // vertical extent of side zones
+    bool corner_leds = (l->corners == BACKLIGHT_CORNER_LED);
+
+    if (l->corners == BACKLIGHT_CORNER_OVERLAP) {
+        vy0 = 0;
+        vy1 = h;
+    } else if (corner_leds) {
+        hx0 = d;
+        hx1 = w - d;
+    }
+
+    // left, bottom to top
+    for (int i = 0; i < l->left; ++i) {
+        int j = l->left - 1 - i;
+        add_zone(b, 0, seg(vy0, vy1, j, l->left), d, seg(vy0, vy1, j + 1, l->left));
+    }
+    if (corner_leds) {
+        add_zone(b, 0, 0, d, d);
+    }
+    // top, left to right
+    for (int i = 0; i < l->top; ++i) {
+        add_zone(b, seg(hx0, hx1, i, l->top), 0, seg(hx0, hx1, i + 1, l->top), d);
+    }
+    if (corner_leds) {
+        add_zone(b, w - d, 0, w, d);
+    }
+    // right, top to bottom
+    for (int i = 0; i < l->right; ++i) {
+        add_zone(b, w - d, seg(vy0, vy1, i, l->right), w, seg(vy0, vy1, i + 1, l->right));
+    }
+    if (corner_leds) {
+        add_zone(b, w - d, h - d, w, h);
+    }
+    // bottom, right to left
+    for (int i = 0; i < l->bottom; ++i) {
+        int j = l->bottom - 1 - i;
+        add_zone(b, seg(hx0, hx1, j, l->bottom), h - d, seg(hx0, hx1, j + 1, l->bottom), h);
+    }
+    if (corner_leds) {
+        add_zone(b, 0, h - d, d, h);
+    }
+}
+
+static size_t layout_led_count(const backlight_layout_t* layout)
+{
+    size_t count = layout->top + layout->right + layout->bottom + layout->left;
+    if (layout->corners == BACKLIGHT_CORNER_LED) {
+        count += 4;
+    }
+    return count;
+}
+
+// Square to quad mapping, see Heckbert, "Fundamentals of Texture Mapping
+// and Image Warping", 1989. Corners are TL, TR, BR, BL.
+static esp_err_t homography_from_corners(const backlight_point_t* p, homography_t* m)
+{
+    float sx = p[0].x - p[1].x + p[2].x - p[3].x;
+    float sy = p[0].y - p[1].y + p[2].y - p[3].y;
+    if (sx == 0 && sy == 0) {
+        m->g = 0;
+        m->h = 0;
+    } else {
+        float dx1 = p[1].x - p[2].x, dx2 = p[3].x - p[2].x;
+        float dy1 = p[1].y - p[2].y, dy2 = p[3].y - p[2].y;
+        float den = dx1 * dy2 - dx2 * dy1;
+        if (den == 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        m->g = (sx * dy2 - dx2 * sy) / den;
+        m->h = (dx1 * sy - sx * dy1) / den;
+    }
+    m->a = p[1].x - p[0].x + m->g * p[1].x;
+    m->b = p[3].x - p[0].x + m->h * p[3].x;
+    m->c = p[0].x;
+    m->d = p[1].y - p[0].y + m->g * p[1].y;
+    m->e = p[3].y - p[0].y + m->h * p[3].y;
+    m->f = p[0].y;
+    return ESP_OK;
+}
+
+// homography is NULL unless the screen is rectified
+static esp_err_t build_span_table(const backlight_layout_t* layout, const backlight_inset_t* inset,
+                                  const homography_t* homography)
+{
+    const int zone_width = s_bl->width - inset->left - inset->right;
+    const int zone_height = s_bl->height - inset->top - inset->bottom;
+    span_builder_t b = { 0 };
+    b.layout = layout;
+    b.homography = homography;
+    b.ox = inset->left;
+    b.oy = inset->top;
+    b.width = s_bl->width;
+    b.height = s_bl->height;
+    b.words_per_row = s_bl->width / 2;
+    build_zones(&b, zone_width, zone_height);
+
+    size_t led_count = b.led;
+    size_t span_count = b.span_count;
+    backlight_span_t* spans = (backlight_span_t*) malloc(sizeof(backlight_span_t) * max(span_count, 1));
+    uint32_t* first = (uint32_t*) malloc(sizeof(uint32_t) * (led_count + 1));
+    uint32_t* words = (uint32_t*) malloc(sizeof(uint32_t) * max(led_count, 1));
+    if (!spans || !first || !words) {
+        ESP_LOGE(TAG, "Not enough memory for %d spans", span_count);
+        free(spans);
+        free(first);
+        free(words);
+        return ESP_ERR_NO_MEM;
+    }
+
+    memset(&b, 0, sizeof(b));
+    b.layout = layout;
+    b.homography = homography;
+    b.ox = inset->left;
+    b.oy = inset->top;
+    b.width = s_bl->width;
+    b.height = s_bl->height;
+    b.words_per_row = s_bl->width / 2;
+    b.spans = spans;
+    b.led_first_span = first;
+    b.led_words = words;
+    build_zones(&b, zone_width, zone_height);
+    first[led_count] = span_count;
+
+    free(s_bl->spans);
+    free(s_bl->led_first_span);
+    free(s_bl->led_words);
+    s_bl->spans = spans;
+    s_bl->span_count = span_count;
+    s_bl->led_first_span = first;
+    s_bl->led_words = words;
+    s_bl->led_count = led_count;
+    memcpy(&s_bl->layout, layout, sizeof(*layout));
+    ESP_LOGD(TAG, "Span table: %d LEDs, %d spans (%d bytes)",
+            led_count, span_count, span_count * sizeof(backlight_span_t));
+    return ESP_OK;
+}
+
+esp_err_t backlight_init(const backlight_layout_t* layout, int fb_width, int fb_height)
+{
+    if (s_bl != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (fb_width <= 0 || fb_height <= 0 || (fb_width % 2) != 0 || layout->row_step == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_bl = (backlight_state_t*) calloc(1, sizeof(*s_bl));
+    if (!s_bl) {
+        return ESP_ERR_NO_MEM;
+    }
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    s_bl->lock = lock;
+    s_bl->width = fb_width;
+    s_bl->height = fb_height;
+    memcpy(&s_bl->pending_layout, layout, sizeof(*layout));
+    esp_err_t err = build_span_table(layout, &s_bl->inset, NULL);
+    if (err != ESP_OK) {
+        free(s_bl);
+        s_bl = NULL;
+    }
+    return err;
+}
+
+esp_err_t backlight_set_layout(const backlight_layout_t* layout)
+{
+    if (s_bl == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (layout->row_step == 0 || layout_led_count(layout) == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&s_bl->lock);
+    memcpy(&s_bl->pending_layout, layout, sizeof(*layout));
+    s_bl->layout_changed = true;
+    portEXIT_CRITICAL(&s_bl->lock);
+    return ESP_OK;
+}
+
+esp_err_t backlight_set_corners(const backlight_point_t* corners)
+{
+    if (s_bl == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (corners != NULL) {
+        homography_t m;
+        for (int i = 0; i < 4; ++i) {
+            if (corners[i].x < 0 || corners[i].x >= s_bl->width ||
+                corners[i].y < 0 || corners[i].y >= s_bl->height) {
+                return ESP_ERR_INVALID_ARG;
+            }
+        }
+        if (homography_from_corners(corners, &m) != ESP_OK) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    portENTER_CRITICAL(&s_bl->lock);
+    if (corners != NULL) {
+        memcpy(s_bl->pending_corners, corners, sizeof(s_bl->pending_corners));
+    }
+    s_bl->pending_rectify = (corners != NULL);
+    s_bl->layout_changed = true;
+    portEXIT_CRITICAL(&s_bl->lock);
+    return ESP_OK;
+}
+
+esp_err_t backlight_set_inset(const backlight_inset_t* inset)
+{
+    if (s_bl == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    backlight_inset_t none = { 0 };
+    if (inset == NULL) {
+        inset = &none;
+    }
+    if ((inset->left + inset->right) * 4 > s_bl->width * 3 ||
+        (inset->top + inset->bottom) * 4 > s_bl->height * 3) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&s_bl->lock);
+    s_bl->pending_inset = *inset;
+    s_bl->layout_changed = true;
+    portEXIT_CRITICAL(&s_bl->lock);
+    return ESP_OK;
+}
+
+void backlight_get_screen_margins(backlight_inset_t* margins)
+{
+    memset(margins, 0, sizeof(*margins));
+    if (s_bl == NULL || !s_bl->rectify) {
+        return;
+    }
+    const backlight_point_t* c = s_bl->corners;
+    margins->top = max(c[0].y, c[1].y);
+    margins->bottom = s_bl->height - 1 - min(c[2].y, c[3].y);
+    margins->left = max(c[0].x, c[3].x);
+    margins->right = s_bl->width - 1 - min(c[1].x, c[2].x);
+}
+
+esp_err_t backlight_detect_corners(const uint32_t* fb, backlight_point_t* corners)
+{
+    if (s_bl == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const int words_per_row = s_bl->width / 2;
+    const int words = words_per_row * s_bl->height;
+
+    // threshold halfway between the average and the brightest luma
+    uint32_t sum = 0;
+    int peak = 0;
+    for (int i = 0; i < words; ++i) {
+        int y = fb[i] & 0xFF;
+        sum += y;
+        peak = max(peak, y);
+    }
+    int mean = sum / words;
+    if (peak - mean < BACKLIGHT_DETECT_CONTRAST) {
+        ESP_LOGW(TAG, "No bright screen found (mean %d, peak %d)", mean, peak);
+        return ESP_ERR_NOT_FOUND;
+    }
+    int threshold = (mean + peak) / 2;
+
+    // extremes of x+y and x-y give the four corners of a convex blob;
+    // a word only counts if the word below is bright too, which keeps
+    // single-pixel reflections out
+    int best[4] = { INT32_MAX, INT32_MIN, INT32_MIN, INT32_MAX };  // TL, TR, BR, BL
+    int bright = 0;
+    for (int wy = 0; wy < s_bl->height - 1; ++wy) {
+        const uint32_t* row = fb + wy * words_per_row;
+        for (int wx = 0; wx < words_per_row; ++wx) {
+            uint32_t w = row[wx];
+            uint32_t below = row[wx + words_per_row];
+            if ((w & 0xFF) < threshold || ((w >> 16) & 0xFF) < threshold ||
+                (below & 0xFF) < threshold) {
+                continue;
+            }
+            bright++;
+            int x = wx * 2;
+            int y = wy;
+            if (x + y < best[0]) {
+                best[0] = x + y;
+                corners[0].x = x;
+                corners[0].y = y;
+            }
+            if (x + 1 - y > best[1]) {
+                best[1] = x + 1 - y;
+                corners[1].x = x + 1;
+                corners[1].y = y;
+            }
+            if (x + 1 + y > best[2]) {
+                best[2] = x + 1 + y;
+                corners[2].x = x + 1;
+                corners[2].y = y;
+            }
+            if (x - y < best[3]) {
+                best[3] = x - y;
+                corners[3].x = x;
+                corners[3].y = y;
+            }
+        }
+    }
+    if (bright < words / BACKLIGHT_DETECT_MIN_AREA) {
+        ESP_LOGW(TAG, "Bright area too small (%d words)", bright);
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_LOGI(TAG, "Screen corners (%d,%d) (%d,%d) (%d,%d) (%d,%d)",
+            corners[0].x, corners[0].y, corners[1].x, corners[1].y,
+            corners[2].x, corners[2].y, corners[3].x, corners[3].y);
+    return ESP_OK;
+}
+
+size_t backlight_get_led_count()
+{
+    if (s_bl == NULL) {
+        return 0;
+    }
+    return s_bl->led_count;
+}
+
+esp_err_t backlight_set_mode(backlight_mode_t mode)
+{
+    if (s_bl == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (mode == BACKLIGHT_MODE_DOMINANT && s_bl->hist == NULL) {
+        // kept for good, the analyzer may still be reading it after a switch back
+        zone_hist_t* hist = (zone_hist_t*) calloc(1, sizeof(zone_hist_t));
+        if (!hist) {
+            return ESP_ERR_NO_MEM;
+        }
+        s_bl->hist = hist;
+    }
+    s_bl->mode = mode;
+    return ESP_OK;
+}
+
+// rebuild the span table if the layout, corners or inset changed
+static esp_err_t apply_pending()
+{
+    backlight_layout_t layout;
+    backlight_point_t corners[4];
+    backlight_inset_t inset;
+    homography_t homography;
+    bool rectify;
+    portENTER_CRITICAL(&s_bl->lock);
+    memcpy(&layout, &s_bl->pending_layout, sizeof(layout));
+    memcpy(corners, s_bl->pending_corners, sizeof(corners));
+    rectify = s_bl->pending_rectify;
+    inset = s_bl->pending_inset;
+    // a change made while the table is built is picked up next frame
+    s_bl->layout_changed = false;
+    portEXIT_CRITICAL(&s_bl->lock);
+    if (rectify) {
+        homography_from_corners(corners, &homography);
+    }
+    esp_err_t err = build_span_table(&layout, &inset, rectify ? &homography : NULL);
+    if (err != ESP_OK) {
+        // keep the old table and geometry, and try again next frame
+        portENTER_CRITICAL(&s_bl->lock);
+        s_bl->layout_changed = true;
+        portEXIT_CRITICAL(&s_bl->lock);
+        return err;
+    }
+    s_bl->inset = inset;
+    s_bl->rectify = rectify;
+    if (rectify) {
+        memcpy(s_bl->corners, corners, sizeof(corners));
+        s_bl->homography = homography;
+    }
+    return ESP_OK;
+}
+
+static void analyze_average(const uint32_t* fb, backlight_yuv_t* out, size_t led_count)
+{
+    const backlight_span_t* span = s_bl->spans;
+    for (size_t led = 0; led < led_count; ++led) {
+        const backlight_span_t* span_end = s_bl->spans + s_bl->led_first_span[led + 1];
+        uint32_t sum_y = 0, sum_u = 0, sum_v = 0;
+        for (; span < span_end; ++span) {
+            // word layout is y1 | v << 8 | y2 << 16 | u << 24, so two
+            // bytes are accumulated at once in each packed register
+            const uint32_t* p = fb + span->start;
+            const uint32_t* end = p + span->words;
+            uint32_t acc_yy = 0, acc_vu = 0;
+            while (p < end) {
+                uint32_t w = *p++;
+                acc_yy += w & 0x00FF00FF;
+                acc_vu += (w >> 8) & 0x00FF00FF;
+            }
+            sum_y += (acc_yy & 0xFFFF) + (acc_yy >> 16);
+            sum_v += acc_vu & 0xFFFF;
+            sum_u += acc_vu >> 16;
+        }
+        uint32_t words = s_bl->led_words[led];
+        if (words == 0) {
+            out[led].y = 16;
+            out[led].u = 128;
+            out[led].v = 128;
+            continue;
+        }
+        out[led].y = sum_y / (words * 2);
+        out[led].u = sum_u / words;
+        out[led].v = sum_v / words;
+    }
+}
+
+// Every zone gets a chroma histogram in one pass over its spans. Bins are
+// weighted by saturation (|u - 128| + |v - 128|, plus one so grey zones
+// still have a winner) and the LED takes the mean color of the heaviest
+// bin, so a zone mixing red and green shows one of them instead of brown.
+static void analyze_dominant(const uint32_t* fb, backlight_yuv_t* out, size_t led_count)
+{
+    zone_hist_t* h = s_bl->hist;
+    const backlight_span_t* span = s_bl->spans;
+    for (size_t led = 0; led < led_count; ++led) {
+        const backlight_span_t* span_end = s_bl->spans + s_bl->led_first_span[led + 1];
+        for (; span < span_end; ++span) {
+            const uint32_t* p = fb + span->start;
+            const uint32_t* end = p + span->words;
+            while (p < end) {
+                uint32_t w = *p++;
+                uint32_t u = w >> 24;
+                uint32_t v = (w >> 8) & 0xff;
+                uint32_t bin = (u >> 5) << 3 | (v >> 5);
+                if (h->words[bin] == 0) {
+                    h->touched[h->touched_count++] = bin;
+                }
+                h->weight[bin] += abs((int) u - 128) + abs((int) v - 128) + 1;
+                h->words[bin]++;
+                h->sum_y[bin] += (w & 0xff) + ((w >> 16) & 0xff);
+                h->sum_u[bin] += u;
+                h->sum_v[bin] += v;
+            }
+        }
+        if (h->touched_count == 0) {
+            out[led].y = 16;
+            out[led].u = 128;
+            out[led].v = 128;
+            continue;
+        }
+        uint32_t best = h->touched[0];
+        for (size_t i = 1; i < h->touched_count; ++i) {
+            if (h->weight[h->touched[i]] > h->weight[best]) {
+                best = h->touched[i];
+            }
+        }
+        uint32_t words = h->words[best];
+        out[led].y = h->sum_y[best] / (words * 2);
+        out[led].u = h->sum_u[best] / words;
+        out[led].v = h->sum_v[best] / words;
+        for (size_t i = 0; i < h->touched_count; ++i) {
+            uint32_t bin = h->touched[i];
+            h->weight[bin] = 0;
+            h->words[bin] = 0;
+            h->sum_y[bin] = 0;
+            h->sum_u[bin] = 0;
+            h->sum_v[bin] = 0;
+        }
+        h->touched_count = 0;
+    }
+}
+
+esp_err_t backlight_analyze(const uint32_t* fb, backlight_yuv_t* out, size_t max_leds)
+{
+    if (s_bl == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_bl->layout_changed) {
+        esp_err_t err = apply_pending();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    size_t led_count = min(s_bl->led_count, max_leds);
+    if (s_bl->mode == BACKLIGHT_MODE_DOMINANT) {
+        analyze_dominant(fb, out, led_count);
+    } else {
+        analyze_average(fb, out, led_count);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "color_lut.h"
+
+static const char* TAG = "color_lut";
+
+#define NVS_NAMESPACE "backlight"
+#define NVS_KEY "lut"
+
+#define LUT_ENTRIES (COLOR_LUT_POINTS * COLOR_LUT_POINTS * COLOR_LUT_POINTS)
+// byte offsets of the neighbouring grid points, 3 bytes per entry
+#define STRIDE_V 3
+#define STRIDE_U (COLOR_LUT_POINTS * STRIDE_V)
+#define STRIDE_Y (COLOR_LUT_POINTS * STRIDE_U)
+
+#define min(a,b) ((a)<(b)?(a):(b))
+
+typedef struct {
+    color_lut_params_t params;
+    uint8_t* lut;               // used by color_lut_apply
+    uint8_t* pending;           // newly built, not picked up yet
+    portMUX_TYPE lock;
+} color_lut_state_t;
+
+static color_lut_state_t* s_lut = NULL;
+
+static inline float clampf(float x)
+{
+    return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+}
+
+static uint8_t* build_lut(const color_lut_params_t* p)
+{
+    uint8_t* lut = (uint8_t*) malloc(LUT_ENTRIES * 3);
+    if (!lut) {
+        ESP_LOGE(TAG, "Not enough memory for the color table");
+        return NULL;
+    }
+    const float* m = p->matrix;
+    uint8_t* out = lut;
+    for (int iy = 0; iy < COLOR_LUT_POINTS; ++iy) {
+        for (int iu = 0; iu < COLOR_LUT_POINTS; ++iu) {
+            for (int iv = 0; iv < COLOR_LUT_POINTS; ++iv) {
+                // the last grid point stands in for 256
+                float y = (float) (min(iy * 16, 255) - 16);
+                float u = (float) (min(iu * 16, 255) - 128);
+                float v = (float) (min(iv * 16, 255) - 128);
+                float r = clampf((1.164f * y + 1.596f * v) / 255.0f);
+                float g = clampf((1.164f * y - 0.813f * v - 0.391f * u) / 255.0f);
+                float b = clampf((1.164f * y + 2.018f * u) / 255.0f);
+                float rgb[3] = {
+                    clampf(m[0] * r + m[1] * g + m[2] * b),
+                    clampf(m[3] * r + m[4] * g + m[5] * b),
+                    clampf(m[6] * r + m[7] * g + m[8] * b),
+                };
+                for (int c = 0; c < 3; ++c) {
+                    *out++ = (uint8_t) (powf(rgb[c], p->gamma[c]) * 255.0f + 0.5f);
+                }
+            }
+        }
+    }
+    return lut;
+}
+
+void color_lut_default_params(color_lut_params_t* params)
+{
+    memset(params, 0, sizeof(*params));
+    params->matrix[0] = 1.0f;
+    params->matrix[4] = 1.0f;
+    params->matrix[8] = 1.0f;
+    params->gamma[0] = 2.2f;
+    params->gamma[1] = 2.2f;
+    params->gamma[2] = 2.2f;
+}
+
+esp_err_t color_lut_init(const color_lut_params_t* params)
+{
+    if (s_lut != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_lut = (color_lut_state_t*) calloc(1, sizeof(*s_lut));
+    if (!s_lut) {
+        return ESP_ERR_NO_MEM;
+    }
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    s_lut->lock = lock;
+    s_lut->lut = build_lut(params);
+    if (!s_lut->lut) {
+        free(s_lut);
+        s_lut = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(&s_lut->params, params, sizeof(*params));
+    ESP_LOGD(TAG, "%d point color table (%d bytes)", LUT_ENTRIES, LUT_ENTRIES * 3);
+    return ESP_OK;
+}
+
+esp_err_t color_lut_set_params(const color_lut_params_t* params)
+{
+    if (s_lut == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (int c = 0; c < 3; ++c) {
+        if (!(params->gamma[c] > 0.0f)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    uint8_t* lut = build_lut(params);
+    if (!lut) {
+        return ESP_ERR_NO_MEM;
+    }
+    portENTER_CRITICAL(&s_lut->lock);
+    uint8_t* old = s_lut->pending;
+    s_lut->pending = lut;
+    memcpy(&s_lut->params, params, sizeof(*params));
+    portEXIT_CRITICAL(&s_lut->lock);
+    // never picked up, nobody else can be using it
+    free(old);
+    return ESP_OK;
+}
+
+esp_err_t color_lut_get_params(color_lut_params_t* params)
+{
+    if (s_lut == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&s_lut->lock);
+    memcpy(params, &s_lut->params, sizeof(*params));
+    portEXIT_CRITICAL(&s_lut->lock);
+    return ESP_OK;
+}
+
+esp_err_t color_lut_load()
+{
+    nvs_handle handle;
+    color_lut_params_t params;
+    size_t length = sizeof(params);
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        // namespace does not exist before the first save
+        return ESP_ERR_NOT_FOUND;
+    }
+    err = nvs_get_blob(handle, NVS_KEY, &params, &length);
+    nvs_close(handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (length != sizeof(params)) {
+        ESP_LOGW(TAG, "Ignoring saved color calibration of %d bytes", length);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return color_lut_set_params(&params);
+}
+
+esp_err_t color_lut_save()
+{
+    nvs_handle handle;
+    color_lut_params_t params;
+    esp_err_t err = color_lut_get_params(&params);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(handle, NVS_KEY, &params, sizeof(params));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+void color_lut_apply(const backlight_yuv_t* in, backlight_rgb_t* out, size_t count)
+{
+    if (s_lut == NULL) {
+        return;
+    }
+    if (s_lut->pending) {
+        uint8_t* old = s_lut->lut;
+        portENTER_CRITICAL(&s_lut->lock);
+        s_lut->lut = s_lut->pending;
+        s_lut->pending = NULL;
+        portEXIT_CRITICAL(&s_lut->lock);
+        free(old);
+    }
+
+    const uint8_t* lut = s_lut->lut;
+    for (size_t i = 0; i < count; ++i) {
+        const int fy = in[i].y & 15;
+        const int fu = in[i].u & 15;
+        const int fv = in[i].v & 15;
+        const uint8_t* p = lut + (in[i].y >> 4) * STRIDE_Y + (in[i].u >> 4) * STRIDE_U + (in[i].v >> 4) * STRIDE_V;
+        uint8_t* dst = &out[i].r;
+        for (int c = 0; c < 3; ++c, ++p) {
+            // along v, then u, then y; weights are in 1/16
+            int c00 = (p[0] << 4) + (p[STRIDE_V] - p[0]) * fv;
+            int c01 = (p[STRIDE_U] << 4) + (p[STRIDE_U + STRIDE_V] - p[STRIDE_U]) * fv;
+            int c10 = (p[STRIDE_Y] << 4) + (p[STRIDE_Y + STRIDE_V] - p[STRIDE_Y]) * fv;
+            int c11 = (p[STRIDE_Y + STRIDE_U] << 4) + (p[STRIDE_Y + STRIDE_U + STRIDE_V] - p[STRIDE_Y + STRIDE_U]) * fv;
+            int c0 = (c00 << 4) + (c01 - c00) * fu;
+            int c1 = (c10 << 4) + (c11 - c10) * fu;
+            dst[c] = ((c0 << 4) + (c1 - c0) * fy + 2048) >> 12;
+        }
+    }
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    BACKLIGHT_CORNER_OVERLAP = 0,   //!< side zones run the full height, sharing the corners with top/bottom
+    BACKLIGHT_CORNER_EXCLUDE = 1,   //!< corners belong to the top and bottom zones only
+    BACKLIGHT_CORNER_LED = 2,       //!< one extra LED per corner samples the corner square
+} backlight_corner_t;
+
+/*
+ * LEDs are numbered in strip order: starting at the bottom left corner,
+ * up the left edge, left to right along the top, down the right edge and
+ * right to left along the bottom. Corner LEDs (BACKLIGHT_CORNER_LED) sit
+ * between the edges they join, the bottom left one is last.
+ */
+typedef struct {
+    uint16_t top;                   /*!< LEDs along the top edge */
+    uint16_t right;                 /*!< LEDs along the right edge */
+    uint16_t bottom;                /*!< LEDs along the bottom edge */
+    uint16_t left;                  /*!< LEDs along the left edge */
+    uint16_t depth;                 /*!< zone depth from the edge inwards, in pixels */
+    uint16_t row_step;              /*!< sample every n-th row of a zone */
+    backlight_corner_t corners;     /*!< corner handling */
+} backlight_layout_t;
+
+typedef struct {
+    int16_t x;
+    int16_t y;
+} backlight_point_t;
+
+typedef struct {
+    uint16_t top;
+    uint16_t bottom;
+    uint16_t left;
+    uint16_t right;
+} backlight_inset_t;
+
+typedef struct {
+    uint8_t y;
+    uint8_t u;
+    uint8_t v;
+} backlight_yuv_t;
+
+typedef enum {
+    BACKLIGHT_MODE_AVERAGE = 0,     //!< mean color of the zone
+    BACKLIGHT_MODE_DOMINANT = 1,    //!< mean color of the zone's dominant chroma bin
+} backlight_mode_t;
+
+typedef struct {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+} backlight_rgb_t;
+
+/**
+ * @brief Initialize the zone analyzer
+ *
+ * Builds the span table for the given layout and frame size. Each LED gets
+ * a list of horizontal pixel runs, so backlight_analyze only has to walk
+ * the table.
+ *
+ * @param layout LED layout
+ * @param fb_width frame width in pixels, must be even
+ * @param fb_height frame height in pixels
+ * @return ESP_OK on success
+ */
+esp_err_t backlight_init(const backlight_layout_t* layout, int fb_width, int fb_height);
+
+/**
+ * @brief Change the LED layout
+ *
+ * The span table is rebuilt by the next backlight_analyze call, so this
+ * can be called from any task while frames are being analyzed.
+ *
+ * @param layout new LED layout
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if not initialized
+ */
+esp_err_t backlight_set_layout(const backlight_layout_t* layout);
+
+/**
+ * @brief Sample a screen seen at an angle
+ *
+ * Zones are laid out on the TV screen instead of the frame borders. The
+ * screen is mapped onto the frame through the homography given by its four
+ * corners, once when the span table is rebuilt by the next backlight_analyze
+ * call; analysis cost stays the same.
+ *
+ * @param corners top left, top right, bottom right, bottom left corner of
+ *                the screen in frame pixels, or NULL to sample the whole frame
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the corners are outside
+ *         the frame or degenerate
+ */
+esp_err_t backlight_set_corners(const backlight_point_t* corners);
+
+/**
+ * @brief Find the screen corners in a frame showing a bright test screen
+ *
+ * @param fb YUV422 framebuffer
+ * @param[out] corners top left, top right, bottom right, bottom left
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if no bright screen was found
+ */
+esp_err_t backlight_detect_corners(const uint32_t* fb, backlight_point_t* corners);
+
+/**
+ * @brief Move the zones inward, e.g. past black bars
+ *
+ * Given in screen pixels, which are frame pixels unless corners are set.
+ * Like backlight_set_layout, the span table is rebuilt by the next
+ * backlight_analyze call.
+ *
+ * @param inset margins, NULL for none
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if less than a quarter
+ *         of the screen would remain in either direction
+ */
+esp_err_t backlight_set_inset(const backlight_inset_t* inset);
+
+/**
+ * @brief Get the part of the frame that is certainly screen
+ *
+ * @param[out] margins distance of the largest screen-aligned rectangle
+ *                     inside the screen corners from the frame borders;
+ *                     all zero unless corners are set
+ */
+void backlight_get_screen_margins(backlight_inset_t* margins);
+
+/**
+ * @brief Get the number of LEDs of the active layout, including corner LEDs.
+ *
+ * A layout set with backlight_set_layout becomes active on the next
+ * backlight_analyze call.
+ */
+size_t backlight_get_led_count();
+
+/**
+ * @brief Choose how zones are reduced to one color
+ *
+ * Takes effect on the next backlight_analyze call. The histogram used by
+ * BACKLIGHT_MODE_DOMINANT is allocated once, on the first switch to it.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the histogram could not be
+ *         allocated
+ */
+esp_err_t backlight_set_mode(backlight_mode_t mode);
+
+/**
+ * @brief Reduce every LED zone of a YUV422 frame to one color
+ *
+ * Zones are averaged or reduced to their dominant color, see
+ * backlight_set_mode.
+ *
+ * @param fb framebuffer as filled by the camera, 2 pixels per word
+ * @param[out] out one color per LED, in strip order
+ * @param max_leds capacity of out; LEDs beyond it are not analyzed
+ * @return ESP_OK on success
+ */
+esp_err_t backlight_analyze(const uint32_t* fb, backlight_yuv_t* out, size_t max_leds);
+
+#ifdef __cplusplus
+}
+#endif
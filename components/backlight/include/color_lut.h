@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "backlight.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Camera YUV to LED RGB through a 17x17x17 lookup table.
+ *
+ * The table bakes in the YUV to RGB conversion, a 3x3 color correction
+ * matrix (white balance, cross-talk) and per-channel LED gamma, so applying
+ * it is one trilinear lookup per LED whatever the calibration. Only the
+ * parameters are stored in NVS, the table is rebuilt from them at startup.
+ */
+
+#define COLOR_LUT_POINTS 17     //!< grid points per axis, 16 code values apart
+
+typedef struct {
+    float matrix[9];            /*!< row major, applied to camera RGB in 0..1 */
+    float gamma[3];             /*!< LED output exponent for r, g, b, 1.0 = linear */
+} color_lut_params_t;
+
+/**
+ * @brief Identity matrix and a gamma of 2.2 on all channels.
+ */
+void color_lut_default_params(color_lut_params_t* params);
+
+/**
+ * @brief Allocate the table and build it from params
+ */
+esp_err_t color_lut_init(const color_lut_params_t* params);
+
+/**
+ * @brief Rebuild the table from new parameters
+ *
+ * The table is built in a new buffer and picked up by the next
+ * color_lut_apply call, so this can run on any task.
+ */
+esp_err_t color_lut_set_params(const color_lut_params_t* params);
+
+/**
+ * @brief Get the parameters the table was last built from.
+ */
+esp_err_t color_lut_get_params(color_lut_params_t* params);
+
+/**
+ * @brief Load parameters from NVS and rebuild the table
+ *
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if nothing was saved yet
+ */
+esp_err_t color_lut_load();
+
+/**
+ * @brief Save the current parameters to NVS
+ */
+esp_err_t color_lut_save();
+
+/**
+ * @brief Map averaged LED colors to LED RGB
+ *
+ * Must always be called from the same task.
+ */
+void color_lut_apply(const backlight_yuv_t* in, backlight_rgb_t* out, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
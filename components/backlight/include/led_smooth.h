@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "backlight.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Temporal post-processing between the analyzer and the strip.
+ *
+ * Camera frames only set targets. The strip refresh calls led_smooth_render
+ * at its own rate, which first interpolates from where the output was when
+ * the latest target arrived towards that target over one measured capture
+ * interval, then applies exponential smoothing. All state is 8.8 fixed
+ * point.
+ */
+
+typedef struct {
+    uint16_t attack;        /*!< weight of the new value per refresh when a channel rises, 1-256 (256 = no smoothing) */
+    uint16_t decay;         /*!< weight of the new value per refresh when a channel falls, 1-256 */
+    bool interpolate;       /*!< spread each new target over one capture interval */
+} led_smooth_config_t;
+
+/**
+ * @brief Allocate smoothing state for led_count LEDs, all starting black.
+ */
+esp_err_t led_smooth_init(size_t led_count, const led_smooth_config_t* config);
+
+/**
+ * @brief Change attack/decay/interpolation at runtime.
+ */
+esp_err_t led_smooth_set_config(const led_smooth_config_t* config);
+
+/**
+ * @brief Get the current configuration.
+ */
+esp_err_t led_smooth_get_config(led_smooth_config_t* config);
+
+/**
+ * @brief Hand over the colors derived from a new camera frame
+ *
+ * @param rgb one color per LED; LEDs beyond count fade to black
+ * @param count number of entries in rgb
+ * @param now_us current time in microseconds (wraps)
+ */
+void led_smooth_set_target(const backlight_rgb_t* rgb, size_t count, uint32_t now_us);
+
+/**
+ * @brief Show the next target at once
+ *
+ * Call before led_smooth_set_target on a scene cut; interpolation and
+ * smoothing restart from that target.
+ */
+void led_smooth_cut();
+
+/**
+ * @brief Compute the colors to show at now_us
+ *
+ * Called once per strip refresh, independently of the capture rate.
+ *
+ * @param[out] out led_count colors
+ * @param now_us current time in microseconds, same clock as led_smooth_set_target
+ */
+void led_smooth_render(backlight_rgb_t* out, uint32_t now_us);
+
+#ifdef __cplusplus
+}
+#endif
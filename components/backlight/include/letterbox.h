@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "backlight.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Letterbox and pillarbox detection from per-row and per-column mean luma.
+ *
+ * Bars are assumed symmetric, so the smaller of top/bottom (left/right)
+ * is used, which keeps dark scene content near one edge from being taken
+ * for a bar. A new bar size has to be seen for settle_frames frames in a
+ * row before it is reported; shrinking bars are reported after a few frames
+ * since picture content in the bar area is unambiguous. Rows inside the
+ * current bars get a slightly higher black level so noise does not make
+ * them flicker.
+ */
+
+typedef struct {
+    uint8_t black_level;        /*!< rows/columns with a mean luma below this are black */
+    uint16_t min_bar;           /*!< smaller bars are ignored, in pixels */
+    uint16_t settle_frames;     /*!< frames a larger bar size must be stable */
+} letterbox_config_t;
+
+/**
+ * @brief Initialize the detector, no bars.
+ */
+esp_err_t letterbox_init(const letterbox_config_t* config);
+
+/**
+ * @brief Feed the profiles of one frame
+ *
+ * @param row_luma mean luma per frame row
+ * @param rows number of rows
+ * @param col_luma mean luma per column bucket
+ * @param cols number of column buckets
+ * @param col_width pixels per column bucket
+ * @param margins part of the frame outside the screen, see
+ *                backlight_get_screen_margins; bars are measured from there
+ * @param[out] inset bars in screen pixels, only written when they changed
+ * @return true if the bar state changed and zones should be rebuilt
+ */
+bool letterbox_update(const uint8_t* row_luma, size_t rows,
+                      const uint8_t* col_luma, size_t cols, int col_width,
+                      const backlight_inset_t* margins, backlight_inset_t* inset);
+
+#ifdef __cplusplus
+}
+#endif
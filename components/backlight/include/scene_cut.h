@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Hard cut detection from coarse frame histograms.
+ *
+ * The metric is the larger of the luma and chroma histogram L1 distances to
+ * the previous frame, scaled to 0 (same distribution) .. 256 (disjoint).
+ * Histograms hardly move with sensor noise or small motion, so the
+ * threshold can be set well above both.
+ */
+
+/**
+ * @brief Initialize the detector
+ *
+ * @param threshold metric at or above which a frame counts as a cut, 1-256
+ */
+esp_err_t scene_cut_init(uint16_t threshold);
+
+/**
+ * @brief Change the threshold, 0 disables detection.
+ */
+esp_err_t scene_cut_set_threshold(uint16_t threshold);
+
+/**
+ * @brief Compare a frame to the previous one
+ *
+ * @param luma_hist luma histogram
+ * @param luma_bins bins in luma_hist, at most 16
+ * @param chroma_hist chroma histogram
+ * @param chroma_bins bins in chroma_hist, at most 64
+ * @param samples samples counted in each histogram
+ * @param[out] metric distance to the previous frame, 0-256; may be NULL
+ * @return true if the frame is a cut
+ */
+bool scene_cut_update(const uint16_t* luma_hist, size_t luma_bins,
+                      const uint16_t* chroma_hist, size_t chroma_bins,
+                      uint32_t samples, uint16_t* metric);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "led_smooth.h"
+
+static const char* TAG = "led_smooth";
+
+// capture interval estimate is kept within these bounds
+#define MIN_INTERVAL_US 10000
+#define MAX_INTERVAL_US 500000
+
+typedef struct {
+    led_smooth_config_t config;
+    size_t channels;            // led_count * 3
+    portMUX_TYPE lock;          // guards config and the pending_* fields
+    uint8_t* pending;           // target handed over by the capture side
+    uint32_t pending_time;
+    bool has_pending;
+    bool pending_cut;           // show the next target at once
+    uint32_t last_target_time;
+    uint32_t interval;          // estimated capture interval, us
+    // owned by led_smooth_render
+    uint8_t* target;            // latest camera-derived value
+    uint16_t* from;             // 8.8, interpolation start for the latest target
+    uint16_t* interp;           // 8.8, last interpolated value
+    uint16_t* current;          // 8.8, smoothed output
+    uint32_t target_time;       // when the latest target arrived
+} led_smooth_state_t;
+
+static led_smooth_state_t* s_sm = NULL;
+
+static inline uint16_t clamp_weight(uint16_t w)
+{
+    if (w < 1) return 1;
+    if (w > 256) return 256;
+    return w;
+}
+
+esp_err_t led_smooth_init(size_t led_count, const led_smooth_config_t* config)
+{
+    if (s_sm != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (led_count == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_sm = (led_smooth_state_t*) calloc(1, sizeof(*s_sm));
+    if (!s_sm) {
+        return ESP_ERR_NO_MEM;
+    }
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    s_sm->lock = lock;
+    s_sm->channels = led_count * 3;
+    s_sm->interval = 66000;
+    s_sm->pending = (uint8_t*) calloc(s_sm->channels, sizeof(uint8_t));
+    s_sm->target = (uint8_t*) calloc(s_sm->channels, sizeof(uint8_t));
+    s_sm->from = (uint16_t*) calloc(s_sm->channels, sizeof(uint16_t));
+    s_sm->interp = (uint16_t*) calloc(s_sm->channels, sizeof(uint16_t));
+    s_sm->current = (uint16_t*) calloc(s_sm->channels, sizeof(uint16_t));
+    if (!s_sm->pending || !s_sm->target || !s_sm->from || !s_sm->interp || !s_sm->current) {
+        ESP_LOGE(TAG, "Not enough memory for %d LEDs", led_count);
+        free(s_sm->pending);
+        free(s_sm->target);
+        free(s_sm->from);
+        free(s_sm->interp);
+        free(s_sm->current);
+        free(s_sm);
+        s_sm = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return led_smooth_set_config(config);
+}
+
+esp_err_t led_smooth_set_config(const led_smooth_config_t* config)
+{
+    if (s_sm == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&s_sm->lock);
+    s_sm->config.attack = clamp_weight(config->attack);
+    s_sm->config.decay = clamp_weight(config->decay);
+    s_sm->config.interpolate = config->interpolate;
+    portEXIT_CRITICAL(&s_sm->lock);
+    ESP_LOGD(TAG, "attack=%d decay=%d interpolate=%d",
+            s_sm->config.attack, s_sm->config.decay, s_sm->config.interpolate);
+    return ESP_OK;
+}
+
+esp_err_t led_smooth_get_config(led_smooth_config_t* config)
+{
+    if (s_sm == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&s_sm->lock);
+    memcpy(config, &s_sm->config, sizeof(*config));
+    portEXIT_CRITICAL(&s_sm->lock);
+    return ESP_OK;
+}
+
+void led_smooth_set_target(const backlight_rgb_t* rgb, size_t count, uint32_t now_us)
+{
+    if (s_sm == NULL) {
+        return;
+    }
+    size_t channels = count * 3;
+    if (channels > s_sm->channels) {
+        channels = s_sm->channels;
+    }
+
+    portENTER_CRITICAL(&s_sm->lock);
+    if (s_sm->last_target_time != 0) {
+        uint32_t interval = now_us - s_sm->last_target_time;
+        if (interval < MIN_INTERVAL_US) interval = MIN_INTERVAL_US;
+        if (interval > MAX_INTERVAL_US) interval = MAX_INTERVAL_US;
+        s_sm->interval = (s_sm->interval * 3 + interval) / 4;
+    }
+    memcpy(s_sm->pending, rgb, channels);
+    memset(s_sm->pending + channels, 0, s_sm->channels - channels);
+    s_sm->pending_time = now_us;
+    s_sm->last_target_time = now_us ? now_us : 1;
+    s_sm->has_pending = true;
+    portEXIT_CRITICAL(&s_sm->lock);
+}
+
+void led_smooth_cut()
+{
+    if (s_sm == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&s_sm->lock);
+    s_sm->pending_cut = true;
+    portEXIT_CRITICAL(&s_sm->lock);
+}
+
+void led_smooth_render(backlight_rgb_t* out, uint32_t now_us)
+{
+    if (s_sm == NULL) {
+        return;
+    }
+    uint8_t* dst = (uint8_t*) out;
+    bool new_target;
+    bool cut = false;
+    uint32_t interval;
+    led_smooth_config_t config;
+
+    portENTER_CRITICAL(&s_sm->lock);
+    new_target = s_sm->has_pending;
+    if (new_target) {
+        memcpy(s_sm->target, s_sm->pending, s_sm->channels);
+        s_sm->target_time = s_sm->pending_time;
+        s_sm->has_pending = false;
+        cut = s_sm->pending_cut;
+        s_sm->pending_cut = false;
+    }
+    interval = s_sm->interval;
+    config = s_sm->config;
+    portEXIT_CRITICAL(&s_sm->lock);
+
+    if (cut) {
+        // hard cut: drop all history and jump straight to the target
+        for (size_t i = 0; i < s_sm->channels; ++i) {
+            s_sm->current[i] = s_sm->interp[i] = s_sm->from[i] = s_sm->target[i] << 8;
+            dst[i] = s_sm->target[i];
+        }
+        return;
+    }
+    if (new_target) {
+        // continue from wherever the previous interpolation got to
+        memcpy(s_sm->from, s_sm->interp, s_sm->channels * sizeof(uint16_t));
+    }
+
+    // interpolation position in 1/256 of the capture interval
+    int32_t t = 256;
+    if (config.interpolate) {
+        uint32_t elapsed = now_us - s_sm->target_time;
+        if (elapsed < interval) {
+            t = (elapsed << 8) / interval;
+        }
+    }
+    const int32_t attack = config.attack;
+    const int32_t decay = config.decay;
+    for (size_t i = 0; i < s_sm->channels; ++i) {
+        int32_t from = s_sm->from[i];
+        int32_t to = s_sm->target[i] << 8;
+        int32_t interp = from + (((to - from) * t) >> 8);
+        int32_t cur = s_sm->current[i];
+        int32_t diff = interp - cur;
+        cur += (diff * (diff > 0 ? attack : decay)) >> 8;
+        s_sm->interp[i] = interp;
+        s_sm->current[i] = cur;
+        cur = (cur + 128) >> 8;
+        dst[i] = cur > 255 ? 255 : cur;
+    }
+}
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "letterbox.h"
+
+static const char* TAG = "letterbox";
+
+// bar sizes are rounded down to this many pixels, so a bar edge falling
+// between two rows does not count as a change
+#define LETTERBOX_QUANTUM 4
+// extra black level for rows/columns inside the current bars
+#define LETTERBOX_LUMA_HYST 8
+// frames before shrinking bars are reported
+#define LETTERBOX_RELEASE_FRAMES 3
+
+#define min(a,b) ((a)<(b)?(a):(b))
+
+typedef struct {
+    letterbox_config_t config;
+    int bar_v;          // current bar height, pixels inside the screen margins
+    int bar_h;          // current bar width
+    int cand_v;         // candidate waiting to settle
+    int cand_h;
+    int cand_frames;
+} letterbox_state_t;
+
+static letterbox_state_t* s_lb = NULL;
+
+esp_err_t letterbox_init(const letterbox_config_t* config)
+{
+    if (s_lb != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_lb = (letterbox_state_t*) calloc(1, sizeof(*s_lb));
+    if (!s_lb) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(&s_lb->config, config, sizeof(*config));
+    return ESP_OK;
+}
+
+// Number of black entries from one end of profile[first, last) towards the
+// other, step is +1 or -1. The first `sticky` entries use the raised level.
+static int count_black(const uint8_t* profile, int first, int last, int step, int sticky)
+{
+    int n = 0;
+    int len = last - first;
+    int i = (step > 0) ? first : last - 1;
+    for (; n < len; ++n, i += step) {
+        int level = s_lb->config.black_level + (n < sticky ? LETTERBOX_LUMA_HYST : 0);
+        if (profile[i] >= level) {
+            break;
+        }
+    }
+    return n;
+}
+
+// Symmetric bar size in pixels, or -1 if the whole range is black.
+static int measure_bar(const uint8_t* profile, int first, int last, int unit, int current)
+{
+    int len = last - first;
+    if (len <= 0) {
+        return 0;
+    }
+    int sticky = current / unit;
+    int a = count_black(profile, first, last, 1, sticky);
+    if (a == len) {
+        return -1;
+    }
+    int b = count_black(profile, first, last, -1, sticky);
+    int bar = min(min(a, b), len / 3) * unit;
+    bar -= bar % LETTERBOX_QUANTUM;
+    return bar < s_lb->config.min_bar ? 0 : bar;
+}
+
+bool letterbox_update(const uint8_t* row_luma, size_t rows,
+                      const uint8_t* col_luma, size_t cols, int col_width,
+                      const backlight_inset_t* margins, backlight_inset_t* inset)
+{
+    if (s_lb == NULL || rows == 0 || cols == 0) {
+        return false;
+    }
+    const int width = cols * col_width;
+    const int r0 = margins->top;
+    const int r1 = rows - margins->bottom;
+    const int c0 = (margins->left + col_width - 1) / col_width;
+    const int c1 = cols - (margins->right + col_width - 1) / col_width;
+
+    int bar_v = measure_bar(row_luma, r0, r1, 1, s_lb->bar_v);
+    int bar_h = measure_bar(col_luma, c0, c1, col_width, s_lb->bar_h);
+    if (bar_v < 0 || bar_h < 0) {
+        // fade to black or a dark scene, nothing to learn from it
+        s_lb->cand_frames = 0;
+        return false;
+    }
+    if (bar_v == s_lb->bar_v && bar_h == s_lb->bar_h) {
+        s_lb->cand_frames = 0;
+        return false;
+    }
+    if (bar_v != s_lb->cand_v || bar_h != s_lb->cand_h) {
+        s_lb->cand_v = bar_v;
+        s_lb->cand_h = bar_h;
+        s_lb->cand_frames = 0;
+    }
+    s_lb->cand_frames++;
+    int needed = s_lb->config.settle_frames;
+    if (bar_v <= s_lb->bar_v && bar_h <= s_lb->bar_h) {
+        needed = min(needed, LETTERBOX_RELEASE_FRAMES);
+    }
+    if (s_lb->cand_frames < needed) {
+        return false;
+    }
+
+    s_lb->bar_v = bar_v;
+    s_lb->bar_h = bar_h;
+    s_lb->cand_frames = 0;
+    // zones live in screen coordinates, which span the whole frame
+    inset->top = inset->bottom = (r1 > r0) ? bar_v * (int) rows / (r1 - r0) : 0;
+    inset->left = inset->right = (c1 > c0) ? bar_h * width / ((c1 - c0) * col_width) : 0;
+    ESP_LOGI(TAG, "Bars changed: %d px top/bottom, %d px left/right", inset->top, inset->left);
+    return true;
+}
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "scene_cut.h"
+
+static const char* TAG = "scene_cut";
+
+#define SCENE_CUT_MAX_LUMA_BINS 16
+#define SCENE_CUT_MAX_CHROMA_BINS 64
+
+typedef struct {
+    uint16_t threshold;
+    bool have_previous;
+    uint32_t samples;
+    uint16_t luma[SCENE_CUT_MAX_LUMA_BINS];
+    uint16_t chroma[SCENE_CUT_MAX_CHROMA_BINS];
+} scene_cut_state_t;
+
+static scene_cut_state_t* s_sc = NULL;
+
+esp_err_t scene_cut_init(uint16_t threshold)
+{
+    if (s_sc != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_sc = (scene_cut_state_t*) calloc(1, sizeof(*s_sc));
+    if (!s_sc) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_sc->threshold = threshold;
+    return ESP_OK;
+}
+
+esp_err_t scene_cut_set_threshold(uint16_t threshold)
+{
+    if (s_sc == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_sc->threshold = threshold;
+    return ESP_OK;
+}
+
+// sum |a - b| is at most 2 * samples, so this is 0..256
+static uint32_t distance(const uint16_t* a, const uint16_t* b, size_t bins, uint32_t samples)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < bins; ++i) {
+        sum += abs((int) a[i] - (int) b[i]);
+    }
+    return (sum << 7) / samples;
+}
+
+bool scene_cut_update(const uint16_t* luma_hist, size_t luma_bins,
+                      const uint16_t* chroma_hist, size_t chroma_bins,
+                      uint32_t samples, uint16_t* metric)
+{
+    if (s_sc == NULL || samples == 0 ||
+        luma_bins > SCENE_CUT_MAX_LUMA_BINS || chroma_bins > SCENE_CUT_MAX_CHROMA_BINS) {
+        return false;
+    }
+    uint32_t d = 0;
+    bool comparable = s_sc->have_previous && s_sc->samples == samples;
+    if (comparable) {
+        uint32_t dl = distance(luma_hist, s_sc->luma, luma_bins, samples);
+        uint32_t dc = distance(chroma_hist, s_sc->chroma, chroma_bins, samples);
+        d = dl > dc ? dl : dc;
+    }
+    memcpy(s_sc->luma, luma_hist, luma_bins * sizeof(uint16_t));
+    memcpy(s_sc->chroma, chroma_hist, chroma_bins * sizeof(uint16_t));
+    s_sc->samples = samples;
+    s_sc->have_previous = true;
+    if (metric) {
+        *metric = d;
+    }
+    if (comparable && s_sc->threshold > 0 && d >= s_sc->threshold) {
+        ESP_LOGD(TAG, "Cut, distance %d", d);
+        return true;
+    }
+    return false;
+}
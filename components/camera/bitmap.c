@@ -48,15 +48,15 @@ char *bmp_create_header(int w, int h)
 	return (char *)pbitmap;
 }
 
-char *bmp_create_header565(int w, int h)
+void bmp_init_header565(bitmap565 *pbitmap, int w, int h)
 {
 	const int _bitsperpixel = 16;
 
-	bitmap565 *pbitmap  = (bitmap565*)calloc(1, sizeof(bitmap565));
 	int _pixelbytesize = w * h * _bitsperpixel/8;
 	int _filesize = _pixelbytesize+sizeof(bitmap565);
+	memset(pbitmap, 0, sizeof(bitmap565));
 	// bitmap565 is 12 bytes larger than std bitmap
-	strcpy((char*)pbitmap->fileheader.signature, "BM");
+	memcpy(pbitmap->fileheader.signature, "BM", 2);
 	pbitmap->fileheader.filesize = _filesize;
 	pbitmap->fileheader.fileoffset_to_pixelarray = sizeof(bitmap565);
 	pbitmap->bitmapinfoheader.dibheadersize = sizeof(bitmapinfoheader);
@@ -73,5 +73,12 @@ char *bmp_create_header565(int w, int h)
 	pbitmap->bitmapinfoheader.BF1 = bits565[0];
 	pbitmap->bitmapinfoheader.BF2 = bits565[1];
 	pbitmap->bitmapinfoheader.BF3 = bits565[2];
+}
+
+char *bmp_create_header565(int w, int h)
+{
+	bitmap565 *pbitmap  = (bitmap565*)malloc(sizeof(bitmap565));
+	if (pbitmap)
+		bmp_init_header565(pbitmap, w, h);
 	return (char *)pbitmap;
 }
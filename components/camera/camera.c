@@ -41,6 +41,8 @@
 #include "esp_intr_alloc.h"
 #include "esp_heap_alloc_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "xtensa/hal.h"
 #include "sensor.h"
 #include "sccb.h"
 #include "wiring.h"
@@ -68,6 +70,10 @@ static const char* TAG = "camera";
 
 camera_state_t* s_state = NULL;
 
+// kept over camera_init calls, written by the ISR and the filter task only
+static volatile uint32_t s_dropped_lines = 0;
+static volatile uint32_t s_dma_overruns = 0;
+
 const int resolution[][2] = {
         { 40, 30 }, /* 40x30 */
         { 64, 32 }, /* 64x32 */
@@ -100,6 +106,8 @@ static void dma_filter_task(void *pvParameters);
 //static void dma_filter_grayscale_highspeed(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst);
 //static void dma_filter_jpeg(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst);
 static void dma_filter_raw(const dma_elem_t* src, lldesc_t* dma_desc, uint32_t* dst);
+static void luma_profile_line(size_t line);
+static void luma_profile_finish();
 
 static void i2s_stop();
 
@@ -545,6 +553,47 @@ int camera_get_fb_width()
     return s_state->width;
 }
 
+uint32_t camera_get_frame_count()
+{
+    if (s_state == NULL) {
+        return 0;
+    }
+    return s_state->frame_count;
+}
+
+void camera_get_frame_timing(uint32_t* vsync_us, uint32_t* done_us)
+{
+    if (s_state == NULL) {
+        *vsync_us = 0;
+        *done_us = 0;
+        return;
+    }
+    *vsync_us = s_state->vsync_time;
+    *done_us = s_state->frame_done_time;
+}
+
+uint32_t camera_get_filter_us()
+{
+    if (s_state == NULL) {
+        return 0;
+    }
+    return s_state->filter_us;
+}
+
+void camera_get_dma_stats(uint32_t* dropped_lines, uint32_t* overruns)
+{
+    *dropped_lines = s_dropped_lines;
+    *overruns = s_dma_overruns;
+}
+
+const camera_luma_profile_t* camera_get_luma_profile()
+{
+    if (s_state == NULL || !s_state->profile_valid) {
+        return NULL;
+    }
+    return &s_state->profile;
+}
+
 int camera_get_fb_height()
 {
     if (s_state == NULL) {
@@ -805,12 +854,19 @@ static void i2s_run()
     while (gpio_get_level(s_state->config.pin_vsync) != 0) {
         ;
     }
+    s_state->vsync_time = (uint32_t) esp_timer_get_time();
     ESP_LOGD(TAG, "Got VSYNC");
 
     s_state->dma_done = false;
     s_state->dma_desc_cur = 0;
     s_state->dma_received_count = 0;
     s_state->dma_filtered_count = 0;
+    s_state->filter_cycles = 0;
+    s_state->profile_valid = false;
+    s_state->profile_col_rows = 0;
+    memset(s_state->profile_col_sum, 0, sizeof(s_state->profile_col_sum));
+    memset(s_state->profile.luma_hist, 0, sizeof(s_state->profile.luma_hist));
+    memset(s_state->profile.chroma_hist, 0, sizeof(s_state->profile.chroma_hist));
     esp_intr_disable(s_state->i2s_intr_handle);
     i2s_conf_reset();
 
@@ -835,6 +891,10 @@ static void IRAM_ATTR signal_dma_buf_received(bool* need_yield)
     size_t dma_desc_filled = s_state->dma_desc_cur;
     s_state->dma_desc_cur = (dma_desc_filled + 1) % s_state->dma_desc_count;
     s_state->dma_received_count++;
+    // the ring wrapped onto a buffer the filter task has not read yet
+    if (s_state->dma_received_count - s_state->dma_filtered_count > s_state->dma_desc_count) {
+        s_dma_overruns++;
+    }
     BaseType_t higher_priority_task_woken;
     BaseType_t ret = xQueueSendFromISR(s_state->data_ready, &dma_desc_filled, &higher_priority_task_woken);
     if (ret != pdTRUE) {
@@ -888,7 +948,16 @@ static void IRAM_ATTR dma_filter_task(void *pvParameters)
         size_t buf_idx;
         xQueueReceive(s_state->data_ready, &buf_idx, portMAX_DELAY);
         if (buf_idx == SIZE_MAX) {
+            size_t expected = s_state->height * s_state->dma_per_line;
             s_state->data_size = get_fb_pos();
+            s_state->frame_done_time = (uint32_t) esp_timer_get_time();
+            s_state->filter_us = s_state->filter_cycles / CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+            // JPEG frames have no fixed line count
+            if (s_state->config.pixel_format != CAMERA_PF_JPEG &&
+                    s_state->dma_filtered_count < expected) {
+                s_dropped_lines += (expected - s_state->dma_filtered_count) / s_state->dma_per_line;
+            }
+            luma_profile_finish();
             xSemaphoreGive(s_state->frame_ready);
             continue;
         }
@@ -898,10 +967,64 @@ static void IRAM_ATTR dma_filter_task(void *pvParameters)
         const dma_elem_t* buf = s_state->dma_buf[buf_idx];
         lldesc_t* desc = &s_state->dma_desc[buf_idx];
         ESP_LOGV(TAG, "dma_flt: pos=%d ", get_fb_pos()/4);
+        uint32_t start = xthal_get_ccount();
         (*s_state->dma_filter)(buf, desc, pfb);
+        s_state->filter_cycles += xthal_get_ccount() - start;
         s_state->dma_filtered_count++;
         ESP_LOGV(TAG, "dma_flt: flt_count=%d ", s_state->dma_filtered_count);
+        if (s_state->config.pixel_format == CAMERA_PF_YUV422 &&
+                s_state->dma_filtered_count % s_state->dma_per_line == 0) {
+            // the whole line is in the framebuffer now, still in cache
+            luma_profile_line(s_state->dma_filtered_count / s_state->dma_per_line - 1);
+        }
+    }
+}
+
+// Samples y1 of every second word, i.e. every 4th pixel.
+static void IRAM_ATTR luma_profile_line(size_t line)
+{
+    const size_t words = s_state->width / 2;
+    const size_t cols = (words + 1) / 2;
+    if (line >= CAMERA_PROFILE_MAX_ROWS || cols > CAMERA_PROFILE_MAX_COLS) {
+        return;
+    }
+    const uint32_t* row = s_state->fb + line * words;
+    uint32_t sum = 0;
+    if (line % CAMERA_PROFILE_ROW_STEP == 0) {
+        uint32_t* col_sum = s_state->profile_col_sum;
+        uint16_t* luma_hist = s_state->profile.luma_hist;
+        uint16_t* chroma_hist = s_state->profile.chroma_hist;
+        for (size_t i = 0; i < words; i += 2) {
+            uint32_t w = row[i];
+            uint32_t y = w & 0xFF;
+            sum += y;
+            *col_sum++ += y;
+            luma_hist[y >> 4]++;
+            chroma_hist[((w >> 29) << 3) | ((w >> 13) & 0x07)]++;
+        }
+        s_state->profile_col_rows++;
+    } else {
+        for (size_t i = 0; i < words; i += 2) {
+            sum += row[i] & 0xFF;
+        }
+    }
+    s_state->profile.row_luma[line] = sum / cols;
+}
+
+static void luma_profile_finish()
+{
+    const size_t cols = (s_state->width / 2 + 1) / 2;
+    if (s_state->config.pixel_format != CAMERA_PF_YUV422 || s_state->profile_col_rows == 0 ||
+            s_state->height > CAMERA_PROFILE_MAX_ROWS || cols > CAMERA_PROFILE_MAX_COLS) {
+        return;
+    }
+    for (size_t i = 0; i < cols; ++i) {
+        s_state->profile.col_luma[i] = s_state->profile_col_sum[i] / s_state->profile_col_rows;
     }
+    s_state->profile.rows = s_state->height;
+    s_state->profile.cols = cols;
+    s_state->profile.hist_samples = cols * s_state->profile_col_rows;
+    s_state->profile_valid = true;
 }
 
 
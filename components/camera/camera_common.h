@@ -80,6 +80,16 @@ typedef struct {
     SemaphoreHandle_t frame_ready;
     TaskHandle_t dma_filter_task;
 
+    uint32_t vsync_time;        // us, start of the last frame
+    uint32_t frame_done_time;   // us, last line filtered
+    uint32_t filter_cycles;     // CPU cycles in the DMA filter, this frame
+    uint32_t filter_us;         // same for the last frame
+
+    camera_luma_profile_t profile;
+    uint32_t profile_col_sum[CAMERA_PROFILE_MAX_COLS];
+    size_t profile_col_rows;
+    bool profile_valid;
+
     // TODO: link LCD to sensor so that latest image is displayed...
     //TaskHandle_t lcd_display_task;
 
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <string.h>
+#include "delta.h"
+
+#define CELLS_PER_ROW (DELTA_BLOCK / DELTA_CELL)
+
+static inline void put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static inline void set_bit(uint8_t* bits, int i)
+{
+    bits[i >> 3] |= 1 << (i & 7);
+}
+
+static inline bool get_bit(const uint8_t* bits, int i)
+{
+    return (bits[i >> 3] >> (i & 7)) & 1;
+}
+
+static size_t bitmap_bytes(const delta_encoder_t* enc)
+{
+    return (enc->blocks_x * enc->blocks_y + 7) / 8;
+}
+
+// pixels of a block inside the frame
+static int block_cols(const delta_encoder_t* enc, int bx)
+{
+    int cols = enc->width - bx * DELTA_BLOCK;
+    return cols < DELTA_BLOCK ? cols : DELTA_BLOCK;
+}
+
+static int block_rows(const delta_encoder_t* enc, int by)
+{
+    int rows = enc->height - by * DELTA_BLOCK;
+    return rows < DELTA_BLOCK ? rows : DELTA_BLOCK;
+}
+
+static const uint8_t* block_row(const delta_encoder_t* enc, const uint8_t* fb, int bx, int by, int y)
+{
+    return fb + ((size_t) (by * DELTA_BLOCK + y) * enc->width + bx * DELTA_BLOCK) * enc->bytes_per_pixel;
+}
+
+// luma of pixel x of a row: y1 and y2 are the even bytes of a YUV422 word;
+// green stands in for RGB565, whose pixels come in byte swapped pairs,
+// which does not matter within a cell
+static inline int luma(camera_pixelformat_t format, const uint8_t* row, int x)
+{
+    const uint8_t* p;
+    switch (format) {
+        case CAMERA_PF_GRAYSCALE:
+            return row[x];
+        case CAMERA_PF_YUV422:
+            return row[x * 2];
+        default:
+            p = row + x * 2;
+            return (((p[0] & 0x07) << 3) | (p[1] >> 5)) << 2;
+    }
+}
+
+static void cell_means(const delta_encoder_t* enc, const uint8_t* fb, int bx, int by,
+                       uint8_t* means)
+{
+    uint16_t sums[DELTA_CELLS] = { 0 };
+    uint8_t counts[DELTA_CELLS] = { 0 };
+    int rows = block_rows(enc, by), cols = block_cols(enc, bx);
+
+    for (int y = 0; y < rows; y++) {
+        const uint8_t* row = block_row(enc, fb, bx, by, y);
+        int cell = (y / DELTA_CELL) * CELLS_PER_ROW;
+        for (int x = 0; x < cols; x++) {
+            sums[cell + x / DELTA_CELL] += luma(enc->format, row, x);
+            counts[cell + x / DELTA_CELL]++;
+        }
+    }
+    for (int i = 0; i < DELTA_CELLS; i++) {
+        if (counts[i] == DELTA_CELL * DELTA_CELL) {
+            means[i] = sums[i] / (DELTA_CELL * DELTA_CELL);
+        } else {
+            means[i] = counts[i] ? sums[i] / counts[i] : 0;
+        }
+    }
+}
+
+esp_err_t delta_encoder_init(delta_encoder_t* enc, int width, int height,
+                             camera_pixelformat_t format, uint32_t threshold)
+{
+    memset(enc, 0, sizeof(delta_encoder_t));
+    if (format == CAMERA_PF_GRAYSCALE) {
+        enc->bytes_per_pixel = 1;
+    } else if (format == CAMERA_PF_YUV422 || format == CAMERA_PF_RGB565) {
+        enc->bytes_per_pixel = 2;
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    // whole YUV422 words and RGB565 pairs per block row
+    if (width < 2 || height < 1 || (width & 1)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    enc->width = width;
+    enc->height = height;
+    enc->format = format;
+    enc->threshold = threshold;
+    enc->blocks_x = (width + DELTA_BLOCK - 1) / DELTA_BLOCK;
+    enc->blocks_y = (height + DELTA_BLOCK - 1) / DELTA_BLOCK;
+    enc->ref = (uint8_t*) malloc(enc->blocks_x * enc->blocks_y * DELTA_CELLS);
+    enc->coded = (uint8_t*) calloc(bitmap_bytes(enc), 1);
+    enc->force = (uint8_t*) calloc(bitmap_bytes(enc), 1);
+    enc->need_key = true;
+    if (enc->ref == NULL || enc->coded == NULL || enc->force == NULL) {
+        delta_encoder_free(enc);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void delta_encoder_free(delta_encoder_t* enc)
+{
+    free(enc->ref);
+    free(enc->coded);
+    free(enc->force);
+    enc->ref = NULL;
+    enc->coded = NULL;
+    enc->force = NULL;
+}
+
+bool delta_encoder_need_key(const delta_encoder_t* enc)
+{
+    return enc->need_key;
+}
+
+void delta_encoder_key(delta_encoder_t* enc, const uint8_t* fb)
+{
+    for (int by = 0; by < enc->blocks_y; by++) {
+        for (int bx = 0; bx < enc->blocks_x; bx++) {
+            cell_means(enc, fb, bx, by, enc->ref + (by * enc->blocks_x + bx) * DELTA_CELLS);
+        }
+    }
+    memset(enc->coded, 0, bitmap_bytes(enc));
+    memset(enc->force, 0, bitmap_bytes(enc));
+    enc->last_key = true;
+    enc->need_key = false;
+}
+
+esp_err_t delta_encode(delta_encoder_t* enc, const uint8_t* fb, uint8_t* out, size_t capacity,
+                       size_t max_records, size_t* len, int* blocks)
+{
+    const uint8_t* end = out + capacity;
+    uint8_t* slice = out;
+    uint8_t* p = out + DELTA_SLICE_HEADER;
+    uint8_t means[DELTA_CELLS];
+    size_t records = 0;
+    int skip = 0, count = 0;
+
+    if (capacity < DELTA_SLICE_HEADER) {
+        enc->need_key = true;
+        return ESP_ERR_NO_MEM;
+    }
+    put16(slice, 0);
+    memset(enc->coded, 0, bitmap_bytes(enc));
+    for (int b = 0; b < enc->blocks_x * enc->blocks_y; b++) {
+        int bx = b % enc->blocks_x, by = b / enc->blocks_x;
+        int rows = block_rows(enc, by);
+        size_t row_bytes = block_cols(enc, bx) * enc->bytes_per_pixel;
+        size_t size = 2 + rows * row_bytes;
+        uint8_t* ref = enc->ref + b * DELTA_CELLS;
+
+        cell_means(enc, fb, bx, by, means);
+        if (!get_bit(enc->force, b)) {
+            uint32_t sad = 0;
+            for (int i = 0; i < DELTA_CELLS; i++) {
+                sad += abs(means[i] - ref[i]);
+            }
+            if (sad * DELTA_CELL * DELTA_CELL <= enc->threshold) {
+                skip++;
+                continue;
+            }
+        }
+
+        if (records > 0 && records + size > max_records) {
+            // the next slice starts at this block
+            put16(slice + 2, records);
+            slice = p;
+            p += DELTA_SLICE_HEADER;
+            records = 0;
+            skip = 0;
+            if (p > end) {
+                enc->need_key = true;
+                return ESP_ERR_NO_MEM;
+            }
+            put16(slice, b);
+        }
+        if (p + size > end) {
+            enc->need_key = true;
+            return ESP_ERR_NO_MEM;
+        }
+        put16(p, skip);
+        p += 2;
+        for (int y = 0; y < rows; y++) {
+            memcpy(p, block_row(enc, fb, bx, by, y), row_bytes);
+            p += row_bytes;
+        }
+        records += size;
+        skip = 0;
+        memcpy(ref, means, DELTA_CELLS);
+        set_bit(enc->coded, b);
+        count++;
+    }
+    put16(slice + 2, records);
+    memset(enc->force, 0, bitmap_bytes(enc));
+    enc->last_key = false;
+    *len = p - out;
+    *blocks = count;
+    return ESP_OK;
+}
+
+void delta_encoder_resend(delta_encoder_t* enc)
+{
+    if (enc->last_key) {
+        enc->need_key = true;
+        return;
+    }
+    for (size_t i = 0; i < bitmap_bytes(enc); i++) {
+        enc->force[i] |= enc->coded[i];
+    }
+}
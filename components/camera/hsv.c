@@ -0,0 +1,138 @@
+#include <stdbool.h>
+#include "hsv.h"
+
+// hue units per sextant of the circle, 65536 / 6
+#define HUE_SEXTANT 10923
+
+// s_hue_step[d] = HUE_SEXTANT / d in 24.8, s_sat_scale[m] = 255 / m in 16.16;
+// entry 0 is never used
+static uint32_t s_hue_step[256];
+static uint32_t s_sat_scale[256];
+static bool s_initialised = false;
+
+static void init_tables()
+{
+    for (uint32_t i = 1; i < 256; ++i) {
+        s_hue_step[i] = ((HUE_SEXTANT << 8) + i / 2) / i;
+        s_sat_scale[i] = ((255 << 16) + i / 2) / i;
+    }
+    // tables are only ever written with the same values, racing here is harmless
+    s_initialised = true;
+}
+
+// exact x / 255 for x < 65536
+static inline uint32_t div255(uint32_t x)
+{
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+// hue of a color given its max and the spread between max and min, delta > 0
+static inline uint16_t hue_of(int r, int g, int b, int max, int delta)
+{
+    int base, diff;
+    if (r == max) {
+        base = 0;
+        diff = g - b;
+    } else if (g == max) {
+        base = 2 * HUE_SEXTANT;
+        diff = b - r;
+    } else {
+        base = 4 * HUE_SEXTANT;
+        diff = r - g;
+    }
+    // diff is within +-delta, so the product stays within +-HUE_SEXTANT << 8;
+    // negative hues wrap around in the cast
+    return (uint16_t) (base + ((diff * (int32_t) s_hue_step[delta]) >> 8));
+}
+
+void hsv_from_rgb(const uint8_t* rgb, hsv_t* out, size_t count)
+{
+    if (!s_initialised) {
+        init_tables();
+    }
+    for (size_t i = 0; i < count; ++i, rgb += 3) {
+        int r = rgb[0], g = rgb[1], b = rgb[2];
+        int max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+        int min = r < g ? (r < b ? r : b) : (g < b ? g : b);
+        int delta = max - min;
+        out[i].v = max;
+        if (delta == 0) {
+            out[i].h = 0;
+            out[i].s = 0;
+        } else {
+            out[i].h = hue_of(r, g, b, max, delta);
+            out[i].s = (delta * s_sat_scale[max] + 0x8000) >> 16;
+        }
+    }
+}
+
+void hsl_from_rgb(const uint8_t* rgb, hsl_t* out, size_t count)
+{
+    if (!s_initialised) {
+        init_tables();
+    }
+    for (size_t i = 0; i < count; ++i, rgb += 3) {
+        int r = rgb[0], g = rgb[1], b = rgb[2];
+        int max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+        int min = r < g ? (r < b ? r : b) : (g < b ? g : b);
+        int delta = max - min;
+        int sum = max + min;
+        out[i].l = (sum + 1) >> 1;
+        if (delta == 0) {
+            out[i].h = 0;
+            out[i].s = 0;
+        } else {
+            // s = delta / (1 - |2l - 1|); the divisor is in 1..255 as delta > 0
+            int span = sum <= 255 ? sum : 510 - sum;
+            out[i].h = hue_of(r, g, b, max, delta);
+            out[i].s = (delta * s_sat_scale[span] + 0x8000) >> 16;
+        }
+    }
+}
+
+void hsv_to_rgb(const hsv_t* in, uint8_t* rgb, size_t count)
+{
+    for (size_t i = 0; i < count; ++i, rgb += 3) {
+        uint32_t v = in[i].v;
+        uint32_t s = in[i].s;
+        uint32_t h6 = (uint32_t) in[i].h * 6;
+        uint32_t sextant = h6 >> 16;
+        uint32_t f = (h6 >> 8) & 0xff;
+        uint8_t p = div255(v * (255 - s));
+        uint8_t q = div255(v * (255 - div255(s * f)));
+        uint8_t t = div255(v * (255 - div255(s * (255 - f))));
+        uint8_t r, g, b;
+        switch (sextant) {
+            case 0:  r = v; g = t; b = p; break;
+            case 1:  r = q; g = v; b = p; break;
+            case 2:  r = p; g = v; b = t; break;
+            case 3:  r = p; g = q; b = v; break;
+            case 4:  r = t; g = p; b = v; break;
+            default: r = v; g = p; b = q; break;
+        }
+        rgb[0] = r;
+        rgb[1] = g;
+        rgb[2] = b;
+    }
+}
+
+void hsv_scale_saturation(uint8_t* rgb, size_t count, uint16_t gain)
+{
+    if (gain == 256) {
+        return;
+    }
+    for (size_t i = 0; i < count; ++i, rgb += 3) {
+        int r = rgb[0], g = rgb[1], b = rgb[2];
+        int max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+        int min = r < g ? (r < b ? r : b) : (g < b ? g : b);
+        if (max == min) {
+            continue;
+        }
+        // every channel moves away from max by gain, which scales delta / max
+        // and keeps max and the hue, until the smallest channel hits 0
+        for (int c = 0; c < 3; ++c) {
+            int x = max - (((max - rgb[c]) * gain + 128) >> 8);
+            rgb[c] = x < 0 ? 0 : x;
+        }
+    }
+}
@@ -29,164 +29,16 @@ typedef struct {
   double s;       // percent
   double v;       // percent
 } hsv;
-typedef struct {
-  float h;       // angle in degrees
-  float s;       // percent
-  float v;       // percent
-} hsvF;
 
 
 
-static hsv rgb2hsv(rgb in);
 static rgb rgb565to888(uint16_t  in);
 static uint16_t rgb888to565(uint8_t r, uint8_t g, uint8_t b);
-static hsv rgb888toHSB(uint8_t red, uint8_t green, uint8_t blue);
 static rgb hsv2rgb888(hsv in);
 static uint16_t hsv2rgb565_i(hsv in);
 
-static hsv rgb888toHSB(uint8_t red, uint8_t green, uint8_t blue) {
-  double r = red / 255.0f;
-  double g = green / 255.0f;
-  double b = blue / 255.0f;
-  double max = max(max(r, g), b);
-  double min = min(min(r, g), b);
-  double delta = max - min;
-  double hue = 0;
-  double brightness = max;
-  double saturation = max == 0 ? 0 : (max - min) / max;
-  if (delta != 0) {
-    if (r == max) {
-      hue = (g - b) / delta;
-    }
-    else {
-      if (g == max) {
-        hue = 2 + (b - r) / delta;
-      }
-      else {
-        hue = 4 + (r - g) / delta;
-      }
-    }
-    hue *= 60;
-    if (hue < 0) hue += 360;
-  }
-  hsv hsv1;
-  hsv1.h = hue;
-  hsv1.s = saturation;
-  hsv1.v = brightness;
-
-  return hsv1;
-
+// RGB to HSV lives in hsv.c, in fixed point
 
-}
-#define swapFloat(a, b) { float t = a; a = b; b = t; }
-
-static void RGB2H(uint8_t red, uint8_t green, uint8_t blue,	float *h){
-
-  float r = red / 255.0f;
-  float g = green / 255.0f;
-  float b = blue / 255.0f;
-  float max = fmaxf(fmaxf(r, g), b);
-  float min = fminf(fminf(r, g), b);
-  float delta = max - min;
-  if (delta != 0)
-  {
-    float hue;
-    if (r == max)
-    {
-      hue = (g - b) / delta;
-    }
-    else
-    {
-      if (g == max)
-      {
-        hue = 2 + (b - r) / delta;
-      }
-      else
-      {
-        hue = 4 + (r - g) / delta;
-      }
-    }
-    hue *= 60;
-    if (hue < 0) hue += 360;
-    *h = hue;
-  }
-  else
-  {
-    *h = 0;
-  }
-  //s = max == 0 ? 0 : (max - min) / max;
-  //b = max;
-}
-
-
-static void RGB2HSV_old(float r, float g, float b,	float *h, float *s, float *v)
-{
-  // da http://lolengine.net/blog/2013/01/13/fast-rgb-to-hsv
-  float K = 0.f;
-
-  if (g < b)
-  {
-    swapFloat(g, b);
-    K = -1.f;
-  }
-
-  if (r < g)
-  {
-    swapFloat(r, g);
-    K = -2.f / 6.f - K;
-  }
-
-  float chroma = r - min(g, b);
-  *h = fabs(K + (g - b) / (6.f * chroma + 1e-20f));
-  *s = chroma / (r + 1e-20f);
-  *v = r;
-}
-
-hsv rgb2hsv(rgb in)
-{
-  // da http://stackoverflow.com/questions/3018313/algorithm-to-convert-rgb-to-hsv-and-hsv-to-rgb-in-range-0-255-for-both
-  hsv         out;
-  double      min, max, delta;
-
-  min = in.r < in.g ? in.r : in.g;
-  min = min  < in.b ? min : in.b;
-
-  max = in.r > in.g ? in.r : in.g;
-  max = max  > in.b ? max : in.b;
-
-  out.v = max;                                // v
-  delta = max - min;
-  if (delta < 0.00001)
-  {
-    out.s = 0;
-    out.h = 0; // undefined, maybe nan?
-    return out;
-  }
-  if (max > 0.0) { // NOTE: if Max is == 0, this divide would cause a crash
-    out.s = (delta / max);                  // s
-  }
-  else {
-    // if max is 0, then r = g = b = 0
-    // s = 0, v is undefined
-    out.s = 0.0;
-    out.h = -1; //NAN;                            // its now undefined
-    return out;
-  }
-  if (in.r >= max)                           // > is bogus, just keeps compilor happy
-    out.h = (in.g - in.b) / delta;        // between yellow & magenta
-  else
-    if (in.g >= max)
-      out.h = 2.0 + (in.b - in.r) / delta;  // between cyan & yellow
-    else
-      out.h = 4.0 + (in.r - in.g) / delta;  // between magenta & cyan
-
-  out.h *= 60.0;                              // degrees
-
-  if (out.h < 0.0)
-    out.h += 360.0;
-
-  return out;
-}
 uint16_t rgb888to565(uint8_t r, uint8_t g, uint8_t b) {
   //rrrrr ggg ggg bbbbb
   uint16_t rgb565=0;
@@ -66,5 +66,7 @@ typedef struct {
 
 char *bmp_create_header(int w, int h);
 char *bmp_create_header565(int w, int h);
+// fill in a header in place, e.g. at the start of an output buffer
+void bmp_init_header565(bitmap565 *header, int w, int h);
 
 #endif
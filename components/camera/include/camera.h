@@ -81,6 +81,25 @@ typedef struct {
 
 } camera_config_t;
 
+// Luma profiles collected while filtering YUV422 frames
+#define CAMERA_PROFILE_MAX_ROWS     240
+#define CAMERA_PROFILE_MAX_COLS     80
+#define CAMERA_PROFILE_COL_WIDTH    4   //!< pixels per column profile entry
+#define CAMERA_PROFILE_ROW_STEP     4   //!< every n-th row goes into the column profile
+#define CAMERA_HIST_LUMA_BINS       16  //!< y >> 4
+#define CAMERA_HIST_CHROMA_BINS     64  //!< (u >> 5) << 3 | v >> 5
+
+typedef struct {
+    size_t rows;                                    /*!< valid entries in row_luma */
+    size_t cols;                                    /*!< valid entries in col_luma */
+    uint8_t row_luma[CAMERA_PROFILE_MAX_ROWS];      /*!< mean luma of each frame row */
+    uint8_t col_luma[CAMERA_PROFILE_MAX_COLS];      /*!< mean luma of each CAMERA_PROFILE_COL_WIDTH pixel wide column */
+    // coarse histograms over the column profile sample grid
+    uint16_t luma_hist[CAMERA_HIST_LUMA_BINS];
+    uint16_t chroma_hist[CAMERA_HIST_CHROMA_BINS];
+    uint16_t hist_samples;                          /*!< samples in each histogram */
+} camera_luma_profile_t;
+
 #define ESP_ERR_CAMERA_BASE 0x20000
 #define ESP_ERR_CAMERA_NOT_DETECTED             (ESP_ERR_CAMERA_BASE + 1)
 #define ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE (ESP_ERR_CAMERA_BASE + 2)
@@ -154,6 +173,51 @@ int camera_get_fb_height();
  */
 esp_err_t camera_run();
 
+/**
+ * @brief Get the number of frames captured since camera_init
+ *
+ * Identifies the frame in the framebuffer; restarts from 0 when the camera
+ * is initialized again.
+ */
+uint32_t camera_get_frame_count();
+
+/**
+ * @brief Get the timing of the last frame
+ *
+ * Microseconds on the esp_timer clock, truncated to 32 bits.
+ *
+ * @param[out] vsync_us when the VSYNC that started the frame was seen
+ * @param[out] done_us when the last line had been filtered into the framebuffer
+ */
+void camera_get_frame_timing(uint32_t* vsync_us, uint32_t* done_us);
+
+/**
+ * @brief Get the CPU time the DMA filter took for the last frame
+ *
+ * @return microseconds spent converting DMA buffers into the framebuffer
+ */
+uint32_t camera_get_filter_us();
+
+/**
+ * @brief Get the DMA loss counters, kept over camera_init calls
+ *
+ * @param[out] dropped_lines lines missing from frames, e.g. because the
+ *             filter task fell behind
+ * @param[out] overruns DMA buffers overwritten before they were filtered
+ */
+void camera_get_dma_stats(uint32_t* dropped_lines, uint32_t* overruns);
+
+/**
+ * @brief Get the row and column luma profiles and histograms of the last frame
+ *
+ * The profiles are built by the DMA filter task as lines arrive, so they
+ * come for free with camera_run. Valid until the next camera_run call.
+ *
+ * @return profiles, or NULL if the pixel format is not YUV422 or the frame
+ *         is larger than the profile
+ */
+const camera_luma_profile_t* camera_get_luma_profile();
+
 /**
  * @brief Print contents of framebuffer on terminal
  *
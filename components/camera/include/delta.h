@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "camera.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Block delta coding for mostly static scenes.
+ *
+ * Frames are split into 16x16 pixel blocks and only the blocks that changed
+ * since they were last sent are coded. There is no room for a reference
+ * frame, so each block is remembered by the luma means of its 4x4 pixel
+ * cells as last sent; a block is coded when the summed absolute difference
+ * of those means, times the 16 pixels of a cell, exceeds a threshold. This
+ * estimates the block's SAD with the sensor noise averaged out, and slow
+ * changes add up until the block is sent.
+ *
+ * Keyframes are sent as raw frames, after which delta_encoder_key takes
+ * the whole frame as the reference.
+ *
+ * A coded frame is a sequence of slices, each small enough for one packet
+ * and decodable on its own, big endian:
+ *   0  u16 first block, in raster order
+ *   2  u16 bytes of records that follow
+ *   4  records: u16 blocks skipped, then the pixels of the next block,
+ *      row by row as in the framebuffer
+ * Blocks at the right and bottom edge have only the pixels inside the
+ * frame. A frame has at least one slice, possibly without records.
+ */
+
+#define DELTA_BLOCK 16
+#define DELTA_CELL 4
+#define DELTA_CELLS ((DELTA_BLOCK / DELTA_CELL) * (DELTA_BLOCK / DELTA_CELL))
+#define DELTA_SLICE_HEADER 4
+
+typedef struct {
+    int width;
+    int height;
+    camera_pixelformat_t format;
+    int bytes_per_pixel;
+    int blocks_x;
+    int blocks_y;
+    uint32_t threshold;     /*!< estimated block SAD a block is coded above */
+    uint8_t* ref;           /*!< DELTA_CELLS luma means per block, as sent */
+    uint8_t* coded;         /*!< bitmap of the blocks in the last frame */
+    uint8_t* force;         /*!< bitmap of blocks to code regardless */
+    bool last_key;          /*!< the last frame was a keyframe */
+    bool need_key;
+} delta_encoder_t;
+
+/**
+ * @brief Set an encoder up for a frame size and pixel format
+ *
+ * The first frame has to be a keyframe.
+ *
+ * @return ESP_OK, ESP_ERR_NOT_SUPPORTED for compressed or odd formats,
+ *         ESP_ERR_NO_MEM
+ */
+esp_err_t delta_encoder_init(delta_encoder_t* enc, int width, int height,
+                             camera_pixelformat_t format, uint32_t threshold);
+
+void delta_encoder_free(delta_encoder_t* enc);
+
+/**
+ * @brief Check whether the next frame has to be a keyframe
+ */
+bool delta_encoder_need_key(const delta_encoder_t* enc);
+
+/**
+ * @brief Take a frame sent as a keyframe as the reference
+ */
+void delta_encoder_key(delta_encoder_t* enc, const uint8_t* fb);
+
+/**
+ * @brief Code the blocks that changed
+ *
+ * @param fb framebuffer
+ * @param out coded frame
+ * @param capacity bytes available at out
+ * @param max_records record bytes per slice at most, room for one block
+ * @param[out] len bytes written to out
+ * @param[out] blocks blocks coded
+ * @return ESP_OK, ESP_ERR_NO_MEM if the coded frame does not fit; the
+ *         reference is partly updated then and the next frame has to be
+ *         a keyframe
+ */
+esp_err_t delta_encode(delta_encoder_t* enc, const uint8_t* fb, uint8_t* out, size_t capacity,
+                       size_t max_records, size_t* len, int* blocks);
+
+/**
+ * @brief Code the blocks of the last frame again in the next one
+ *
+ * For a frame that was dropped instead of sent; after a dropped keyframe
+ * the next frame has to be a keyframe too.
+ */
+void delta_encoder_resend(delta_encoder_t* enc);
+
+#ifdef __cplusplus
+}
+#endif
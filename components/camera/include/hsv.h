@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Integer RGB <-> HSV/HSL conversion.
+ *
+ * Hue is 8.8 fixed point on a 256 step circle, so a full turn is exactly
+ * 65536 and hue arithmetic wraps for free in a uint16_t: red is 0, green
+ * 0x5555, blue 0xAAAA. Saturation, value and lightness are 0-255.
+ * Divisions go through 256 entry reciprocal tables; all functions work on
+ * arrays of packed 8-bit RGB triplets.
+ */
+
+#define HSV_HUE_RED     0x0000
+#define HSV_HUE_GREEN   0x5555
+#define HSV_HUE_BLUE    0xAAAA
+
+typedef struct {
+    uint16_t h;
+    uint8_t s;
+    uint8_t v;
+} hsv_t;
+
+typedef struct {
+    uint16_t h;
+    uint8_t s;
+    uint8_t l;
+} hsl_t;
+
+/**
+ * @brief Convert count RGB triplets to HSV
+ */
+void hsv_from_rgb(const uint8_t* rgb, hsv_t* out, size_t count);
+
+/**
+ * @brief Convert count HSV values back to RGB triplets
+ */
+void hsv_to_rgb(const hsv_t* in, uint8_t* rgb, size_t count);
+
+/**
+ * @brief Convert count RGB triplets to HSL
+ */
+void hsl_from_rgb(const uint8_t* rgb, hsl_t* out, size_t count);
+
+/**
+ * @brief Scale the saturation of count RGB triplets in place
+ *
+ * Hue and value are kept; works directly on the channels, without a full
+ * round trip through HSV.
+ *
+ * @param gain 8.8 fixed point, 256 leaves the colors unchanged
+ */
+void hsv_scale_saturation(uint8_t* rgb, size_t count, uint16_t gain);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Baseline JPEG encoder for YUV422 framebuffers.
+ *
+ * Reads the framebuffer (2 pixels per word, y1 | v << 8 | y2 << 16 | u << 24)
+ * directly in 16x8 MCU strips, so chroma is kept at its native 2:1
+ * horizontal subsampling. Integer DCT, standard Huffman tables; output is
+ * passed to the write callback in chunks of up to JPEG_CHUNK_SIZE bytes.
+ */
+
+// one TCP segment
+#define JPEG_CHUNK_SIZE 1436
+
+/**
+ * @brief Output callback
+ *
+ * @return 0 to continue, anything else aborts encoding
+ */
+typedef int (*jpeg_write_cb_t)(void* ctx, const uint8_t* data, size_t len);
+
+/**
+ * @brief Encode a YUV422 frame
+ *
+ * @param fb framebuffer, width / 2 words per row
+ * @param width frame width in pixels, even
+ * @param height frame height in pixels
+ * @param quality 1-100, as in libjpeg
+ * @param write output callback
+ * @param ctx passed to write
+ * @return ESP_OK on success, ESP_FAIL if write aborted, ESP_ERR_NO_MEM
+ */
+esp_err_t jpeg_encode_yuv422(const uint32_t* fb, int width, int height, int quality,
+                             jpeg_write_cb_t write, void* ctx);
+
+#ifdef __cplusplus
+}
+#endif
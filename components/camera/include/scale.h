@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Framebuffer downscaling.
+ *
+ * Framebuffers hold two pixels per word, y1 | v << 8 | y2 << 16 | u << 24
+ * for YUV422. Pixels are averaged over the source area each output pixel
+ * covers (box filter), in integer arithmetic.
+ */
+
+/**
+ * @brief Halve a YUV422 frame in both directions
+ *
+ * Each output pixel averages a 2x2 block, chroma is averaged over the
+ * 4x2 block of its word.
+ *
+ * @param src width / 2 words per row
+ * @param width source width in pixels, a multiple of 4
+ * @param height source height in pixels, even
+ * @param dst width / 4 words per row, height / 2 rows
+ */
+void scale_yuv422_half(const uint32_t* src, int width, int height, uint32_t* dst);
+
+/**
+ * @brief Shrink a YUV422 frame to any smaller size, in one pass
+ *
+ * Output column x averages the source columns from x * width / dst_width
+ * up to (x + 1) * width / dst_width, rows likewise, so every source pixel
+ * counts exactly once. The column spans are tabled up front and each box
+ * sum is divided by its area with rounding. Chroma is averaged over the
+ * two boxes of an output word together.
+ *
+ * @param src width / 2 words per row
+ * @param width source width in pixels, even
+ * @param height source height in pixels
+ * @param dst dst_width / 2 words per row, dst_height rows
+ * @param dst_width output width, even, 2 to width
+ * @param dst_height output height, 1 to height
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for sizes out of range,
+ *         ESP_ERR_NO_MEM if the span table cannot be allocated
+ */
+esp_err_t scale_yuv422_box(const uint32_t* src, int width, int height,
+                           uint32_t* dst, int dst_width, int dst_height);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,429 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "jpeg_encoder.h"
+
+#define min(a,b) ((a)<(b)?(a):(b))
+
+static const uint8_t s_zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// ITU T.81 Annex K tables, in natural order
+static const uint8_t s_luma_quant[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99,
+};
+
+static const uint8_t s_chroma_quant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+static const uint8_t s_dc_luma_bits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t s_dc_chroma_bits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const uint8_t s_dc_vals[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uint8_t s_ac_luma_bits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const uint8_t s_ac_luma_vals[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+static const uint8_t s_ac_chroma_bits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const uint8_t s_ac_chroma_vals[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+// code and length per symbol, built once from the tables above
+typedef struct {
+    uint16_t code[256];
+    uint8_t size[256];
+} huff_table_t;
+
+enum { HUFF_DC_LUMA = 0, HUFF_DC_CHROMA, HUFF_AC_LUMA, HUFF_AC_CHROMA, HUFF_COUNT };
+
+static huff_table_t s_huff[HUFF_COUNT];
+static bool s_initialised = false;
+
+typedef struct {
+    jpeg_write_cb_t write;
+    void* ctx;
+    bool failed;
+    uint32_t bits;          // pending bits, right aligned
+    int bit_count;
+    size_t len;
+    uint8_t out[JPEG_CHUNK_SIZE];
+    uint8_t quant[2][64];   // zigzag order, as written to DQT
+    uint16_t recip[2][64];  // 65536 / (8 * quant), natural order
+    int32_t mcu[4][64];     // Y left, Y right, Cb, Cr
+    int last_dc[3];
+} jpeg_state_t;
+
+static void build_huff(huff_table_t* t, const uint8_t* bits, const uint8_t* vals)
+{
+    uint16_t code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; ++len) {
+        for (int i = 0; i < bits[len - 1]; ++i) {
+            t->code[vals[k]] = code++;
+            t->size[vals[k]] = len;
+            k++;
+        }
+        code <<= 1;
+    }
+}
+
+static void init_tables()
+{
+    build_huff(&s_huff[HUFF_DC_LUMA], s_dc_luma_bits, s_dc_vals);
+    build_huff(&s_huff[HUFF_DC_CHROMA], s_dc_chroma_bits, s_dc_vals);
+    build_huff(&s_huff[HUFF_AC_LUMA], s_ac_luma_bits, s_ac_luma_vals);
+    build_huff(&s_huff[HUFF_AC_CHROMA], s_ac_chroma_bits, s_ac_chroma_vals);
+    s_initialised = true;
+}
+
+static void flush(jpeg_state_t* s)
+{
+    if (s->len > 0 && !s->failed) {
+        s->failed = s->write(s->ctx, s->out, s->len) != 0;
+    }
+    s->len = 0;
+}
+
+static inline void put_byte(jpeg_state_t* s, uint8_t b)
+{
+    s->out[s->len++] = b;
+    if (s->len == JPEG_CHUNK_SIZE) {
+        flush(s);
+    }
+}
+
+static void put_bytes(jpeg_state_t* s, const uint8_t* data, size_t len)
+{
+    while (len--) {
+        put_byte(s, *data++);
+    }
+}
+
+static void put_marker(jpeg_state_t* s, uint8_t marker, uint16_t len)
+{
+    put_byte(s, 0xFF);
+    put_byte(s, marker);
+    put_byte(s, len >> 8);
+    put_byte(s, len & 0xFF);
+}
+
+static inline void put_bits(jpeg_state_t* s, uint32_t code, int size)
+{
+    s->bits = (s->bits << size) | (code & ((1 << size) - 1));
+    s->bit_count += size;
+    while (s->bit_count >= 8) {
+        uint8_t b = s->bits >> (s->bit_count - 8);
+        put_byte(s, b);
+        if (b == 0xFF) {
+            put_byte(s, 0);
+        }
+        s->bit_count -= 8;
+    }
+}
+
+static void write_headers(jpeg_state_t* s, int width, int height)
+{
+    static const uint8_t jfif[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+
+    put_byte(s, 0xFF);
+    put_byte(s, 0xD8);
+    put_marker(s, 0xE0, 2 + sizeof(jfif));
+    put_bytes(s, jfif, sizeof(jfif));
+
+    put_marker(s, 0xDB, 2 + 2 * 65);
+    for (int t = 0; t < 2; ++t) {
+        put_byte(s, t);
+        put_bytes(s, s->quant[t], 64);
+    }
+
+    // Y 2x1 sampled, Cb and Cr 1x1
+    put_marker(s, 0xC0, 2 + 6 + 3 * 3);
+    put_byte(s, 8);
+    put_byte(s, height >> 8);
+    put_byte(s, height & 0xFF);
+    put_byte(s, width >> 8);
+    put_byte(s, width & 0xFF);
+    put_byte(s, 3);
+    put_byte(s, 1); put_byte(s, 0x21); put_byte(s, 0);
+    put_byte(s, 2); put_byte(s, 0x11); put_byte(s, 1);
+    put_byte(s, 3); put_byte(s, 0x11); put_byte(s, 1);
+
+    put_marker(s, 0xC4, 2 + 4 * 17 + 2 * 12 + 2 * 162);
+    put_byte(s, 0x00);
+    put_bytes(s, s_dc_luma_bits, 16);
+    put_bytes(s, s_dc_vals, 12);
+    put_byte(s, 0x10);
+    put_bytes(s, s_ac_luma_bits, 16);
+    put_bytes(s, s_ac_luma_vals, 162);
+    put_byte(s, 0x01);
+    put_bytes(s, s_dc_chroma_bits, 16);
+    put_bytes(s, s_dc_vals, 12);
+    put_byte(s, 0x11);
+    put_bytes(s, s_ac_chroma_bits, 16);
+    put_bytes(s, s_ac_chroma_vals, 162);
+
+    put_marker(s, 0xDA, 2 + 1 + 3 * 2 + 3);
+    put_byte(s, 3);
+    put_byte(s, 1); put_byte(s, 0x00);
+    put_byte(s, 2); put_byte(s, 0x11);
+    put_byte(s, 3); put_byte(s, 0x11);
+    put_byte(s, 0);
+    put_byte(s, 63);
+    put_byte(s, 0);
+}
+
+static void set_quality(jpeg_state_t* s, int quality)
+{
+    const uint8_t* base[2] = { s_luma_quant, s_chroma_quant };
+    int scale;
+
+    quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
+    scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    for (int t = 0; t < 2; ++t) {
+        for (int i = 0; i < 64; ++i) {
+            int q = (base[t][s_zigzag[i]] * scale + 50) / 100;
+            q = q < 1 ? 1 : q > 255 ? 255 : q;
+            s->quant[t][i] = q;
+            s->recip[t][s_zigzag[i]] = (65536 + 4 * q) / (8 * q);
+        }
+    }
+}
+
+// Loeffler-Ligtenberg-Moschytz integer DCT as in the IJG islow version;
+// the result is 8 times the true DCT
+#define CONST_BITS 13
+#define PASS1_BITS 2
+#define FIX_0_298631336 2446
+#define FIX_0_390180644 3196
+#define FIX_0_541196100 4433
+#define FIX_0_765366865 6270
+#define FIX_0_899976223 7373
+#define FIX_1_175875602 9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+#define DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+
+static void fdct(int32_t* data)
+{
+    int32_t tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    int32_t tmp10, tmp11, tmp12, tmp13;
+    int32_t z1, z2, z3, z4, z5;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        // rows first, then columns
+        int step = pass == 0 ? 1 : 8;
+        int stride = pass == 0 ? 8 : 1;
+        int shift = pass == 0 ? CONST_BITS - PASS1_BITS : CONST_BITS + PASS1_BITS;
+        for (int i = 0; i < 8; ++i) {
+            int32_t* d = data + i * stride;
+            tmp0 = d[0] + d[7 * step];
+            tmp7 = d[0] - d[7 * step];
+            tmp1 = d[1 * step] + d[6 * step];
+            tmp6 = d[1 * step] - d[6 * step];
+            tmp2 = d[2 * step] + d[5 * step];
+            tmp5 = d[2 * step] - d[5 * step];
+            tmp3 = d[3 * step] + d[4 * step];
+            tmp4 = d[3 * step] - d[4 * step];
+
+            tmp10 = tmp0 + tmp3;
+            tmp13 = tmp0 - tmp3;
+            tmp11 = tmp1 + tmp2;
+            tmp12 = tmp1 - tmp2;
+
+            if (pass == 0) {
+                d[0] = (tmp10 + tmp11) << PASS1_BITS;
+                d[4 * step] = (tmp10 - tmp11) << PASS1_BITS;
+            } else {
+                d[0] = DESCALE(tmp10 + tmp11, PASS1_BITS);
+                d[4 * step] = DESCALE(tmp10 - tmp11, PASS1_BITS);
+            }
+            z1 = (tmp12 + tmp13) * FIX_0_541196100;
+            d[2 * step] = DESCALE(z1 + tmp13 * FIX_0_765366865, shift);
+            d[6 * step] = DESCALE(z1 - tmp12 * FIX_1_847759065, shift);
+
+            z1 = tmp4 + tmp7;
+            z2 = tmp5 + tmp6;
+            z3 = tmp4 + tmp6;
+            z4 = tmp5 + tmp7;
+            z5 = (z3 + z4) * FIX_1_175875602;
+            tmp4 *= FIX_0_298631336;
+            tmp5 *= FIX_2_053119869;
+            tmp6 *= FIX_3_072711026;
+            tmp7 *= FIX_1_501321110;
+            z1 *= -FIX_0_899976223;
+            z2 *= -FIX_2_562915447;
+            z3 = z3 * -FIX_1_961570560 + z5;
+            z4 = z4 * -FIX_0_390180644 + z5;
+
+            d[7 * step] = DESCALE(tmp4 + z1 + z3, shift);
+            d[5 * step] = DESCALE(tmp5 + z2 + z4, shift);
+            d[3 * step] = DESCALE(tmp6 + z2 + z3, shift);
+            d[1 * step] = DESCALE(tmp7 + z1 + z4, shift);
+        }
+    }
+}
+
+static inline int bit_length(int v)
+{
+    int n = 0;
+    while (v) {
+        n++;
+        v >>= 1;
+    }
+    return n;
+}
+
+// transform, quantize and entropy code a block of level shifted samples
+static void encode_block(jpeg_state_t* s, int32_t* block, int comp)
+{
+    int t = comp == 0 ? 0 : 1;
+    const huff_table_t* dc = &s_huff[t == 0 ? HUFF_DC_LUMA : HUFF_DC_CHROMA];
+    const huff_table_t* ac = &s_huff[t == 0 ? HUFF_AC_LUMA : HUFF_AC_CHROMA];
+    const uint16_t* recip = s->recip[t];
+    int16_t q[64];
+
+    fdct(block);
+    for (int i = 0; i < 64; ++i) {
+        int k = s_zigzag[i];
+        int32_t v = block[k];
+        if (v < 0) {
+            q[i] = -(int) (((uint32_t) -v * recip[k] + 32768) >> 16);
+        } else {
+            q[i] = (int) (((uint32_t) v * recip[k] + 32768) >> 16);
+        }
+    }
+
+    int diff = q[0] - s->last_dc[comp];
+    s->last_dc[comp] = q[0];
+    int mag = diff < 0 ? -diff : diff;
+    int nbits = bit_length(mag);
+    put_bits(s, dc->code[nbits], dc->size[nbits]);
+    if (nbits) {
+        // negative values are sent as the one's complement
+        put_bits(s, diff < 0 ? diff - 1 : diff, nbits);
+    }
+
+    int run = 0;
+    for (int i = 1; i < 64; ++i) {
+        int v = q[i];
+        if (v == 0) {
+            run++;
+            continue;
+        }
+        while (run > 15) {
+            put_bits(s, ac->code[0xF0], ac->size[0xF0]);
+            run -= 16;
+        }
+        mag = v < 0 ? -v : v;
+        nbits = bit_length(mag);
+        int sym = (run << 4) | nbits;
+        put_bits(s, ac->code[sym], ac->size[sym]);
+        put_bits(s, v < 0 ? v - 1 : v, nbits);
+        run = 0;
+    }
+    if (run > 0) {
+        put_bits(s, ac->code[0x00], ac->size[0x00]);
+    }
+}
+
+esp_err_t jpeg_encode_yuv422(const uint32_t* fb, int width, int height, int quality,
+                             jpeg_write_cb_t write, void* ctx)
+{
+    if (fb == NULL || write == NULL || width <= 0 || height <= 0 || (width % 2) != 0 ||
+        width > 65535 || height > 65535) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_initialised) {
+        init_tables();
+    }
+    jpeg_state_t* s = (jpeg_state_t*) calloc(1, sizeof(jpeg_state_t));
+    if (!s) {
+        return ESP_ERR_NO_MEM;
+    }
+    s->write = write;
+    s->ctx = ctx;
+    set_quality(s, quality);
+    write_headers(s, width, height);
+
+    const int words_per_row = width / 2;
+    for (int y0 = 0; y0 < height && !s->failed; y0 += 8) {
+        for (int x0 = 0; x0 < words_per_row; x0 += 8) {
+            // 8 rows of 8 words: 16 luma and 8 chroma samples per row, edges
+            // are repeated past the frame border
+            for (int row = 0; row < 8; ++row) {
+                const uint32_t* line = fb + min(y0 + row, height - 1) * words_per_row;
+                for (int j = 0; j < 8; ++j) {
+                    uint32_t w = line[min(x0 + j, words_per_row - 1)];
+                    int32_t* yb = &s->mcu[j >> 2][row * 8 + (j & 3) * 2];
+                    yb[0] = (int32_t) (w & 0xFF) - 128;
+                    yb[1] = (int32_t) ((w >> 16) & 0xFF) - 128;
+                    s->mcu[2][row * 8 + j] = (int32_t) (w >> 24) - 128;
+                    s->mcu[3][row * 8 + j] = (int32_t) ((w >> 8) & 0xFF) - 128;
+                }
+            }
+            encode_block(s, s->mcu[0], 0);
+            encode_block(s, s->mcu[1], 0);
+            encode_block(s, s->mcu[2], 1);
+            encode_block(s, s->mcu[3], 2);
+        }
+    }
+    // pad the last byte with ones, then EOI
+    put_bits(s, 0x7F, 7);
+    s->bit_count = 0;
+    put_byte(s, 0xFF);
+    put_byte(s, 0xD9);
+    flush(s);
+
+    esp_err_t err = s->failed ? ESP_FAIL : ESP_OK;
+    free(s);
+    return err;
+}
@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <string.h>
+#include "scale.h"
+
+#define EVEN_BYTES 0x00FF00FFu
+
+void scale_yuv422_half(const uint32_t* src, int width, int height, uint32_t* dst)
+{
+    const int src_words = width / 2;
+
+    for (int y = 0; y < height; y += 2) {
+        const uint32_t* row0 = src + y * src_words;
+        const uint32_t* row1 = row0 + src_words;
+        for (int x = 0; x < src_words; x += 2) {
+            uint32_t a = row0[x], b = row0[x + 1];
+            uint32_t c = row1[x], d = row1[x + 1];
+            // two 16-bit lanes per sum: y1 and y2 of a word for luma, v and
+            // u of all four words for chroma
+            uint32_t luma_l = (a & EVEN_BYTES) + (c & EVEN_BYTES);
+            uint32_t luma_r = (b & EVEN_BYTES) + (d & EVEN_BYTES);
+            uint32_t chroma = ((a >> 8) & EVEN_BYTES) + ((b >> 8) & EVEN_BYTES) +
+                              ((c >> 8) & EVEN_BYTES) + ((d >> 8) & EVEN_BYTES);
+            uint32_t y1 = ((luma_l & 0xFFFF) + (luma_l >> 16) + 2) >> 2;
+            uint32_t y2 = ((luma_r & 0xFFFF) + (luma_r >> 16) + 2) >> 2;
+            uint32_t v = ((chroma & 0xFFFF) + 2) >> 2;
+            uint32_t u = ((chroma >> 16) + 2) >> 2;
+            *dst++ = y1 | (v << 8) | (y2 << 16) | (u << 24);
+        }
+    }
+}
+
+typedef struct {
+    uint16_t start;
+    uint16_t count;
+} span_t;
+
+esp_err_t scale_yuv422_box(const uint32_t* src, int width, int height,
+                           uint32_t* dst, int dst_width, int dst_height)
+{
+    if (src == NULL || dst == NULL || (width % 2) != 0 || (dst_width % 2) != 0 ||
+            dst_width < 2 || dst_width > width || dst_height < 1 || dst_height > height) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // y, u and v sums of one output row, then the columns' spans
+    uint32_t* sums = (uint32_t*) malloc(dst_width * (3 * sizeof(uint32_t) + sizeof(span_t)));
+    if (sums == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    span_t* cols = (span_t*) (sums + 3 * dst_width);
+    for (int x = 0; x < dst_width; x++) {
+        cols[x].start = x * width / dst_width;
+        cols[x].count = (x + 1) * width / dst_width - cols[x].start;
+    }
+
+    int row = 0;
+    for (int y = 0; y < dst_height; y++) {
+        int end = (y + 1) * height / dst_height;
+        int rows = end - row;
+        memset(sums, 0, 3 * dst_width * sizeof(uint32_t));
+        for (; row < end; row++) {
+            const uint32_t* line = src + row * (width / 2);
+            uint32_t* s = sums;
+            for (int x = 0; x < dst_width; x++, s += 3) {
+                int p_end = cols[x].start + cols[x].count;
+                for (int p = cols[x].start; p < p_end; p++) {
+                    uint32_t w = line[p >> 1];
+                    s[0] += (w >> ((p & 1) << 4)) & 0xFF;
+                    s[1] += w >> 24;
+                    s[2] += (w >> 8) & 0xFF;
+                }
+            }
+        }
+        // each box divided by its area, rounded; dst_width divisions per row
+        const uint32_t* s = sums;
+        for (int x = 0; x < dst_width; x += 2, s += 6) {
+            uint32_t a1 = cols[x].count * rows;
+            uint32_t a2 = cols[x + 1].count * rows;
+            uint32_t y1 = (s[0] + a1 / 2) / a1;
+            uint32_t y2 = (s[3] + a2 / 2) / a2;
+            // chroma over both boxes of the word, rounded once
+            uint32_t a = a1 + a2;
+            uint32_t u = (s[1] + s[4] + a / 2) / a;
+            uint32_t v = (s[2] + s[5] + a / 2) / a;
+            *dst++ = y1 | (v << 8) | (y2 << 16) | (u << 24);
+        }
+    }
+    free(sums);
+    return ESP_OK;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Network LED output, for strips driven by a remote controller.
+ *
+ * Frames are packed into E1.31 (sACN) universes or DDP packets and sent
+ * over UDP by a dedicated task, so netled_show never waits on the network.
+ * Every packet of a frame has its own preallocated buffer with the static
+ * header filled in once; per frame only the sequence number and the pixel
+ * data are written.
+ */
+
+#define NETLED_E131_PORT            5568
+#define NETLED_E131_HEADER_LEN      126
+#define NETLED_E131_CHANNELS        510     //!< 170 RGB LEDs, no LED straddles two universes
+
+#define NETLED_DDP_PORT             4048
+#define NETLED_DDP_HEADER_LEN       10
+#define NETLED_DDP_CHANNELS         1440    //!< 480 RGB LEDs, keeps packets below the MTU
+
+typedef enum {
+    NETLED_PROTOCOL_E131 = 0,
+    NETLED_PROTOCOL_DDP = 1,
+} netled_protocol_t;
+
+typedef struct {
+    netled_protocol_t protocol;
+    const char* host;           /*!< receiver IPv4 address; NULL or "" sends E1.31 to the universe multicast groups */
+    uint16_t universe;          /*!< first E1.31 universe, 1-63999 */
+    size_t led_count;
+} netled_config_t;
+
+/**
+ * @brief Allocate packet buffers and start the sender task
+ *
+ * @param config output configuration
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad address or universe
+ */
+esp_err_t netled_init(const netled_config_t* config);
+
+/**
+ * @brief Send a frame
+ *
+ * Copies the frame and returns; if the previous frame is still being sent
+ * only the latest one goes out. The copy is made outside the driver's
+ * lock, so frames have to come from one task.
+ *
+ * @param rgb led_count * 3 bytes, red first
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if not initialized
+ */
+esp_err_t netled_show(const uint8_t* rgb);
+
+/**
+ * @brief Fill the static part of an E1.31 data packet
+ *
+ * @param pkt NETLED_E131_HEADER_LEN + channels bytes
+ * @param cid 16 byte component identifier of this sender
+ * @param source source name, up to 63 characters
+ * @param universe universe number
+ * @param channels DMX slots carried, up to 512
+ */
+void netled_e131_header(uint8_t* pkt, const uint8_t* cid, const char* source,
+                        uint16_t universe, size_t channels);
+
+/**
+ * @brief Fill a DDP header
+ *
+ * @param pkt NETLED_DDP_HEADER_LEN + length bytes
+ * @param offset byte offset of this packet's data in the frame
+ * @param length data bytes in this packet
+ * @param push true for the last packet of a frame
+ */
+void netled_ddp_header(uint8_t* pkt, uint32_t offset, uint16_t length, bool push);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Keeps the estimated strip current within the supply budget.
+ *
+ * The current drawn by each channel is looked up in a 256 entry table per
+ * channel, so estimating a frame is one lookup per byte. When the estimate
+ * is over budget every channel is scaled down at once; the scale then
+ * recovers gradually so brightness does not pump.
+ */
+
+#define POWER_LIMIT_IDLE_UA     600     //!< quiescent current of one WS2812B
+
+typedef struct {
+    uint32_t budget_ma;         /*!< current available for the strip, 0 = unlimited */
+    uint16_t channel_ma[3];     /*!< current of a fully lit red, green and blue channel */
+} power_limit_config_t;
+
+/**
+ * @brief Build the current tables
+ */
+esp_err_t power_limit_init(const power_limit_config_t* config);
+
+/**
+ * @brief Change the budget at runtime, 0 = unlimited.
+ */
+esp_err_t power_limit_set_budget(uint32_t budget_ma);
+
+/**
+ * @brief Scale a frame so it stays within the budget
+ *
+ * Called once per strip refresh.
+ *
+ * @param[inout] grb led_count * 3 bytes in strip order (green, red, blue)
+ * @param led_count number of LEDs
+ * @return estimated current of the frame as sent, in mA
+ */
+uint32_t power_limit_apply(uint8_t* grb, size_t led_count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "driver/rmt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * WS2812B timings, in RMT ticks. The RMT channel runs from the 80MHz APB
+ * clock divided by WS2812_RMT_CLK_DIV, so one tick is 25ns.
+ */
+#define WS2812_RMT_CLK_DIV      2
+#define WS2812_T0H_TICKS        16      //!< 0.40us
+#define WS2812_T0L_TICKS        34      //!< 0.85us
+#define WS2812_T1H_TICKS        32      //!< 0.80us
+#define WS2812_T1L_TICKS        18      //!< 0.45us
+#define WS2812_RESET_TICKS      12000   //!< 300us, appended to the last bit of a frame
+
+#define WS2812_BITS_PER_LED     24
+#define WS2812_BYTES_PER_LED    3
+
+typedef struct {
+    int gpio_num;               /*!< GPIO connected to DIN of the first LED */
+    rmt_channel_t channel;      /*!< RMT channel used for the bit stream */
+    size_t led_count;           /*!< number of LEDs on the strip */
+} ws2812_config_t;
+
+/**
+ * @brief Initialize the LED strip driver
+ *
+ * Configures the RMT channel, allocates two encoded frame buffers and
+ * starts the output task. The strip is cleared once the task is running.
+ *
+ * @param config strip configuration
+ * @return ESP_OK on success
+ */
+esp_err_t ws2812_init(const ws2812_config_t* config);
+
+/**
+ * @brief Queue a frame for output
+ *
+ * Copies led_count * 3 bytes of GRB data and wakes the output task, which
+ * encodes the frame while the previous one is still being clocked out.
+ * Never waits for the strip; if called faster than the strip can be
+ * refreshed, only the most recent frame is sent. The copy is made outside
+ * the driver's lock, so frames have to come from one task.
+ *
+ * @param grb GRB bytes, 3 per LED, in strip order
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if not initialized
+ */
+esp_err_t ws2812_show(const uint8_t* grb);
+
+/**
+ * @brief Get the number of LEDs the driver was initialized with.
+ */
+size_t ws2812_get_led_count();
+
+/**
+ * @brief Get the number of ws2812_show calls so far.
+ */
+uint32_t ws2812_get_show_count();
+
+/**
+ * @brief Get when the strip last latched a frame
+ *
+ * @param[out] show_count ws2812_show calls included in that frame
+ * @param[out] latch_us latch time, microseconds on the esp_timer clock
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if not initialized
+ */
+esp_err_t ws2812_get_latch(uint32_t* show_count, uint32_t* latch_us);
+
+/**
+ * @brief Encode GRB bytes into RMT items
+ *
+ * Writes 24 items per LED, MSB first. The low phase of the very last item
+ * is stretched by WS2812_RESET_TICKS so the frame ends with a latch.
+ * Does not touch any hardware.
+ *
+ * @param grb GRB bytes, 3 per LED
+ * @param led_count number of LEDs
+ * @param[out] items buffer for led_count * WS2812_BITS_PER_LED items
+ */
+void ws2812_encode(const uint8_t* grb, size_t led_count, rmt_item32_t* items);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "lwip/api.h"
+#include "netled.h"
+
+static const char* TAG = "netled";
+
+#define NETLED_SOURCE_NAME "ESPILICAM"
+
+typedef struct {
+    uint8_t* data;              // header followed by pixel data
+    size_t channels;            // pixel bytes in this packet
+    size_t frame_offset;        // position of the first pixel byte in the frame
+    ip_addr_t addr;
+    struct netbuf* buf;
+} netled_packet_t;
+
+typedef struct {
+    netled_config_t config;
+    size_t header_len;
+    uint16_t port;
+    netled_packet_t* packets;
+    size_t packet_count;
+    // frame buffers swapped under lock like in ws2812.c
+    uint8_t* fill;              // written by netled_show
+    uint8_t* pending;           // latest frame handed over by netled_show
+    uint8_t* work;              // owned by the sender task
+    bool fresh;                 // pending has not been taken by the task yet
+    uint8_t sequence;
+    size_t frames_sent;
+    size_t send_errors;
+    struct netconn* conn;
+    portMUX_TYPE lock;
+    TaskHandle_t task;
+} netled_state_t;
+
+static netled_state_t* s_net = NULL;
+
+static inline void put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static inline void put32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+// ANSI E1.31-2016, section 4 (data packet), all fields big endian
+void netled_e131_header(uint8_t* pkt, const uint8_t* cid, const char* source,
+                        uint16_t universe, size_t channels)
+{
+    static const uint8_t acn_id[12] = { 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0 };
+    size_t len = NETLED_E131_HEADER_LEN + channels;
+
+    memset(pkt, 0, NETLED_E131_HEADER_LEN);
+    // root layer
+    put16(pkt + 0, 0x0010);                     // preamble size
+    memcpy(pkt + 4, acn_id, sizeof(acn_id));
+    put16(pkt + 16, 0x7000 | (len - 16));
+    put32(pkt + 18, 0x00000004);                // VECTOR_ROOT_E131_DATA
+    memcpy(pkt + 22, cid, 16);
+    // framing layer
+    put16(pkt + 38, 0x7000 | (len - 38));
+    put32(pkt + 40, 0x00000002);                // VECTOR_E131_DATA_PACKET
+    strncpy((char*) pkt + 44, source, 63);
+    pkt[108] = 100;                             // priority
+    put16(pkt + 113, universe);
+    // DMP layer
+    put16(pkt + 115, 0x7000 | (len - 115));
+    pkt[117] = 0x02;                            // VECTOR_DMP_SET_PROPERTY
+    pkt[118] = 0xA1;                            // address and data type
+    put16(pkt + 121, 0x0001);                   // address increment
+    put16(pkt + 123, channels + 1);             // property values, including the start code
+}
+
+// DDP, http://www.3waylabs.com/ddp/
+void netled_ddp_header(uint8_t* pkt, uint32_t offset, uint16_t length, bool push)
+{
+    pkt[0] = 0x40 | (push ? 0x01 : 0x00);       // version 1
+    pkt[1] = 0;                                 // sequence, set per frame
+    pkt[2] = 0x0B;                              // RGB, 8 bits per channel
+    pkt[3] = 0x01;                              // default output device
+    put32(pkt + 4, offset);
+    put16(pkt + 8, length);
+}
+
+static void netled_task(void *pvParameters)
+{
+    const size_t header_len = s_net->header_len;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        portENTER_CRITICAL(&s_net->lock);
+        bool fresh = s_net->fresh;
+        if (fresh) {
+            uint8_t* frame = s_net->pending;
+            s_net->pending = s_net->work;
+            s_net->work = frame;
+            s_net->fresh = false;
+        }
+        portEXIT_CRITICAL(&s_net->lock);
+        if (!fresh) {
+            continue;
+        }
+        for (size_t i = 0; i < s_net->packet_count; ++i) {
+            netled_packet_t* p = &s_net->packets[i];
+            memcpy(p->data + header_len, s_net->work + p->frame_offset, p->channels);
+        }
+
+        // E1.31 receivers drop sequence numbers that go backwards, DDP uses 1-15
+        if (s_net->config.protocol == NETLED_PROTOCOL_E131) {
+            s_net->sequence++;
+        } else {
+            s_net->sequence = (s_net->sequence % 15) + 1;
+        }
+        for (size_t i = 0; i < s_net->packet_count; ++i) {
+            netled_packet_t* p = &s_net->packets[i];
+            if (s_net->config.protocol == NETLED_PROTOCOL_E131) {
+                p->data[111] = s_net->sequence;
+            } else {
+                p->data[1] = s_net->sequence;
+            }
+            // the data is referenced, not copied; lwIP is done with it
+            // once netconn_sendto returns
+            netbuf_ref(p->buf, p->data, header_len + p->channels);
+            err_t err = netconn_sendto(s_net->conn, p->buf, &p->addr, s_net->port);
+            if (err != ERR_OK) {
+                // typically no IP yet, or out of buffers; the next frame will do
+                s_net->send_errors++;
+                ESP_LOGV(TAG, "send failed, err=%d", err);
+                break;
+            }
+        }
+        s_net->frames_sent++;
+    }
+}
+
+esp_err_t netled_init(const netled_config_t* config)
+{
+    if (s_net != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    bool multicast = (config->host == NULL || config->host[0] == '\0');
+    if (config->led_count == 0 ||
+        (config->protocol == NETLED_PROTOCOL_E131 && (config->universe < 1 || config->universe > 63999)) ||
+        (config->protocol == NETLED_PROTOCOL_DDP && multicast)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    s_net = (netled_state_t*) calloc(1, sizeof(*s_net));
+    if (!s_net) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(&s_net->config, config, sizeof(*config));
+    s_net->config.host = NULL;
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    s_net->lock = lock;
+
+    esp_err_t err = ESP_OK;
+    ip_addr_t host_addr;
+    if (!multicast && !ipaddr_aton(config->host, &host_addr)) {
+        ESP_LOGE(TAG, "Invalid receiver address %s", config->host);
+        err = ESP_ERR_INVALID_ARG;
+        goto fail;
+    }
+
+    size_t frame_bytes = config->led_count * 3;
+    size_t per_packet;
+    if (config->protocol == NETLED_PROTOCOL_E131) {
+        s_net->header_len = NETLED_E131_HEADER_LEN;
+        s_net->port = NETLED_E131_PORT;
+        per_packet = NETLED_E131_CHANNELS;
+    } else {
+        s_net->header_len = NETLED_DDP_HEADER_LEN;
+        s_net->port = NETLED_DDP_PORT;
+        per_packet = NETLED_DDP_CHANNELS;
+    }
+    s_net->packet_count = (frame_bytes + per_packet - 1) / per_packet;
+    s_net->fill = (uint8_t*) malloc(frame_bytes);
+    s_net->pending = (uint8_t*) calloc(frame_bytes, 1);
+    s_net->work = (uint8_t*) malloc(frame_bytes);
+    s_net->packets = (netled_packet_t*) calloc(s_net->packet_count, sizeof(netled_packet_t));
+    if (!s_net->fill || !s_net->pending || !s_net->work || !s_net->packets) {
+        err = ESP_ERR_NO_MEM;
+        goto fail;
+    }
+
+    uint8_t cid[16] = { 'E', 'S', 'P', 'I', 'L', 'I', 'C', 'A', 'M', 0 };
+    esp_efuse_mac_get_default(cid + 10);
+
+    for (size_t i = 0; i < s_net->packet_count; ++i) {
+        netled_packet_t* p = &s_net->packets[i];
+        p->frame_offset = i * per_packet;
+        p->channels = frame_bytes - p->frame_offset;
+        if (p->channels > per_packet) {
+            p->channels = per_packet;
+        }
+        p->data = (uint8_t*) calloc(s_net->header_len + p->channels, 1);
+        p->buf = netbuf_new();
+        if (!p->data || !p->buf) {
+            ESP_LOGE(TAG, "Not enough memory for %d packets", s_net->packet_count);
+            err = ESP_ERR_NO_MEM;
+            goto fail;
+        }
+        if (config->protocol == NETLED_PROTOCOL_E131) {
+            uint16_t universe = config->universe + i;
+            netled_e131_header(p->data, cid, NETLED_SOURCE_NAME, universe, p->channels);
+            if (multicast) {
+                IP_ADDR4(&p->addr, 239, 255, universe >> 8, universe & 0xFF);
+            } else {
+                p->addr = host_addr;
+            }
+        } else {
+            netled_ddp_header(p->data, p->frame_offset, p->channels, i == s_net->packet_count - 1);
+            p->addr = host_addr;
+        }
+    }
+
+    s_net->conn = netconn_new(NETCONN_UDP);
+    if (!s_net->conn) {
+        err = ESP_ERR_NO_MEM;
+        goto fail;
+    }
+    if (!xTaskCreatePinnedToCore(&netled_task, "netled", 2048, NULL, 5, &s_net->task, 0)) {
+        ESP_LOGE(TAG, "Failed to create network LED task");
+        err = ESP_ERR_NO_MEM;
+        goto fail;
+    }
+    ESP_LOGI(TAG, "%d LEDs in %d %s packets to %s", config->led_count, s_net->packet_count,
+            config->protocol == NETLED_PROTOCOL_E131 ? "E1.31" : "DDP",
+            multicast ? "multicast" : config->host);
+    return ESP_OK;
+
+fail:
+    if (s_net->conn) {
+        netconn_delete(s_net->conn);
+    }
+    for (size_t i = 0; s_net->packets && i < s_net->packet_count; ++i) {
+        free(s_net->packets[i].data);
+        if (s_net->packets[i].buf) {
+            netbuf_delete(s_net->packets[i].buf);
+        }
+    }
+    free(s_net->packets);
+    free(s_net->fill);
+    free(s_net->pending);
+    free(s_net->work);
+    free(s_net);
+    s_net = NULL;
+    return err;
+}
+
+esp_err_t netled_show(const uint8_t* rgb)
+{
+    if (s_net == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memcpy(s_net->fill, rgb, s_net->config.led_count * 3);
+    portENTER_CRITICAL(&s_net->lock);
+    // an older frame the task has not taken yet becomes the next fill buffer
+    uint8_t* frame = s_net->pending;
+    s_net->pending = s_net->fill;
+    s_net->fill = frame;
+    s_net->fresh = true;
+    portEXIT_CRITICAL(&s_net->lock);
+    xTaskNotifyGive(s_net->task);
+    return ESP_OK;
+}
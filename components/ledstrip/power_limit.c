@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "esp_log.h"
+#include "power_limit.h"
+
+static const char* TAG = "power_limit";
+
+// table entries are in 1/100 mA
+#define CURRENT_UNIT_PER_MA 100
+// scale is 8.8, 256 << 8 is full brightness
+#define SCALE_ONE (256 << 8)
+// weight out of 256 with which the scale recovers per refresh,
+// about half a second at 100 Hz
+#define SCALE_RECOVERY 4
+
+typedef struct {
+    uint32_t budget_ma;
+    uint16_t current[3][256];   // per byte position in GRB order
+    uint32_t scale;
+    bool limiting;
+} power_limit_state_t;
+
+static power_limit_state_t* s_pl = NULL;
+
+esp_err_t power_limit_init(const power_limit_config_t* config)
+{
+    if (s_pl != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_pl = (power_limit_state_t*) calloc(1, sizeof(*s_pl));
+    if (!s_pl) {
+        return ESP_ERR_NO_MEM;
+    }
+    // WS2812B channels are PWM driven at constant current, so the average
+    // current is linear in the channel value
+    static const int grb_to_rgb[3] = { 1, 0, 2 };
+    for (int c = 0; c < 3; ++c) {
+        uint32_t full = config->channel_ma[grb_to_rgb[c]] * CURRENT_UNIT_PER_MA;
+        for (int v = 0; v < 256; ++v) {
+            s_pl->current[c][v] = (full * v + 127) / 255;
+        }
+    }
+    s_pl->budget_ma = config->budget_ma;
+    s_pl->scale = SCALE_ONE;
+    return ESP_OK;
+}
+
+esp_err_t power_limit_set_budget(uint32_t budget_ma)
+{
+    if (s_pl == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_pl->budget_ma = budget_ma;
+    return ESP_OK;
+}
+
+uint32_t power_limit_apply(uint8_t* grb, size_t led_count)
+{
+    if (s_pl == NULL) {
+        return 0;
+    }
+    const uint16_t* cur_g = s_pl->current[0];
+    const uint16_t* cur_r = s_pl->current[1];
+    const uint16_t* cur_b = s_pl->current[2];
+    const uint32_t idle = led_count * POWER_LIMIT_IDLE_UA / 10;
+    uint32_t total = 0;
+    const uint8_t* p = grb;
+    for (size_t i = 0; i < led_count; ++i, p += 3) {
+        total += cur_g[p[0]] + cur_r[p[1]] + cur_b[p[2]];
+    }
+    if (s_pl->budget_ma == 0) {
+        return (total + idle) / CURRENT_UNIT_PER_MA;
+    }
+
+    // the idle current can't be dimmed, it comes off the budget first
+    uint32_t budget = s_pl->budget_ma * CURRENT_UNIT_PER_MA;
+    budget = budget > idle ? budget - idle : 0;
+    uint32_t target = SCALE_ONE;
+    if (total > budget) {
+        target = (uint32_t) (((uint64_t) budget * SCALE_ONE) / total);
+    }
+    if (target < s_pl->scale) {
+        // drop at once, a brown-out resets the board
+        s_pl->scale = target;
+    } else {
+        s_pl->scale += ((target - s_pl->scale) * SCALE_RECOVERY + 255) >> 8;
+    }
+    if (s_pl->limiting != (s_pl->scale < SCALE_ONE)) {
+        s_pl->limiting = !s_pl->limiting;
+        ESP_LOGD(TAG, "%s limiting, %d mA requested", s_pl->limiting ? "Start" : "Stop",
+                (total + idle) / CURRENT_UNIT_PER_MA);
+    }
+    if (s_pl->scale >= SCALE_ONE) {
+        return (total + idle) / CURRENT_UNIT_PER_MA;
+    }
+
+    const uint32_t scale = s_pl->scale >> 8;
+    uint8_t* q = grb;
+    for (size_t i = 0; i < led_count * 3; ++i) {
+        q[i] = (q[i] * scale) >> 8;
+    }
+    return ((uint64_t) total * scale / 256 + idle) / CURRENT_UNIT_PER_MA;
+}
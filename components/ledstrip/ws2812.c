@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/rmt.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "ws2812.h"
+
+static const char* TAG = "ws2812";
+
+typedef struct {
+    ws2812_config_t config;
+    // three GRB buffers that change owner by pointer swaps under lock, so
+    // no frame is copied with interrupts off
+    uint8_t* fill;              // written by ws2812_show
+    uint8_t* pending;           // latest frame handed over by ws2812_show
+    uint8_t* work;              // owned by the output task
+    bool fresh;                 // pending has not been taken by the task yet
+    rmt_item32_t* items[2];     // encoded frames, one may be in flight
+    int back;                   // index of the items buffer not being clocked out
+    size_t frames_sent;
+    uint32_t show_count;        // ws2812_show calls so far
+    uint32_t latched_count;     // show_count of the frame latched at latch_time
+    uint32_t latch_time;        // us
+    portMUX_TYPE lock;
+    TaskHandle_t task;
+} ws2812_state_t;
+
+static ws2812_state_t* s_ws = NULL;
+
+// One item per bit: high phase first, then low phase.
+#define WS2812_ITEM(high, low)  ((uint32_t)(high) | (1u << 15) | ((uint32_t)(low) << 16))
+
+void ws2812_encode(const uint8_t* grb, size_t led_count, rmt_item32_t* items)
+{
+    const uint32_t bit0 = WS2812_ITEM(WS2812_T0H_TICKS, WS2812_T0L_TICKS);
+    const uint32_t bit1 = WS2812_ITEM(WS2812_T1H_TICKS, WS2812_T1L_TICKS);
+    size_t byte_count = led_count * WS2812_BYTES_PER_LED;
+    rmt_item32_t* item = items;
+
+    for (size_t i = 0; i < byte_count; ++i) {
+        uint8_t b = grb[i];
+        // manually unrolling the 8 bits, MSB first
+        item[0].val = (b & 0x80) ? bit1 : bit0;
+        item[1].val = (b & 0x40) ? bit1 : bit0;
+        item[2].val = (b & 0x20) ? bit1 : bit0;
+        item[3].val = (b & 0x10) ? bit1 : bit0;
+        item[4].val = (b & 0x08) ? bit1 : bit0;
+        item[5].val = (b & 0x04) ? bit1 : bit0;
+        item[6].val = (b & 0x02) ? bit1 : bit0;
+        item[7].val = (b & 0x01) ? bit1 : bit0;
+        item += 8;
+    }
+    if (byte_count > 0) {
+        // hold the line low after the last bit so the strip latches
+        item[-1].duration1 += WS2812_RESET_TICKS;
+    }
+}
+
+static void ws2812_task(void *pvParameters)
+{
+    const size_t led_count = s_ws->config.led_count;
+    const size_t item_count = led_count * WS2812_BITS_PER_LED;
+    // the strip latches once the whole frame and the reset are clocked out
+    const uint32_t frame_us = item_count * (WS2812_T0H_TICKS + WS2812_T0L_TICKS) / 40 +
+                              WS2812_RESET_TICKS / 40;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        portENTER_CRITICAL(&s_ws->lock);
+        if (s_ws->fresh) {
+            uint8_t* frame = s_ws->pending;
+            s_ws->pending = s_ws->work;
+            s_ws->work = frame;
+            s_ws->fresh = false;
+        }
+        uint32_t show_count = s_ws->show_count;
+        portEXIT_CRITICAL(&s_ws->lock);
+
+        // frame N may still be clocking out of the other buffer while we encode N+1
+        rmt_item32_t* items = s_ws->items[s_ws->back];
+        ws2812_encode(s_ws->work, led_count, items);
+
+        rmt_wait_tx_done(s_ws->config.channel, portMAX_DELAY);
+        rmt_write_items(s_ws->config.channel, items, item_count, false);
+        uint32_t latch_time = (uint32_t) esp_timer_get_time() + frame_us;
+        portENTER_CRITICAL(&s_ws->lock);
+        s_ws->latched_count = show_count;
+        s_ws->latch_time = latch_time;
+        portEXIT_CRITICAL(&s_ws->lock);
+        s_ws->back ^= 1;
+        s_ws->frames_sent++;
+        ESP_LOGV(TAG, "frame %d queued", s_ws->frames_sent);
+    }
+}
+
+esp_err_t ws2812_init(const ws2812_config_t* config)
+{
+    if (s_ws != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (config->led_count == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    s_ws = (ws2812_state_t*) calloc(1, sizeof(*s_ws));
+    if (!s_ws) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(&s_ws->config, config, sizeof(*config));
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    s_ws->lock = lock;
+
+    esp_err_t err = ESP_OK;
+    size_t frame_bytes = config->led_count * WS2812_BYTES_PER_LED;
+    size_t items_bytes = config->led_count * WS2812_BITS_PER_LED * sizeof(rmt_item32_t);
+    ESP_LOGD(TAG, "Allocating buffers for %d LEDs (2 x %d bytes of RMT items)",
+            config->led_count, items_bytes);
+    s_ws->fill = (uint8_t*) malloc(frame_bytes);
+    s_ws->pending = (uint8_t*) calloc(frame_bytes, 1);
+    s_ws->work = (uint8_t*) malloc(frame_bytes);
+    s_ws->fresh = true;
+    s_ws->items[0] = (rmt_item32_t*) malloc(items_bytes);
+    s_ws->items[1] = (rmt_item32_t*) malloc(items_bytes);
+    if (!s_ws->fill || !s_ws->pending || !s_ws->work || !s_ws->items[0] || !s_ws->items[1]) {
+        ESP_LOGE(TAG, "Not enough memory for LED buffers");
+        err = ESP_ERR_NO_MEM;
+        goto fail;
+    }
+
+    rmt_config_t rmt_conf = {
+        .rmt_mode = RMT_MODE_TX,
+        .channel = config->channel,
+        .clk_div = WS2812_RMT_CLK_DIV,
+        .gpio_num = config->gpio_num,
+        .mem_block_num = 1,
+        .tx_config = {
+            .loop_en = false,
+            .carrier_en = false,
+            .idle_level = RMT_IDLE_LEVEL_LOW,
+            .idle_output_en = true,
+        },
+    };
+    err = rmt_config(&rmt_conf);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "rmt_config failed, rc=%x", err);
+        goto fail;
+    }
+    err = rmt_driver_install(config->channel, 0, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "rmt_driver_install failed, rc=%x", err);
+        goto fail;
+    }
+
+    // keep off the capture core (1)
+    if (!xTaskCreatePinnedToCore(&ws2812_task, "ws2812", 2048, NULL, 5, &s_ws->task, 0)) {
+        ESP_LOGE(TAG, "Failed to create LED output task");
+        rmt_driver_uninstall(config->channel);
+        err = ESP_ERR_NO_MEM;
+        goto fail;
+    }
+    ESP_LOGI(TAG, "%d LEDs on GPIO %d, RMT channel %d",
+            config->led_count, config->gpio_num, config->channel);
+
+    // pending is zeroed, so this blanks the strip
+    xTaskNotifyGive(s_ws->task);
+    return ESP_OK;
+
+fail:
+    free(s_ws->fill);
+    free(s_ws->pending);
+    free(s_ws->work);
+    free(s_ws->items[0]);
+    free(s_ws->items[1]);
+    free(s_ws);
+    s_ws = NULL;
+    return err;
+}
+
+esp_err_t ws2812_show(const uint8_t* grb)
+{
+    if (s_ws == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memcpy(s_ws->fill, grb, s_ws->config.led_count * WS2812_BYTES_PER_LED);
+    portENTER_CRITICAL(&s_ws->lock);
+    // an older frame the task has not taken yet becomes the next fill buffer
+    uint8_t* frame = s_ws->pending;
+    s_ws->pending = s_ws->fill;
+    s_ws->fill = frame;
+    s_ws->fresh = true;
+    s_ws->show_count++;
+    portEXIT_CRITICAL(&s_ws->lock);
+    xTaskNotifyGive(s_ws->task);
+    return ESP_OK;
+}
+
+esp_err_t ws2812_get_latch(uint32_t* show_count, uint32_t* latch_us)
+{
+    if (s_ws == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&s_ws->lock);
+    *show_count = s_ws->latched_count;
+    *latch_us = s_ws->latch_time;
+    portEXIT_CRITICAL(&s_ws->lock);
+    return ESP_OK;
+}
+
+uint32_t ws2812_get_show_count()
+{
+    if (s_ws == NULL) {
+        return 0;
+    }
+    return s_ws->show_count;
+}
+
+size_t ws2812_get_led_count()
+{
+    if (s_ws == NULL) {
+        return 0;
+    }
+    return s_ws->config.led_count;
+}
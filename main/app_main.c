@@ -15,6 +15,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
 #include <byteswap.h>
 
 #include "freertos/FreeRTOS.h"
@@ -36,6 +38,7 @@
 #include "esp_wifi.h"
 #include "esp_event_loop.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "driver/gpio.h"
 #include "driver/spi_master.h"
@@ -53,8 +56,28 @@
 #include "lwip/netdb.h"
 #include "lwip/api.h"
 #include "bitmap.h"
+#include "jpeg_encoder.h"
+#include "scale.h"
+#include "delta.h"
+#include "ws2812.h"
+#include "netled.h"
+#include "power_limit.h"
+#include "backlight.h"
+#include "led_smooth.h"
+#include "letterbox.h"
+#include "color_lut.h"
+#include "scene_cut.h"
+#include "hsv.h"
 
 #include "telnet.h"
+#include "latency.h"
+#include "broadcast.h"
+#include "tx_pool.h"
+#include "udp_stream.h"
+#include "websocket.h"
+#include "stream_ctl.h"
+#include "metrics.h"
+#include "http_parser.h"
 
 static const char* TAG = "ESPILICAM";
 
@@ -302,26 +325,238 @@ static void set_moviemode(bool c) {
 
 static uint16_t lcd_delay_ms = 100;
 
+// BACKLIGHT
+
+static size_t s_led_count = 0;
+static backlight_yuv_t* s_led_yuv = NULL;
+static backlight_rgb_t* s_led_rgb = NULL;   // capture side
+static backlight_rgb_t* s_led_out = NULL;   // refresh side
+static uint8_t* s_led_grb = NULL;
+static camera_pixelformat_t s_pixel_format;
+static volatile bool s_detect_corners = false;
+static volatile uint16_t s_led_saturation = CONFIG_BACKLIGHT_SATURATION;
+static volatile uint32_t s_backlight_us = 0;
+
+// written by the capture task only
+static metrics_histogram_t s_capture_hist;
+static metrics_histogram_t s_filter_hist;
+static metrics_histogram_t s_backlight_hist;
+static metrics_histogram_t s_display_hist;
+
+static esp_err_t backlight_setup()
+{
+    backlight_layout_t layout = {
+        .top = CONFIG_BACKLIGHT_LEDS_TOP,
+        .right = CONFIG_BACKLIGHT_LEDS_RIGHT,
+        .bottom = CONFIG_BACKLIGHT_LEDS_BOTTOM,
+        .left = CONFIG_BACKLIGHT_LEDS_LEFT,
+        .depth = CONFIG_BACKLIGHT_ZONE_DEPTH,
+        .row_step = CONFIG_BACKLIGHT_ROW_STEP,
+#if CONFIG_BACKLIGHT_CORNER_OVERLAP
+        .corners = BACKLIGHT_CORNER_OVERLAP,
+#elif CONFIG_BACKLIGHT_CORNER_LED
+        .corners = BACKLIGHT_CORNER_LED,
+#else
+        .corners = BACKLIGHT_CORNER_EXCLUDE,
+#endif
+    };
+    led_smooth_config_t smooth = {
+        .attack = CONFIG_BACKLIGHT_SMOOTH_ATTACK,
+        .decay = CONFIG_BACKLIGHT_SMOOTH_DECAY,
+#if CONFIG_BACKLIGHT_INTERPOLATE
+        .interpolate = true,
+#else
+        .interpolate = false,
+#endif
+    };
+    power_limit_config_t power = {
+        .budget_ma = CONFIG_LED_STRIP_POWER_BUDGET_MA,
+        .channel_ma = { CONFIG_LED_STRIP_CHANNEL_MA, CONFIG_LED_STRIP_CHANNEL_MA, CONFIG_LED_STRIP_CHANNEL_MA },
+    };
+    s_led_count = ws2812_get_led_count();
+    if (s_led_count == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = power_limit_init(&power);
+    if (err != ESP_OK) {
+        return err;
+    }
+    s_led_yuv = (backlight_yuv_t*) calloc(s_led_count, sizeof(backlight_yuv_t));
+    s_led_rgb = (backlight_rgb_t*) calloc(s_led_count, sizeof(backlight_rgb_t));
+    s_led_out = (backlight_rgb_t*) calloc(s_led_count, sizeof(backlight_rgb_t));
+    s_led_grb = (uint8_t*) calloc(s_led_count, 3);
+    if (!s_led_yuv || !s_led_rgb || !s_led_out || !s_led_grb) {
+        return ESP_ERR_NO_MEM;
+    }
+    err = backlight_init(&layout, camera_get_fb_width(), camera_get_fb_height());
+    if (err != ESP_OK) {
+        return err;
+    }
+#if CONFIG_BACKLIGHT_MODE_DOMINANT
+    err = backlight_set_mode(BACKLIGHT_MODE_DOMINANT);
+    if (err != ESP_OK) {
+        return err;
+    }
+#endif
+    if (backlight_get_led_count() > s_led_count) {
+        ESP_LOGW(TAG, "Backlight layout has %d LEDs, strip only %d", backlight_get_led_count(), s_led_count);
+    }
+    err = scene_cut_init(CONFIG_BACKLIGHT_SCENE_CUT);
+    if (err != ESP_OK) {
+        return err;
+    }
+    color_lut_params_t lut_params;
+    color_lut_default_params(&lut_params);
+    err = color_lut_init(&lut_params);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (color_lut_load() != ESP_OK) {
+        ESP_LOGI(TAG, "No saved color calibration, using defaults");
+    }
+#if CONFIG_BACKLIGHT_LETTERBOX
+    letterbox_config_t letterbox = {
+        .black_level = CONFIG_BACKLIGHT_BLACK_LEVEL,
+        .min_bar = CONFIG_BACKLIGHT_LETTERBOX_MIN_BAR,
+        .settle_frames = CONFIG_BACKLIGHT_LETTERBOX_FRAMES,
+    };
+    err = letterbox_init(&letterbox);
+    if (err != ESP_OK) {
+        return err;
+    }
+#endif
+    return led_smooth_init(s_led_count, &smooth);
+}
+
+// analyze the frame just captured, the refresh task takes it from there
+static void backlight_update()
+{
+    if (s_led_grb == NULL || s_pixel_format != CAMERA_PF_YUV422) {
+        return;
+    }
+    uint32_t start = (uint32_t) esp_timer_get_time();
+
+    if (s_detect_corners) {
+        // calibration: the TV shows a bright full screen image
+        backlight_point_t corners[4];
+        s_detect_corners = false;
+        if (backlight_detect_corners(camera_get_fb(), corners) == ESP_OK) {
+            backlight_set_corners(corners);
+        }
+    }
+    const camera_luma_profile_t* profile = camera_get_luma_profile();
+    if (profile != NULL && latency_active()) {
+        uint32_t vsync_us, filter_us, sum = 0;
+        for (int i = 0; i < profile->rows; i++) {
+            sum += profile->row_luma[i];
+        }
+        camera_get_frame_timing(&vsync_us, &filter_us);
+        latency_frame(sum / profile->rows, vsync_us, filter_us);
+    }
+#if CONFIG_BACKLIGHT_LETTERBOX
+    if (profile != NULL) {
+        backlight_inset_t margins, inset;
+        backlight_get_screen_margins(&margins);
+        if (letterbox_update(profile->row_luma, profile->rows, profile->col_luma, profile->cols,
+                CAMERA_PROFILE_COL_WIDTH, &margins, &inset)) {
+            backlight_set_inset(&inset);
+        }
+    }
+#endif
+    if (backlight_analyze(camera_get_fb(), s_led_yuv, s_led_count) != ESP_OK) {
+        return;
+    }
+    size_t count = backlight_get_led_count();
+    if (count > s_led_count) count = s_led_count;
+    color_lut_apply(s_led_yuv, s_led_rgb, count);
+    hsv_scale_saturation((uint8_t*) s_led_rgb, count, s_led_saturation);
+    if (profile != NULL && scene_cut_update(profile->luma_hist, CAMERA_HIST_LUMA_BINS,
+            profile->chroma_hist, CAMERA_HIST_CHROMA_BINS, profile->hist_samples, NULL)) {
+        led_smooth_cut();
+    }
+    // LEDs past the layout fade to black
+    led_smooth_set_target(s_led_rgb, count, (uint32_t) esp_timer_get_time());
+    if (latency_active()) {
+        latency_analysis_done((uint32_t) esp_timer_get_time(), ws2812_get_show_count());
+    }
+
+    s_backlight_us = (uint32_t) esp_timer_get_time() - start;
+    metrics_observe(&s_backlight_hist, s_backlight_us);
+    ESP_LOGD(TAG, "Backlight update done in %d us", s_backlight_us);
+}
+
+// refresh the strip at a fixed rate, interpolating between camera frames
+static void ledRefreshTask(void *pvParameters) {
+  TickType_t period = configTICK_RATE_HZ / CONFIG_BACKLIGHT_REFRESH_HZ;
+  if (period == 0) period = 1;
+  TickType_t last_wake = xTaskGetTickCount();
+  while(1) {
+     vTaskDelayUntil(&last_wake, period);
+     led_smooth_render(s_led_out, (uint32_t) esp_timer_get_time());
+     for (int i = 0; i < s_led_count; i++) {
+       s_led_grb[i*3] = s_led_out[i].g;
+       s_led_grb[i*3+1] = s_led_out[i].r;
+       s_led_grb[i*3+2] = s_led_out[i].b;
+     }
+     power_limit_apply(s_led_grb, s_led_count);
+     ws2812_show(s_led_grb);
+     if (latency_active()) {
+       uint32_t latched_count, latch_us;
+       ws2812_get_latch(&latched_count, &latch_us);
+       latency_latched(latched_count, latch_us);
+     }
+#if !CONFIG_NETLED_NONE
+     netled_show((const uint8_t*) s_led_out);
+#endif
+  }
+}
+
+static void stream_publish_frame();
+static void udp_publish_frame();
+
+// odd while the camera is writing the framebuffer
+static volatile uint32_t s_fb_writes = 0;
+
+// stream clients keep the camera running
+static bool camera_running() {
+  return is_moviemode_on() || broadcast_subscribers() > 0 || udp_stream_active();
+}
+
 static void captureTask(void *pvParameters) {
 
   err_t err;
   bool movie_mode = false;
+  bool requested;
+  uint32_t vsync_us, done_us, display_us;
   xSemaphoreGive(captureDoneSem);
   while(1) {
      //frame++;
-     movie_mode = is_moviemode_on();
-     if (!movie_mode)
-     xSemaphoreTake(captureSem, portMAX_DELAY);
+     movie_mode = camera_running();
+     requested = xSemaphoreTake(captureSem, movie_mode ? 0 : 100 / portTICK_RATE_MS) == pdTRUE;
+     if (!movie_mode && !requested)
+       continue;
 
+     s_fb_writes++;
      err = camera_run();
-
+     s_fb_writes++;
+     camera_get_frame_timing(&vsync_us, &done_us);
+     metrics_observe(&s_capture_hist, done_us - vsync_us);
+     metrics_observe(&s_filter_hist, camera_get_filter_us());
+     backlight_update();
+     if (broadcast_subscribers() > 0)
+       stream_publish_frame();
+     if (udp_stream_active())
+       udp_publish_frame();
+
+     display_us = (uint32_t) esp_timer_get_time();
      spi_lcd_send();
      spi_lcd_wait_finish();
+     metrics_observe(&s_display_hist, (uint32_t) esp_timer_get_time() - display_us);
 
      // reorder?
      vTaskDelay(lcd_delay_ms / portTICK_RATE_MS);
 
-     if (!movie_mode)
+     if (requested)
        xSemaphoreGive(captureDoneSem);
      // only return when LCD finished display .. sort of..
    } // end while(1)
@@ -333,7 +568,6 @@ static void captureTask(void *pvParameters) {
 
 // CAMERA CONFIG
 
-static camera_pixelformat_t s_pixel_format;
 static camera_config_t config = {
     .ledc_channel = LEDC_CHANNEL_0,
     .ledc_timer = LEDC_TIMER_0,
@@ -535,6 +769,17 @@ const static char http_pgm_hdr[] =
 const static char http_stream_boundary[] = "--123456789000000000000987654321\r\n";
 const static char http_bitmap_hdr[] =
         "Content-type: image/bitmap\r\n\r\n";
+const static char http_ws_hdr[] =
+        "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: ";
+const static char http_bad_request[] = "HTTP/1.1 400 Bad Request\r\n\r\n";
+const static char http_unavailable[] = "HTTP/1.1 503 Service Unavailable\r\n\r\n";
+const static char http_metrics_hdr[] =
+        "Content-type: text/plain; version=0.0.4\r\n\r\n";
+const static char http_not_allowed[] = "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\n\r\n";
+const static char http_chunked_hdr[] = "Transfer-Encoding: chunked\r\n";
+const static char http_keep_alive_hdr[] = "Connection: keep-alive\r\n";
+const static char http_close_hdr[] = "Connection: close\r\n";
 const static char http_yuv422_hdr[] =
         "Content-Disposition: attachment; Content-type: application/octet-stream\r\n\r\n";
 
@@ -550,10 +795,123 @@ static ip4_addr_t s_ip_addr;
 #define RESPONSE_BUFFER_LEN 256
 #define CMD_BUFFER_LEN 128
 
-static sarg_root root;
+// at least twice the number of option names, a power of two
+#define CMD_HASH_SLOTS 128
+
 static char telnet_cmd_response_buff[RESPONSE_BUFFER_LEN];
 static char telnet_cmd_buffer[CMD_BUFFER_LEN];
 
+// commands by short and long name, open addressing; built once at startup
+static const sarg_opt *s_cmd_opts;
+static int s_cmd_count;
+static uint8_t s_cmd_slots[CMD_HASH_SLOTS];   // option index + 1, 0 if free
+
+// FNV-1a
+static uint32_t cmd_hash(const char *name, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (uint8_t)name[i]) * 16777619u;
+  return h;
+}
+
+static bool cmd_name_is(const char *opt_name, const char *name, size_t len) {
+  return opt_name != NULL && strncmp(opt_name, name, len) == 0 && opt_name[len] == '\0';
+}
+
+static void cmd_table_add(const char *name, int index) {
+  uint32_t slot = cmd_hash(name, strlen(name));
+  while (s_cmd_slots[slot % CMD_HASH_SLOTS] != 0)
+    slot++;
+  s_cmd_slots[slot % CMD_HASH_SLOTS] = index + 1;
+}
+
+static void cmd_table_init(const sarg_opt *opts) {
+  int names = 0;
+  s_cmd_opts = opts;
+  for (s_cmd_count = 0; opts[s_cmd_count].short_name || opts[s_cmd_count].long_name; s_cmd_count++) {
+    if (opts[s_cmd_count].short_name) {
+      cmd_table_add(opts[s_cmd_count].short_name, s_cmd_count);
+      names++;
+    }
+    if (opts[s_cmd_count].long_name) {
+      cmd_table_add(opts[s_cmd_count].long_name, s_cmd_count);
+      names++;
+    }
+  }
+  // keeps probe sequences short
+  assert(2 * names <= CMD_HASH_SLOTS);
+}
+
+static const sarg_opt *cmd_find(const char *name, size_t len) {
+  for (uint32_t slot = cmd_hash(name, len); s_cmd_slots[slot % CMD_HASH_SLOTS] != 0; slot++) {
+    const sarg_opt *opt = &s_cmd_opts[s_cmd_slots[slot % CMD_HASH_SLOTS] - 1];
+    if (cmd_name_is(opt->long_name, name, len) || cmd_name_is(opt->short_name, name, len))
+      return opt;
+  }
+  return NULL;
+}
+
+// run one "name [arg]" command, modified in place; string arguments point
+// into it
+static int cmd_run(char *cmd) {
+  const sarg_opt *opt;
+  sarg_result res;
+  char *name, *arg, *end;
+  int ret;
+
+  // leading dashes are optional, as in "--video 1"
+  while (isspace((unsigned char)*cmd) || *cmd == '-')
+    cmd++;
+  if (*cmd == '\0')
+    return SARG_ERR_SUCCESS;
+  name = cmd;
+  while (*cmd != '\0' && !isspace((unsigned char)*cmd))
+    cmd++;
+  opt = cmd_find(name, cmd - name);
+  if (opt == NULL) {
+    ESP_LOGW(TAG, "Unknown command %.*s", (int)(cmd - name), name);
+    return SARG_ERR_NOTFOUND;
+  }
+  arg = cmd;
+  while (isspace((unsigned char)*arg))
+    arg++;
+  end = arg + strlen(arg);
+  while (end > arg && isspace((unsigned char)end[-1]))
+    end--;
+  *end = '\0';
+
+  memset(&res, 0, sizeof(res));
+  res.type = opt->type;
+  res.count = 1;
+  ret = SARG_ERR_SUCCESS;
+  if (opt->type == BOOL) {
+    // flags take no argument
+    if (*arg != '\0')
+      ret = SARG_ERR_PARSE;
+    res.bool_val = 1;
+  } else if (*arg == '\0') {
+    ret = SARG_ERR_PARSE;
+  } else if (opt->type == STRING) {
+    res.str_val = arg;
+  } else {
+    // base 0 takes 0x and leading 0 prefixes like smallargs does
+    errno = 0;
+    if (opt->type == INT)
+      res.int_val = strtol(arg, &end, 0);
+    else if (opt->type == UINT)
+      res.uint_val = strtoul(arg, &end, 0);
+    else
+      res.double_val = strtod(arg, &end);
+    if (*end != '\0' || errno == ERANGE)
+      ret = SARG_ERR_PARSE;
+  }
+  if (ret != SARG_ERR_SUCCESS) {
+    ESP_LOGW(TAG, "Invalid argument \"%s\" for %s", arg, opt->long_name ? opt->long_name : opt->short_name);
+    return ret;
+  }
+  return opt->callback ? opt->callback(&res) : SARG_ERR_SUCCESS;
+}
+
 static void handle_camera_config_chg(bool reinit_reqd) {
   if (reinit_reqd) {
               ESP_LOGD(TAG, "Reconfiguring camera...");
@@ -563,6 +921,8 @@ static void handle_camera_config_chg(bool reinit_reqd) {
               err = reset_pixformat();
               config.pixel_format = s_pixel_format;
               err = camera_init(&config);
+              // frame numbers start over
+              broadcast_invalidate();
               if (err != ESP_OK) {
                   ESP_LOGE(TAG, "Camera init failed with error 0x%x", err);
                   //return;
@@ -577,19 +937,29 @@ static void handle_camera_config_chg(bool reinit_reqd) {
 static int help_cb(const sarg_result *res)
 {
     UNUSED(res);
-    char *buf;
-    int ret;
-
-    ret = sarg_help_text(&root, &buf);
-    if(ret != SARG_ERR_SUCCESS)
-        return ret;
-//    we can't spare much memory!!
-//    int length = 0;
-//    length += sprintf(telnet_cmd_response_buff+length, "%s\n", buf);
-//    ESP_LOGD(TAG," help_cb: %s",telnet_cmd_response_buff);
-//    telnet_esp32_sendData((uint8_t *)telnet_cmd_response_buff, strlen(telnet_cmd_response_buff));
-    telnet_esp32_sendData((uint8_t *)buf, strlen(buf));
-    free(buf);
+    char line[128], names[40];
+    int length, n;
+    // we can't spare much memory, lines are sent as the response buffer fills
+    length = sprintf(telnet_cmd_response_buff, "Usage: COMMAND [ARG][; COMMAND [ARG]]...\n\n");
+    for (int i = 0; i < s_cmd_count; i++) {
+        const sarg_opt *opt = &s_cmd_opts[i];
+        if (opt->short_name && opt->long_name)
+            snprintf(names, sizeof(names), "  %s, %s", opt->short_name, opt->long_name);
+        else
+            snprintf(names, sizeof(names), "  %s", opt->long_name ? opt->long_name : opt->short_name);
+        n = snprintf(line, sizeof(line), "%-20s%-8s%s\n", names,
+            opt->type == INT ? "INT" : opt->type == UINT ? "UINT" : opt->type == DOUBLE ? "DOUBLE" :
+            opt->type == STRING ? "STRING" : "", opt->help ? opt->help : "");
+        if (n >= sizeof(line))
+            n = sizeof(line) - 1;
+        if (length + n > RESPONSE_BUFFER_LEN) {
+            telnet_esp32_sendData((uint8_t *)telnet_cmd_response_buff, length);
+            length = 0;
+        }
+        memcpy(telnet_cmd_response_buff + length, line, n);
+        length += n;
+    }
+    telnet_esp32_sendData((uint8_t *)telnet_cmd_response_buff, length);
     return 0;
 }
 
@@ -613,6 +983,21 @@ void captureTask( void * pvParameters ) {
 */
 
 
+static void heap_stats(size_t *free8, size_t *free32, size_t *free8start, size_t *free32start)
+{
+    #ifdef ESPIDFV21RC
+        *free8=xPortGetFreeHeapSizeCaps(MALLOC_CAP_8BIT);
+        *free32=xPortGetFreeHeapSizeCaps(MALLOC_CAP_32BIT);
+        *free8start=xPortGetMinimumEverFreeHeapSizeCaps(MALLOC_CAP_8BIT);
+        *free32start=xPortGetMinimumEverFreeHeapSizeCaps(MALLOC_CAP_32BIT);
+    #else
+        *free32=heap_caps_get_largest_free_block(MALLOC_CAP_32BIT);
+        *free8=heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+        *free8start=heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+        *free32start=heap_caps_get_minimum_free_size(MALLOC_CAP_32BIT);
+    #endif
+}
+
 static int sys_stats_cb(const sarg_result *res)
 {
      uint8_t level = 0;
@@ -620,18 +1005,7 @@ static int sys_stats_cb(const sarg_result *res)
      level = res->int_val;
      uint8_t length = 0;
      if (level == 0) {
-
-       #ifdef ESPIDFV21RC
-           free8=xPortGetFreeHeapSizeCaps(MALLOC_CAP_8BIT);
-           free32=xPortGetFreeHeapSizeCaps(MALLOC_CAP_32BIT);
-           free8start=xPortGetMinimumEverFreeHeapSizeCaps(MALLOC_CAP_8BIT);
-           free32start=xPortGetMinimumEverFreeHeapSizeCaps(MALLOC_CAP_32BIT);
-       #else
-           free32=heap_caps_get_largest_free_block(MALLOC_CAP_32BIT);
-           free8=heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
-           free8start=heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
-           free32start=heap_caps_get_minimum_free_size(MALLOC_CAP_32BIT);
-       #endif
+      heap_stats(&free8, &free32, &free8start, &free32start);
 
       tstk = uxTaskGetStackHighWaterMark(NULL);
       length += sprintf(telnet_cmd_response_buff+length,
@@ -866,6 +1240,194 @@ static int  ov7670_whitebalance_cb(const sarg_result *res) {
 }
 
 
+static int  led_attack_cb(const sarg_result *res) {
+  led_smooth_config_t smooth;
+  if (led_smooth_get_config(&smooth) == ESP_OK) {
+    smooth.attack = res->int_val;
+    ESP_LOGD(TAG, "Set LED attack (1-256) to %d",res->int_val);
+    led_smooth_set_config(&smooth);
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+static int  led_decay_cb(const sarg_result *res) {
+  led_smooth_config_t smooth;
+  if (led_smooth_get_config(&smooth) == ESP_OK) {
+    smooth.decay = res->int_val;
+    ESP_LOGD(TAG, "Set LED decay (1-256) to %d",res->int_val);
+    led_smooth_set_config(&smooth);
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+static int  led_interpolate_cb(const sarg_result *res) {
+  led_smooth_config_t smooth;
+  if (led_smooth_get_config(&smooth) == ESP_OK) {
+    smooth.interpolate = (res->int_val == 1);
+    ESP_LOGD(TAG, "Set LED interpolation %d",smooth.interpolate);
+    led_smooth_set_config(&smooth);
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+
+static int  led_corners_cb(const sarg_result *res) {
+  backlight_point_t corners[4];
+  int c[8];
+  if (strcmp("auto", res->str_val) == 0) {
+    ESP_LOGD(TAG, "Detect screen corners on next frame");
+    s_detect_corners = true;
+  } else if (strcmp("off", res->str_val) == 0) {
+    ESP_LOGD(TAG, "Sample the whole frame");
+    backlight_set_corners(NULL);
+  } else if (sscanf(res->str_val, "%d,%d,%d,%d,%d,%d,%d,%d",
+        &c[0], &c[1], &c[2], &c[3], &c[4], &c[5], &c[6], &c[7]) == 8) {
+    for (int i = 0; i < 4; i++) {
+      corners[i].x = c[i*2];
+      corners[i].y = c[i*2+1];
+    }
+    if (backlight_set_corners(corners) != ESP_OK) {
+      ESP_LOGW(TAG, "Invalid screen corners %s", res->str_val);
+    }
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+
+static int  led_ccm_cb(const sarg_result *res) {
+  color_lut_params_t params;
+  float *m = params.matrix;
+  if (color_lut_get_params(&params) != ESP_OK) {
+    return SARG_ERR_SUCCESS;
+  }
+  if (sscanf(res->str_val, "%f,%f,%f,%f,%f,%f,%f,%f,%f",
+        &m[0], &m[1], &m[2], &m[3], &m[4], &m[5], &m[6], &m[7], &m[8]) == 9) {
+    ESP_LOGD(TAG, "Set LED color matrix %s", res->str_val);
+    color_lut_set_params(&params);
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+static int  led_gamma_cb(const sarg_result *res) {
+  color_lut_params_t params;
+  float *g = params.gamma;
+  if (color_lut_get_params(&params) != ESP_OK) {
+    return SARG_ERR_SUCCESS;
+  }
+  if (sscanf(res->str_val, "%f,%f,%f", &g[0], &g[1], &g[2]) == 3) {
+    ESP_LOGD(TAG, "Set LED gamma %s", res->str_val);
+    if (color_lut_set_params(&params) != ESP_OK) {
+      ESP_LOGW(TAG, "Invalid LED gamma %s", res->str_val);
+    }
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+static int  led_lut_cb(const sarg_result *res) {
+  color_lut_params_t params;
+  esp_err_t err = ESP_OK;
+  if (strcmp("save", res->str_val) == 0) {
+    err = color_lut_save();
+  } else if (strcmp("load", res->str_val) == 0) {
+    err = color_lut_load();
+  } else if (strcmp("reset", res->str_val) == 0) {
+    color_lut_default_params(&params);
+    err = color_lut_set_params(&params);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Color calibration %s failed with error 0x%x", res->str_val, err);
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+
+static int  led_mode_cb(const sarg_result *res) {
+  esp_err_t err = ESP_OK;
+  if (strcmp("average", res->str_val) == 0) {
+    err = backlight_set_mode(BACKLIGHT_MODE_AVERAGE);
+  } else if (strcmp("dominant", res->str_val) == 0) {
+    err = backlight_set_mode(BACKLIGHT_MODE_DOMINANT);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Backlight mode %s failed with error 0x%x", res->str_val, err);
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+static int  led_power_cb(const sarg_result *res) {
+  if (res->int_val < 0) {
+    ESP_LOGW(TAG, "LED power budget %d mA is negative, use 0 for unlimited", res->int_val);
+    return SARG_ERR_PARSE;
+  }
+  ESP_LOGD(TAG, "Set LED power budget to %d mA (0=unlimited)",res->int_val);
+  power_limit_set_budget(res->int_val);
+  return SARG_ERR_SUCCESS;
+}
+
+
+static int  led_scenecut_cb(const sarg_result *res) {
+  ESP_LOGD(TAG, "Set scene cut threshold (0-256) to %d",res->int_val);
+  if (res->int_val >= 0 && res->int_val <= 256) {
+    scene_cut_set_threshold(res->int_val);
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+static int  led_saturation_cb(const sarg_result *res) {
+  ESP_LOGD(TAG, "Set LED saturation gain (0-1024) to %d",res->int_val);
+  if (res->int_val >= 0 && res->int_val <= 1024) {
+    s_led_saturation = res->int_val;
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+// block delta coder of the UDP stream, set up for the camera format on use
+static delta_encoder_t s_udp_delta;
+static volatile uint32_t s_udp_delta_threshold = CONFIG_UDP_DELTA_THRESHOLD;
+static int s_udp_delta_frames = 0;   // since the last keyframe
+
+static int  udp_stream_cb(const sarg_result *res) {
+  char host[32];
+  int port = CONFIG_UDP_STREAM_PORT;
+  if (strcmp("off", res->str_val) == 0) {
+    udp_stream_stop();
+    return SARG_ERR_SUCCESS;
+  }
+  if (sscanf(res->str_val, "%31[^:]:%d", host, &port) < 1 ||
+      udp_stream_start(host, port, CONFIG_UDP_STREAM_KBPS) != ESP_OK) {
+    ESP_LOGW(TAG, "Invalid UDP stream receiver %s", res->str_val);
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+static int  udp_rate_cb(const sarg_result *res) {
+  ESP_LOGD(TAG, "Set UDP stream bitrate to %d kbps",res->int_val);
+  if (res->int_val > 0) {
+    udp_stream_set_bitrate(res->int_val);
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+static int  udp_delta_cb(const sarg_result *res) {
+  ESP_LOGD(TAG, "Set UDP block delta threshold to %d",res->int_val);
+  if (res->int_val >= 0) {
+    s_udp_delta_threshold = res->int_val;
+    s_udp_delta.threshold = res->int_val;
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+static int  latency_cb(const sarg_result *res) {
+  if (res->int_val > 0) {
+    latency_start(res->int_val);
+  } else {
+    int length = latency_report(telnet_cmd_response_buff, RESPONSE_BUFFER_LEN);
+    telnet_esp32_sendData((uint8_t *)telnet_cmd_response_buff, length);
+  }
+  return SARG_ERR_SUCCESS;
+}
+
+
 const static sarg_opt my_opts[] = {
     {"h", "help", "show help text", BOOL, help_cb},
     {"s", "stats", "system stats (0=mem,1=tasks)", INT, sys_stats_cb},
@@ -885,33 +1447,68 @@ const static sarg_opt my_opts[] = {
     {NULL, "gamma", "ov7670 gamma mode (0=disabled,1=slope1)", INT, ov7670_gamma_cb},
     {NULL, "whitebalance", "ov7670 whitebalance (0,1,2)", INT, ov7670_whitebalance_cb},
     {NULL, "video", "video mode (0=off,1=on)", INT, videomode_cb},
+    {NULL, "attack", "LED smoothing on rise (1-256, 256=off)", INT, led_attack_cb},
+    {NULL, "decay", "LED smoothing on fall (1-256, 256=off)", INT, led_decay_cb},
+    {NULL, "interpolate", "LED interpolation between frames (0=off,1=on)", INT, led_interpolate_cb},
+    {NULL, "scenecut", "scene cut threshold (0=off, 1-256)", INT, led_scenecut_cb},
+    {NULL, "corners", "screen corners (auto, off, tlx,tly,trx,try,brx,bry,blx,bly)", STRING, led_corners_cb},
+    {NULL, "ledsat", "LED saturation gain (256=unchanged, 0-1024)", INT, led_saturation_cb},
+    {NULL, "ccm", "LED color matrix (9 values, row major)", STRING, led_ccm_cb},
+    {NULL, "ledgamma", "LED gamma (r,g,b)", STRING, led_gamma_cb},
+    {NULL, "lut", "LED color calibration (save, load, reset)", STRING, led_lut_cb},
+    {NULL, "ledmode", "LED zone color (average, dominant)", STRING, led_mode_cb},
+    {NULL, "power", "LED power budget in mA (0=unlimited)", INT, led_power_cb},
+    {NULL, "udp", "raw frames over UDP (ip[:port], off)", STRING, udp_stream_cb},
+    {NULL, "udprate", "UDP stream bitrate in kbps", INT, udp_rate_cb},
+    {NULL, "udpdelta", "UDP block delta threshold, 0 for raw frames", INT, udp_delta_cb},
+    {NULL, "latency", "measure glass-to-LED latency (n=start n trials, 0=report)", INT, latency_cb},
     {NULL, NULL, NULL, INT, NULL}
 };
 
 
+static bool is_cmd_separator(char c) {
+  return c == ';' || c == '\n' || c == '\r';
+}
+
+// run the commands received, separated by ';' or line ends; more than fits
+// in telnet_cmd_buffer is taken in pieces cut after a separator
 static int handle_command(uint8_t *cmdLine, size_t len)
 {
-    int ret = sarg_init(&root, my_opts, "ESPILICAM");
-    assert(ret == SARG_ERR_SUCCESS);
-    // lots of redundant code here! //strcpy or memcpy would suffice
-    size_t cmd_len = len;
-    if (len > CMD_BUFFER_LEN) cmd_len = CMD_BUFFER_LEN;
-    for (int i = 0; i < cmd_len; i++)
-      telnet_cmd_buffer[i] = *(cmdLine+i);
-    telnet_cmd_buffer[cmd_len-1] = '\0';
-    ESP_LOGD(TAG, "Processing telnet_cmd_buffer len=%d - contents=%s",cmd_len,(char*)telnet_cmd_buffer);
-    if(telnet_cmd_buffer != NULL) {
-        // next command will call sarg_parse and call callbacks as needed...
-        ret = sarg_parse_command_buffer(&root, telnet_cmd_buffer, cmd_len);
-        if(ret != SARG_ERR_SUCCESS) {
-            ESP_LOGE(TAG, "Command parsing failed");
-            sarg_destroy(&root);
-            return -1;
+    int failed = 0;
+    while (len > 0) {
+        size_t cmd_len = len < CMD_BUFFER_LEN - 1 ? len : CMD_BUFFER_LEN - 1;
+        if (cmd_len < len) {
+            size_t cut = cmd_len;
+            while (cut > 0 && !is_cmd_separator(cmdLine[cut - 1]))
+                cut--;
+            // a single command this long is cut short
+            if (cut > 0)
+                cmd_len = cut;
+        }
+        memcpy(telnet_cmd_buffer, cmdLine, cmd_len);
+        telnet_cmd_buffer[cmd_len] = '\0';
+        cmdLine += cmd_len;
+        len -= cmd_len;
+        ESP_LOGD(TAG, "Processing telnet_cmd_buffer len=%d - contents=%s", cmd_len, telnet_cmd_buffer);
+
+        char *cmd = telnet_cmd_buffer;
+        while (cmd != NULL) {
+            char *next = cmd;
+            while (*next != '\0' && !is_cmd_separator(*next))
+                next++;
+            if (*next != '\0')
+                *next++ = '\0';
+            else
+                next = NULL;
+            if (cmd_run(cmd) != SARG_ERR_SUCCESS)
+                failed++;
+            cmd = next;
         }
-        // command has been parsed and executed!
-        ESP_LOGD(TAG, "Command parser completed...");
     }
-    sarg_destroy(&root);
+    if (failed > 0) {
+        ESP_LOGE(TAG, "Command parsing failed");
+        return -1;
+    }
     return 0;
 }
 
@@ -1022,14 +1619,14 @@ static void convert_yuv_line_to_565(uint8_t *srcline, uint8_t *destline, int byt
 }
 */
 
-static void convert_fb32bit_line_to_bmp565(uint32_t *srcline, uint8_t *destline, const camera_pixelformat_t format) {
+static void convert_fb32bit_line_to_bmp565(uint32_t *srcline, uint8_t *destline, const camera_pixelformat_t format, int width) {
 
   uint16_t pixel565 = 0;
   uint16_t pixel565_2 = 0;
   uint32_t long2px = 0;
   uint16_t *sptr;
   int current_src_pos=0, current_dest_pos=0;
-  for (int current_pixel_pos = 0; current_pixel_pos < 320; current_pixel_pos += 2)
+  for (int current_pixel_pos = 0; current_pixel_pos < width; current_pixel_pos += 2)
   {
     current_src_pos = current_pixel_pos/2;
     long2px = srcline[current_src_pos];
@@ -1063,212 +1660,982 @@ static void convert_fb32bit_line_to_bmp565(uint32_t *srcline, uint8_t *destline,
 }
 
 
-// TODO: handle http request while videomode on
+// encodings kept in the frame cache
+typedef enum {
+  FRAME_BMP565 = 0,   // bitmap565 header and bottom-up 565 lines
+  FRAME_PGM,          // P5 header and the grayscale framebuffer
+  FRAME_RAW,          // the framebuffer as captured
+  FRAME_JPEG,
+  FRAME_DELTA,        // UDP block delta slices, never cached
+} frame_format_t;
 
-static void http_server_netconn_serve(struct netconn *conn)
+typedef struct {
+  broadcast_frame_t *frame;
+  size_t len;
+} jpeg_frame_writer_t;
+
+static int jpeg_frame_write(void *ctx, const uint8_t *data, size_t len) {
+  jpeg_frame_writer_t *w = (jpeg_frame_writer_t *)ctx;
+  if (w->len + len > w->frame->capacity)
+    return 1;
+  memcpy(w->frame->data + w->len, data, len);
+  w->len += len;
+  return 0;
+}
+
+// cheaper JPEG stream encodings for slow links, best first; clients at
+// level n follow broadcast channel n
+static const struct {
+  uint8_t quality;    // percent of CONFIG_HTTP_JPEG_QUALITY
+  bool half;          // half resolution
+} stream_levels[BROADCAST_MAX_CHANNELS] = {
+  { 100, false }, { 60, false }, { 100, true }, { 50, true },
+};
+
+// half resolution frames, only encoded by the capture task
+static uint32_t *s_half_fb = NULL;
+
+// encode the frame in the framebuffer, once per frame, format and level:
+// /bmp, /get and every /stream client share the cached buffer
+// returns the frame with a reference held, NULL if no buffer is available
+static broadcast_frame_t *encode_frame(frame_format_t format, int level) {
+  uint32_t key = camera_get_frame_count();
+  int cache_format = format | (level << 8);
+  broadcast_frame_t *frame = broadcast_find(key, cache_format);
+  uint8_t *p;
+  if (frame != NULL)
+    return frame;
+  switch (format) {
+    case FRAME_BMP565:
+      frame = broadcast_begin(key, format, sizeof(bitmap565) + 320*2*240);
+      if (frame == NULL)
+        return NULL;
+      bmp_init_header565((bitmap565 *)frame->data, camera_get_fb_width(), camera_get_fb_height());
+      p = frame->data + sizeof(bitmap565);
+      for (int i = 0; i < 240; i++) {
+        convert_fb32bit_line_to_bmp565((uint32_t *)&currFbPtr[(i*320)/2], p, s_pixel_format, 320);
+        p += 320*2;
+      }
+      break;
+    case FRAME_PGM: {
+      char pgm_header[32];
+      int n = snprintf(pgm_header, sizeof(pgm_header), "P5 %d %d %d\n", camera_get_fb_width(), camera_get_fb_height(), 255);
+      frame = broadcast_begin(key, format, n + camera_get_data_size());
+      if (frame == NULL)
+        return NULL;
+      memcpy(frame->data, pgm_header, n);
+      memcpy(frame->data + n, camera_get_fb(), camera_get_data_size());
+      break;
+    }
+    case FRAME_RAW:
+      frame = broadcast_begin(key, format, camera_get_data_size());
+      if (frame == NULL)
+        return NULL;
+      memcpy(frame->data, camera_get_fb(), camera_get_data_size());
+      break;
+    case FRAME_JPEG: {
+      // frames are usually a tenth of this, larger ones are not cached
+      jpeg_frame_writer_t w;
+      const uint32_t *fb = camera_get_fb();
+      int width = camera_get_fb_width(), height = camera_get_fb_height();
+      int quality = CONFIG_HTTP_JPEG_QUALITY * stream_levels[level].quality / 100;
+      if (stream_levels[level].half) {
+        if (s_half_fb == NULL)
+          s_half_fb = (uint32_t *) malloc(width * height / 2);
+        if (s_half_fb == NULL)
+          return NULL;
+        scale_yuv422_half(fb, width, height, s_half_fb);
+        fb = s_half_fb;
+        width /= 2;
+        height /= 2;
+      }
+      w.frame = broadcast_begin(key, cache_format, width * height / 2);
+      if (w.frame == NULL)
+        return NULL;
+      w.len = 0;
+      if (jpeg_encode_yuv422(fb, width, height, quality > 0 ? quality : 1,
+              jpeg_frame_write, &w) != ESP_OK) {
+        ESP_LOGD(TAG, "JPEG frame too large, not cached");
+        broadcast_release(w.frame);
+        return NULL;
+      }
+      frame = w.frame;
+      frame->len = w.len;
+      break;
+    }
+    default:
+      return NULL;
+  }
+  broadcast_commit(frame);
+  return frame;
+}
+
+static void frame_sent(void *ctx) {
+  broadcast_release((broadcast_frame_t *)ctx);
+}
+
+// send a cached frame from offset on, without copying it into lwIP; the
+// reference is dropped once the client has acknowledged it
+static err_t write_frame(tx_conn_t *tx, broadcast_frame_t *frame, size_t offset) {
+  return tx_conn_write_nocopy(tx, frame->data + offset, frame->len - offset, frame_sent, frame);
+}
+
+static frame_format_t stream_format() {
+#if CONFIG_HTTP_STREAM_JPEG
+  if (s_pixel_format == CAMERA_PF_YUV422)
+    return FRAME_JPEG;
+#endif
+  if ((s_pixel_format == CAMERA_PF_RGB565) || (s_pixel_format == CAMERA_PF_YUV422))
+    return FRAME_BMP565;
+  return FRAME_RAW;
+}
+
+// JPEG streams can be made cheaper, other formats only skip frames
+static int stream_max_level() {
+  return stream_format() == FRAME_JPEG ? BROADCAST_MAX_CHANNELS - 1 : 0;
+}
+
+// hand the frame just captured to every /stream client, in each level
+// some client currently wants
+static void stream_publish_frame() {
+  frame_format_t format = stream_format();
+  for (int level = 0; level <= stream_max_level(); level++) {
+    if (!broadcast_channel_wanted(level))
+      continue;
+    broadcast_frame_t *frame = encode_frame(format, level);
+    if (frame == NULL)
+      continue;
+    broadcast_publish(frame, level);
+    broadcast_release(frame);
+  }
+}
+
+// follow the level the rate controller picked
+// per broadcast slot, level -1 while the slot is free
+static metrics_client_t s_client_metrics[BROADCAST_MAX_CLIENTS];
+
+static metrics_client_t *client_metrics_start(int slot) {
+  metrics_client_t *m = &s_client_metrics[slot];
+  m->frames = 0;
+  m->bytes = 0;
+  m->dropped = 0;
+  m->level = 0;
+  return m;
+}
+
+static void stream_follow_level(int slot, stream_ctl_t *ctl, uint32_t *last_seq) {
+  stream_ctl_set_max_level(ctl, stream_max_level());
+  broadcast_set_channel(slot, ctl->level);
+  s_client_metrics[slot].level = ctl->level;
+  // sequence numbers are per channel
+  *last_seq = 0;
+}
+
+static bool udp_delta_ready(int width, int height) {
+  if (s_udp_delta.ref != NULL && s_udp_delta.width == width && s_udp_delta.height == height &&
+      s_udp_delta.format == s_pixel_format)
+    return true;
+  delta_encoder_free(&s_udp_delta);
+  return delta_encoder_init(&s_udp_delta, width, height, s_pixel_format, s_udp_delta_threshold) == ESP_OK;
+}
+
+// the changed blocks of the frame just captured, NULL if a keyframe is due
+// or there is no buffer
+static broadcast_frame_t *udp_delta_frame() {
+  broadcast_frame_t *frame;
+  size_t len;
+  int blocks;
+  // a frame about to be replaced is dropped now, its blocks go into this one
+  if (udp_stream_unpublish())
+    delta_encoder_resend(&s_udp_delta);
+  if (delta_encoder_need_key(&s_udp_delta) || s_udp_delta_frames >= CONFIG_UDP_DELTA_KEYFRAME_INTERVAL)
+    return NULL;
+  // larger than raw, a keyframe is sent instead
+  frame = broadcast_begin(camera_get_frame_count(), FRAME_DELTA, camera_get_data_size());
+  if (frame == NULL)
+    return NULL;
+  if (delta_encode(&s_udp_delta, (const uint8_t *)camera_get_fb(), frame->data, camera_get_data_size(),
+          UDP_STREAM_MAX_PAYLOAD, &len, &blocks) != ESP_OK) {
+    broadcast_release(frame);
+    return NULL;
+  }
+  frame->len = len;
+  s_udp_delta_frames++;
+  return frame;
+}
+
+// hand the frame just captured to the UDP sender, raw or as the blocks that
+// changed with a raw keyframe every CONFIG_UDP_DELTA_KEYFRAME_INTERVAL frames
+static void udp_publish_frame() {
+  udp_stream_info_t info;
+  uint32_t done_us;
+  broadcast_frame_t *frame = NULL;
+  bool delta;
+  // only fixed size lines can be cut into packets
+  if (s_pixel_format == CAMERA_PF_JPEG)
+    return;
+  info.width = camera_get_fb_width();
+  info.height = camera_get_fb_height();
+  info.format = s_pixel_format;
+  info.bytes_per_pixel = camera_get_data_size() / (info.width * info.height);
+  camera_get_frame_timing(&info.capture_us, &done_us);
+  delta = s_udp_delta_threshold > 0 && udp_delta_ready(info.width, info.height);
+  if (delta)
+    frame = udp_delta_frame();
+  info.delta = frame != NULL;
+  if (frame == NULL) {
+    frame = encode_frame(FRAME_RAW, 0);
+    if (frame == NULL)
+      return;
+    if (delta) {
+      delta_encoder_key(&s_udp_delta, (const uint8_t *)camera_get_fb());
+      s_udp_delta_frames = 0;
+    }
+  }
+  udp_stream_publish(frame, &info);
+}
+
+// send the shared frames to one /stream client until it goes away; frames
+// published while the previous one is still being written are skipped
+static void http_stream_serve(struct netconn *conn)
 {
-    struct netbuf *inbuf;
-    char *buf;
-    u16_t buflen;
+    broadcast_frame_t *frame;
+    tx_conn_t tx;
+    stream_ctl_t ctl;
+    metrics_client_t *metrics;
+    uint32_t last_seq = 0, sent = 0, skipped = 0, start_us;
     err_t err;
-    /* Read the data from the port, blocking if nothing yet there.
-     We assume the request (the part we care about) is in one netbuf */
-    err = netconn_recv(conn, &inbuf);
-    if (err == ERR_OK) {
-        netbuf_data(inbuf, (void**) &buf, &buflen);
-
-        /* Is this an HTTP GET command? (only check the first 5 chars, since
-         there are other formats for GET, and we're keeping it very simple )*/
-        if (buflen >= 5 && buf[0] == 'G' && buf[1] == 'E' && buf[2] == 'T'
-                && buf[3] == ' ' && buf[4] == '/') {
-
-          // disable videomode (autocapture) to allow streaming...
-          bool s_moviemode = is_moviemode_on();
-          set_moviemode(false);
-
-          /* Send the HTTP header
-             * subtract 1 from the size, since we dont send the \0 in the string
-             * NETCONN_NOCOPY: our data is const static, so no need to copy it
-             */
-          netconn_write(conn, http_hdr, sizeof(http_hdr) - 1,
+    int slot = -1;
+    // keep a worker free for snapshots and other requests
+    if (broadcast_subscribers() < CONFIG_HTTP_SERVER_TASKS - 1) {
+        slot = broadcast_subscribe();
+    }
+    if (slot < 0) {
+        ESP_LOGW(TAG, "Too many stream clients");
+        return;
+    }
+    metrics = client_metrics_start(slot);
+    err = netconn_write(conn, http_stream_hdr, sizeof(http_stream_hdr) - 1,
+        NETCONN_NOCOPY);
+    stream_ctl_init(&ctl, stream_max_level(), (uint32_t) esp_timer_get_time());
+    ESP_LOGD(TAG, "Stream started.");
+    while (err == ERR_OK) {
+        frame = broadcast_wait(slot, last_seq, 1000 / portTICK_RATE_MS);
+        if (frame == NULL) {
+            // the format changed and this level is no longer published
+            if (ctl.level > stream_max_level()) {
+                stream_follow_level(slot, &ctl, &last_seq);
+            }
+            continue;
+        }
+        if (last_seq != 0) {
+            skipped += frame->seq - last_seq - 1;
+            metrics->dropped += frame->seq - last_seq - 1;
+        }
+        last_seq = frame->seq;
+        start_us = (uint32_t) esp_timer_get_time();
+        if (!stream_ctl_frame(&ctl, start_us)) {
+            broadcast_release(frame);
+            continue;
+        }
+        // the reference is gone once the frame is acknowledged
+        metrics->bytes += frame->len;
+        if ((frame->format & 0xFF) == FRAME_BMP565) {
+            err = netconn_write(conn, http_bitmap_hdr, sizeof(http_bitmap_hdr) - 1,
+                NETCONN_NOCOPY);
+        } else {
+            err = netconn_write(conn, http_jpg_hdr, sizeof(http_jpg_hdr) - 1,
+                NETCONN_NOCOPY);
+        }
+        if (err == ERR_OK) {
+            tx_conn_init(&tx, conn);
+            write_frame(&tx, frame, 0);
+            if (tx.err == ERR_OK) {
+                netconn_write(conn, http_stream_boundary, sizeof(http_stream_boundary) - 1,
                     NETCONN_NOCOPY);
+            }
+            err = tx_conn_flush(&tx);
+        } else {
+            broadcast_release(frame);
+        }
+        sent++;
+        metrics->frames++;
+        // the frame has been acknowledged, nothing is left in flight
+        uint32_t now_us = (uint32_t) esp_timer_get_time();
+        if (stream_ctl_update(&ctl, now_us - start_us, 0, now_us)) {
+            ESP_LOGD(TAG, "Stream level %d, skipping %d", ctl.level, ctl.skip);
+            stream_follow_level(slot, &ctl, &last_seq);
+        }
+    }
+    metrics->level = -1;
+    broadcast_unsubscribe(slot);
+    ESP_LOGD(TAG, "Stream ended, %u frames sent, %u skipped.", sent, skipped);
+    ESP_LOGI(TAG, "task stack: %d", uxTaskGetStackHighWaterMark(NULL));
+}
 
+static const char *frame_format_name(frame_format_t format) {
+  switch (format) {
+    case FRAME_BMP565: return "bmp";
+    case FRAME_PGM: return "pgm";
+    case FRAME_JPEG: return "jpeg";
+    case FRAME_DELTA: return "delta";
+    default: return "raw";
+  }
+}
 
-           //check if a stream is requested.
-           if (buf[5] == 's') {
-                //Send mjpeg stream header
-                err = netconn_write(conn, http_stream_hdr, sizeof(http_stream_hdr) - 1,
-                    NETCONN_NOCOPY);
-                ESP_LOGD(TAG, "Stream started.");
+// one JSON object: frame rate, stage timings, this client's counters and
+// the LED colors as shown
+static int ws_telemetry(char *out, size_t size, uint32_t fps_x10, uint32_t sent, uint32_t dropped,
+    const stream_ctl_t *ctl) {
+  uint32_t vsync_us, done_us;
+  int n;
+  camera_get_frame_timing(&vsync_us, &done_us);
+  n = snprintf(out, size, "{\"frame\":%u,\"fps\":%u.%u,\"format\":\"%s\",\"capture_us\":%u,"
+      "\"backlight_us\":%u,\"sent\":%u,\"dropped\":%u,\"level\":%d,\"skip\":%d,\"heap\":%u,\"leds\":[",
+      camera_get_frame_count(), fps_x10 / 10, fps_x10 % 10, frame_format_name(stream_format()),
+      done_us - vsync_us, s_backlight_us, sent, dropped, ctl->level, ctl->skip, esp_get_free_heap_size());
+  for (int i = 0; i < s_led_count && n + 12 < size; i++) {
+    n += snprintf(out + n, size - n, "%s\"%02x%02x%02x\"", i ? "," : "",
+        s_led_out[i].r, s_led_out[i].g, s_led_out[i].b);
+  }
+  if (n + 3 > size)
+    return -1;
+  n += snprintf(out + n, size - n, "]}");
+  return n;
+}
 
-                //Run while everyhting is ok and connection open.
-                while(err == ERR_OK) {
-                    ESP_LOGD(TAG, "Capture frame");
+static void ws_send(tx_conn_t *tx, ws_opcode_t opcode, const void *payload, size_t len) {
+  uint8_t hdr[WS_MAX_HEADER_LEN];
+  tx_conn_write(tx, hdr, ws_frame_header(hdr, opcode, len));
+  tx_conn_write(tx, payload, len);
+  tx_conn_push(tx);
+}
 
-/*
-                    PAUSE_DISPLAY = true;
-                    err = camera_run();
-                    PAUSE_DISPLAY = false;
-*/
+// read what the client sent, answer pings and close requests
+// returns false once the connection is to be closed
+static bool ws_handle_input(struct netconn *conn, tx_conn_t *tx, uint8_t *rx, size_t *rx_len, size_t rx_size) {
+  struct netbuf *inbuf;
+  ws_frame_t frame;
+  void *data;
+  u16_t len;
+  int used;
+  err_t err = netconn_recv(conn, &inbuf);
+  if (err == ERR_TIMEOUT)
+    return true;
+  if (err != ERR_OK)
+    return false;
+  do {
+    netbuf_data(inbuf, &data, &len);
+    if (len > rx_size - *rx_len) {
+      // only control frames and short commands are expected
+      uint8_t status[2] = { 1009 >> 8, 1009 & 0xFF };
+      netbuf_delete(inbuf);
+      ws_send(tx, WS_OP_CLOSE, status, sizeof(status));
+      return false;
+    }
+    memcpy(rx + *rx_len, data, len);
+    *rx_len += len;
+  } while (netbuf_next(inbuf) >= 0);
+  netbuf_delete(inbuf);
+
+  while ((used = ws_parse_frame(rx, *rx_len, &frame)) > 0) {
+    if (frame.opcode == WS_OP_CLOSE) {
+      // echo the status code
+      ws_send(tx, WS_OP_CLOSE, frame.payload, frame.len >= 2 ? 2 : 0);
+      return false;
+    } else if (frame.opcode == WS_OP_PING) {
+      ws_send(tx, WS_OP_PONG, frame.payload, frame.len);
+    }
+    *rx_len -= used;
+    memmove(rx, rx + used, *rx_len);
+  }
+  return used == 0;
+}
 
-                    capture_request();
-                    capture_wait_finish();
-
-
-                    //spi_lcd_send();
-                    //spi_lcd_wait_finish();
-
-                    if (err != ESP_OK) {
-                        ESP_LOGD(TAG, "Camera capture failed with error = %d", err);
-                    } else {
-                        ESP_LOGD(TAG, "Done");
-                        //stream an image..
-                        if((s_pixel_format == CAMERA_PF_RGB565) || (s_pixel_format == CAMERA_PF_YUV422)) {
-                            // write mime boundary start
-                            err = netconn_write(conn, http_bitmap_hdr, sizeof(http_bitmap_hdr) - 1,
-                                NETCONN_NOCOPY);
-                            // write bitmap header
-                            char *bmp = bmp_create_header565(camera_get_fb_width(), camera_get_fb_height());
-                            err = netconn_write(conn, bmp, sizeof(bitmap565), NETCONN_NOCOPY);
-                            free(bmp);
-                            // convert framebuffer on the fly...
-                            // only rgb and yuv...
-                            uint8_t s_line[320*2];
-                            uint32_t *fbl;
-                            for (int i = 0; i < 240; i++) {
-                              fbl = &currFbPtr[(i*320)/2];  //(i*(320*2)/4); // 4 bytes for each 2 pixel / 2 byte read..
-                              convert_fb32bit_line_to_bmp565(fbl, s_line,s_pixel_format);
-                              err = netconn_write(conn, s_line, 320*2,
-                                            NETCONN_COPY);
-                            }
-                        }
-                        else { // stream jpeg
-                            err = netconn_write(conn, http_jpg_hdr, sizeof(http_jpg_hdr) - 1,
-                                NETCONN_NOCOPY);
-                            if(err == ERR_OK)
-                              err = netconn_write(conn, camera_get_fb(), camera_get_data_size(),
-                                              NETCONN_COPY);
-                        }
-                        if(err == ERR_OK)
-                        {
-                            //Send boundary to next jpeg
-                            err = netconn_write(conn, http_stream_boundary,
-                                    sizeof(http_stream_boundary) -1, NETCONN_NOCOPY);
-                        }
-                        vTaskDelay(30 / portTICK_RATE_MS);
-                    }
-                }
-                ESP_LOGD(TAG, "Stream ended.");
-                ESP_LOGI(TAG, "task stack: %d", uxTaskGetStackHighWaterMark(NULL));
+// push the shared stream frames as binary messages and telemetry as text
+// messages once a second over a WebSocket; a frame published while the
+// client has not acknowledged the previous one yet is dropped, so a slow
+// link costs frame rate, not latency. How long the acknowledgements take
+// drives the client's stream level and frame skip.
+static void ws_serve(struct netconn *conn, const char *req, u16_t req_len)
+{
+    char accept[WS_ACCEPT_LEN + 1];
+    uint8_t rx[128];
+    size_t rx_len = 0, json_size = 180 + s_led_count * 9;
+    tx_conn_t tx;
+    stream_ctl_t ctl;
+    metrics_client_t *metrics;
+    broadcast_frame_t *frame;
+    uint32_t last_seq = 0, sent = 0, dropped = 0;
+    uint32_t telemetry_frame = camera_get_frame_count();
+    uint32_t now_us, write_us = 0;
+    TickType_t now, telemetry_at = xTaskGetTickCount() + configTICK_RATE_HZ;
+    bool open = true, in_flight = false, changed;
+    int slot = -1, n;
+    char *json;
+
+    if (!ws_handshake(req, req_len, accept)) {
+        netconn_write(conn, http_bad_request, sizeof(http_bad_request) - 1, NETCONN_NOCOPY);
+        return;
+    }
+    // keep a worker free for snapshots and other requests
+    if (broadcast_subscribers() < CONFIG_HTTP_SERVER_TASKS - 1) {
+        slot = broadcast_subscribe();
+    }
+    json = (char *) malloc(json_size);
+    if (slot < 0 || json == NULL) {
+        ESP_LOGW(TAG, "Too many stream clients");
+        netconn_write(conn, http_unavailable, sizeof(http_unavailable) - 1, NETCONN_NOCOPY);
+        broadcast_unsubscribe(slot);
+        free(json);
+        return;
+    }
+    metrics = client_metrics_start(slot);
+    netconn_write(conn, http_ws_hdr, sizeof(http_ws_hdr) - 1, NETCONN_NOCOPY);
+    netconn_write(conn, accept, WS_ACCEPT_LEN, NETCONN_COPY);
+    netconn_write(conn, "\r\n\r\n", 4, NETCONN_NOCOPY);
+    netconn_set_recvtimeout(conn, 1);
+    tx_conn_init(&tx, conn);
+    stream_ctl_init(&ctl, stream_max_level(), (uint32_t) esp_timer_get_time());
+    ESP_LOGD(TAG, "WebSocket client connected.");
+
+    while (open && tx.err == ERR_OK) {
+        // look for the acknowledgement of the frame in flight every tick
+        frame = broadcast_wait(slot, last_seq, in_flight ? 1 : 100 / portTICK_RATE_MS);
+        now_us = (uint32_t) esp_timer_get_time();
+        changed = false;
+        if (in_flight && tx_conn_poll(&tx) == 0) {
+            in_flight = false;
+            changed = stream_ctl_update(&ctl, now_us - write_us, 0, now_us);
+        }
+        if (frame != NULL) {
+            last_seq = frame->seq;
+            if (!stream_ctl_frame(&ctl, now_us)) {
+                broadcast_release(frame);
+            } else if (in_flight) {
+                dropped++;
+                metrics->dropped++;
+                broadcast_release(frame);
+                changed |= stream_ctl_update(&ctl, now_us - write_us, tx_conn_backlog(&tx), now_us);
             } else {
-                if (s_pixel_format == CAMERA_PF_JPEG) {
-                    netconn_write(conn, http_jpg_hdr, sizeof(http_jpg_hdr) - 1, NETCONN_NOCOPY);
-                } else if (s_pixel_format == CAMERA_PF_GRAYSCALE) {
-                    netconn_write(conn, http_pgm_hdr, sizeof(http_pgm_hdr) - 1, NETCONN_NOCOPY);
-                    if (memcmp(&buf[5], "pgm", 3) == 0) {
-                        char pgm_header[32];
-                        snprintf(pgm_header, sizeof(pgm_header), "P5 %d %d %d\n", camera_get_fb_width(), camera_get_fb_height(), 255);
-                        netconn_write(conn, pgm_header, strlen(pgm_header), NETCONN_COPY);
-                    }
-                    else {
-                      char outstr[120];
-                      get_image_mime_info_str(outstr);
-                      netconn_write(conn, outstr, sizeof(outstr) - 1, NETCONN_NOCOPY);
-                      //netconn_write(conn, http_yuv422_hdr, sizeof(http_yuv422_hdr) - 1, NETCONN_NOCOPY);
-                    }
-                } else
-                 if (s_pixel_format == CAMERA_PF_RGB565) {
-                    netconn_write(conn, http_bitmap_hdr, sizeof(http_bitmap_hdr) - 1, NETCONN_NOCOPY);
-                    if (memcmp(&buf[5], "bmp", 3) == 0) {
-                        char *bmp = bmp_create_header565(camera_get_fb_width(), camera_get_fb_height());
-                        err = netconn_write(conn, bmp, sizeof(bitmap565), NETCONN_COPY);
-                        free(bmp);
-                    }
-                    else {
-                      char outstr[120];
-                      get_image_mime_info_str(outstr);
-                      netconn_write(conn, outstr, sizeof(outstr) - 1, NETCONN_NOCOPY);
-                      //netconn_write(conn, http_yuv422_hdr, sizeof(http_yuv422_hdr) - 1, NETCONN_NOCOPY);
-                    }
-                } else if (s_pixel_format == CAMERA_PF_YUV422) {
-                  if (memcmp(&buf[5], "bmp", 3) == 0) {
-                      //PAUSE_DISPLAY = true;
-                      // send YUV converted to 565 2bpp for now...
-                      netconn_write(conn, http_bitmap_hdr, sizeof(http_bitmap_hdr) - 1, NETCONN_NOCOPY);
-                      char *bmp = bmp_create_header565(camera_get_fb_width(), camera_get_fb_height());
-                      err = netconn_write(conn, bmp, sizeof(bitmap565), NETCONN_COPY);
-                      free(bmp);
-                  } else {
-                    char outstr[120];
-                    get_image_mime_info_str(outstr);
-                    netconn_write(conn, outstr, sizeof(outstr) - 1, NETCONN_NOCOPY);
-                    //netconn_write(conn, http_yuv422_hdr, sizeof(http_yuv422_hdr) - 1, NETCONN_NOCOPY);
-                  }
-                } else {
-                  char outstr[120];
-                  get_image_mime_info_str(outstr);
-                  netconn_write(conn, outstr, sizeof(outstr) - 1, NETCONN_NOCOPY);
-                }
-                // handle non streaming images (http../get and http:../bmp )
-
-                  ESP_LOGD(TAG, "Image requested.");
-                  //ESP_LOGI(TAG, "task stack: %d", uxTaskGetStackHighWaterMark(NULL));
-
-                  bool s_moviemode = is_moviemode_on();
-                  set_moviemode(false);
-                  capture_request();
-                  capture_wait_finish();
-                  set_moviemode(s_moviemode);
-
-                  //ESP_LOGI(TAG, "task stack: %d", uxTaskGetStackHighWaterMark(NULL));
-
-                  if (err != ESP_OK) {
-                      ESP_LOGD(TAG, "Camera capture failed with error = %d", err);
-                  } else {
-                      ESP_LOGD(TAG, "Done");
-                      //ESP_LOGI(TAG, "task stack: %d", uxTaskGetStackHighWaterMark(NULL));
-                      //Send jpeg
-                      if ((s_pixel_format == CAMERA_PF_RGB565) || (s_pixel_format == CAMERA_PF_YUV422)) {
-                        ESP_LOGD(TAG, "Converting framebuffer to RGB565 requested, sending...");
-                        uint8_t s_line[320*2];
-                        uint32_t *fbl;
-                        for (int i = 0; i < 240; i++) {
-                          fbl = &currFbPtr[(i*320)/2];  //(i*(320*2)/4); // 4 bytes for each 2 pixel / 2 byte read..
-                          convert_fb32bit_line_to_bmp565(fbl, s_line,s_pixel_format);
-                          err = netconn_write(conn, s_line, 320*2,
-                                        NETCONN_COPY);
-                        }
-                    //    ESP_LOGI(TAG, "task stack: %d", uxTaskGetStackHighWaterMark(NULL));
-
-                      } else
-                        err = netconn_write(conn, camera_get_fb(), camera_get_data_size(),
-                          NETCONN_NOCOPY);
-                  } // handle .bmp and std gets...
+                uint8_t hdr[WS_MAX_HEADER_LEN];
+                tx_conn_write(&tx, hdr, ws_frame_header(hdr, WS_OP_BINARY, frame->len));
+                metrics->bytes += frame->len;
+                write_frame(&tx, frame, 0);
+                write_us = now_us;
+                in_flight = true;
+                sent++;
+                metrics->frames++;
+            }
+        } else if (ctl.level > stream_max_level()) {
+            // the camera format changed under the client
+            changed = true;
+        }
+        if (changed) {
+            ESP_LOGD(TAG, "WebSocket client at level %d, skip %d", ctl.level, ctl.skip);
+            stream_follow_level(slot, &ctl, &last_seq);
+        }
+        now = xTaskGetTickCount();
+        if ((frame == NULL && !in_flight) || (int32_t) (now - telemetry_at) >= 0) {
+            open = ws_handle_input(conn, &tx, rx, &rx_len, sizeof(rx));
+        }
+        if (open && (int32_t) (now - telemetry_at) >= 0) {
+            uint32_t frames = camera_get_frame_count() - telemetry_frame;
+            uint32_t elapsed = now - telemetry_at + configTICK_RATE_HZ;
+            telemetry_frame += frames;
+            telemetry_at = now + configTICK_RATE_HZ;
+            n = ws_telemetry(json, json_size, frames * 10 * configTICK_RATE_HZ / elapsed, sent, dropped, &ctl);
+            if (n > 0) {
+                ws_send(&tx, WS_OP_TEXT, json, n);
+            }
+        }
+    }
+    tx_conn_flush(&tx);
+    free(json);
+    metrics->level = -1;
+    broadcast_unsubscribe(slot);
+    ESP_LOGD(TAG, "WebSocket closed, %u frames sent, %u dropped.", sent, dropped);
+}
+
+#define SNAPSHOT_ATTEMPTS 4
+
+// Snapshots read the last completed frame as it is, between two captures,
+// while the camera is running; otherwise a frame is captured first, as
+// nothing else would. A read is only good if fb_read_end agrees.
+static bool fb_read_begin(uint32_t *writes) {
+  if (!camera_running()) {
+    capture_request();
+    capture_wait_finish();
+  }
+  // a capture in progress takes a frame period at most
+  for (int i = 0; ((*writes = s_fb_writes) & 1) && i < 1000 / portTICK_RATE_MS; i++)
+    vTaskDelay(1);
+  return (*writes & 1) == 0;
+}
+
+// true if no capture started since fb_read_begin
+static bool fb_read_end(uint32_t writes) {
+  return s_fb_writes == writes;
+}
+
+// encode the last completed frame for a snapshot; ESP_ERR_NO_MEM if there
+// is no cache buffer for it, ESP_ERR_TIMEOUT if it kept being overwritten
+static esp_err_t snapshot_frame(frame_format_t format, broadcast_frame_t **frame) {
+  uint32_t writes;
+  for (int attempt = 0; attempt < SNAPSHOT_ATTEMPTS; attempt++) {
+    if (!fb_read_begin(&writes))
+      return ESP_ERR_TIMEOUT;
+    *frame = encode_frame(format, 0);
+    if (*frame == NULL)
+      return ESP_ERR_NO_MEM;
+    if (fb_read_end(writes))
+      return ESP_OK;
+    // torn, the cache entry still carries the old frame number
+    broadcast_release(*frame);
+  }
+  *frame = NULL;
+  ESP_LOGD(TAG, "Snapshot kept being overwritten");
+  return ESP_ERR_TIMEOUT;
+}
+
+// response body, chunked when a kept-alive response has no known length
+typedef struct {
+  tx_conn_t tx;
+  bool chunked;
+} http_body_t;
+
+// status line and headers of a 200 response with a body of len bytes, or
+// of unknown length for len < 0: chunked if the client can take it, else
+// ended by closing the connection. Returns whether the connection may be
+// kept open afterwards.
+static bool http_response_begin(http_body_t *body, struct netconn *conn, const http_request_t *req,
+    const char *type, size_t type_len, int len) {
+  char hdr[32];
+  bool keep_alive = req->keep_alive && (len >= 0 || req->http11);
+  tx_conn_init(&body->tx, conn);
+  body->chunked = keep_alive && len < 0;
+  tx_conn_write(&body->tx, http_hdr, sizeof(http_hdr) - 1);
+  if (len >= 0)
+    tx_conn_write(&body->tx, hdr, snprintf(hdr, sizeof(hdr), "Content-Length: %d\r\n", len));
+  else if (body->chunked)
+    tx_conn_write(&body->tx, http_chunked_hdr, sizeof(http_chunked_hdr) - 1);
+  if (keep_alive)
+    tx_conn_write(&body->tx, http_keep_alive_hdr, sizeof(http_keep_alive_hdr) - 1);
+  else
+    tx_conn_write(&body->tx, http_close_hdr, sizeof(http_close_hdr) - 1);
+  // ends the head
+  tx_conn_write(&body->tx, type, type_len);
+  return keep_alive;
+}
+
+// a jpeg_write_cb_t as well
+static int http_body_write(void *ctx, const uint8_t *data, size_t len) {
+  http_body_t *body = (http_body_t *)ctx;
+  char size[12];
+  // an empty chunk would end the body
+  if (len == 0)
+    return 0;
+  if (body->chunked)
+    tx_conn_write(&body->tx, size, snprintf(size, sizeof(size), "%x\r\n", len));
+  tx_conn_write(&body->tx, data, len);
+  if (body->chunked)
+    tx_conn_write(&body->tx, "\r\n", 2);
+  return body->tx.err != ERR_OK;
+}
+
+// complete is false for a body cut short, which must not look complete
+static bool http_response_end(http_body_t *body, bool complete) {
+  if (body->chunked && complete)
+    tx_conn_write(&body->tx, "0\r\n\r\n", 5);
+  return tx_conn_flush(&body->tx) == ERR_OK && complete;
+}
+
+#define THUMB_WIDTH 80
+#define THUMB_HEIGHT 60
 
+// /thumb?w=&h=&bmp=1: the last completed frame shrunk with a box filter,
+// as JPEG unless a bitmap is asked for. Thumbnails are at most half the
+// frame size; the scaled copy is taken between two captures and encoded
+// from there.
+static bool thumb_serve(struct netconn *conn, const http_request_t *req)
+{
+    int width = http_query_int(req, "w", THUMB_WIDTH) & ~1;
+    int height = http_query_int(req, "h", THUMB_HEIGHT);
+    bool bmp = http_query_int(req, "bmp", 0) != 0;
+    uint32_t *thumb = NULL, writes;
+    esp_err_t err = ESP_FAIL;
+    http_body_t body;
+    bool keep_alive, complete = true;
+
+    // framebuffer sizes only change with the camera format
+    if (s_pixel_format != CAMERA_PF_YUV422) {
+        netconn_write(conn, http_unavailable, sizeof(http_unavailable) - 1, NETCONN_NOCOPY);
+        return false;
+    }
+    if (width < 2 || height < 1 || width > camera_get_fb_width() / 2 ||
+            height > camera_get_fb_height() / 2) {
+        netconn_write(conn, http_bad_request, sizeof(http_bad_request) - 1, NETCONN_NOCOPY);
+        return false;
+    }
+    thumb = (uint32_t *) malloc(width * height * 2);
+    for (int attempt = 0; thumb != NULL && attempt < SNAPSHOT_ATTEMPTS; attempt++) {
+        if (!fb_read_begin(&writes))
+            break;
+        err = scale_yuv422_box(camera_get_fb(), camera_get_fb_width(), camera_get_fb_height(),
+            thumb, width, height);
+        if (err != ESP_OK || fb_read_end(writes))
+            break;
+        err = ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGD(TAG, "Thumbnail failed with error 0x%x", err);
+        netconn_write(conn, http_unavailable, sizeof(http_unavailable) - 1, NETCONN_NOCOPY);
+        free(thumb);
+        return false;
+    }
+
+    if (bmp) {
+        bitmap565 header;
+        uint8_t *dest;
+        keep_alive = http_response_begin(&body, conn, req, http_bitmap_hdr, sizeof(http_bitmap_hdr) - 1,
+            sizeof(bitmap565) + width * height * 2);
+        bmp_init_header565(&header, width, height);
+        tx_conn_write(&body.tx, &header, sizeof(bitmap565));
+        for (int i = 0; i < height && body.tx.err == ERR_OK; i++) {
+            uint32_t *line = thumb + i * width / 2;
+            dest = tx_conn_reserve(&body.tx, width * 2);
+            if (dest == NULL) {
+                // the thumbnail is not needed afterwards, convert in place
+                convert_fb32bit_line_to_bmp565(line, (uint8_t *) line, s_pixel_format, width);
+                tx_conn_write(&body.tx, line, width * 2);
+            } else {
+                convert_fb32bit_line_to_bmp565(line, dest, s_pixel_format, width);
+            }
+        }
+    } else {
+        keep_alive = http_response_begin(&body, conn, req, http_jpg_hdr, sizeof(http_jpg_hdr) - 1, -1);
+        complete = jpeg_encode_yuv422(thumb, width, height, CONFIG_HTTP_JPEG_QUALITY,
+            http_body_write, &body) == ESP_OK;
+    }
+    free(thumb);
+    return http_response_end(&body, complete) && keep_alive;
+}
+
+static void metrics_out(void *ctx, const char *text, size_t len) {
+  http_body_write(ctx, (const uint8_t *)text, len);
+}
+
+// one sample per connected client, of the counter at offset
+static void client_samples(metrics_writer_t *w, const char *name, const char *type, const char *help,
+    size_t offset) {
+  char labels[24];
+  metrics_family(w, name, type, help);
+  for (int i = 0; i < BROADCAST_MAX_CLIENTS; i++) {
+    const metrics_client_t *m = &s_client_metrics[i];
+    if (m->level >= 0) {
+      snprintf(labels, sizeof(labels), "client=\"%d\"", i);
+      metrics_sample(w, name, labels, *(const volatile uint32_t *)((const uint8_t *)m + offset));
+    }
+  }
+}
+
+// Prometheus text format; every value is read without taking a lock
+static bool metrics_serve(struct netconn *conn, const http_request_t *req)
+{
+    http_body_t body;
+    bool keep_alive;
+    metrics_writer_t w;
+    wifi_ap_record_t ap;
+    size_t free8, free32, free8start, free32start;
+    uint32_t dropped_lines, overruns, udp_sent, udp_dropped, udp_errors;
+
+    keep_alive = http_response_begin(&body, conn, req, http_metrics_hdr, sizeof(http_metrics_hdr) - 1, -1);
+    metrics_writer_init(&w, metrics_out, &body);
+
+    metrics_family(&w, "espilicam_frames_total", "counter", "Frames captured since the camera was initialized");
+    metrics_sample(&w, "espilicam_frames_total", NULL, camera_get_frame_count());
+    camera_get_dma_stats(&dropped_lines, &overruns);
+    metrics_family(&w, "espilicam_dma_dropped_lines_total", "counter", "Lines missing from captured frames");
+    metrics_sample(&w, "espilicam_dma_dropped_lines_total", NULL, dropped_lines);
+    metrics_family(&w, "espilicam_dma_overruns_total", "counter", "DMA buffers overwritten before they were filtered");
+    metrics_sample(&w, "espilicam_dma_overruns_total", NULL, overruns);
+    metrics_histogram(&w, "espilicam_capture_seconds", "VSYNC to last line in the framebuffer", &s_capture_hist);
+    metrics_histogram(&w, "espilicam_filter_seconds", "CPU time in the DMA filter per frame", &s_filter_hist);
+    metrics_histogram(&w, "espilicam_backlight_seconds", "Backlight update per frame", &s_backlight_hist);
+    metrics_histogram(&w, "espilicam_display_seconds", "LCD transfer per frame", &s_display_hist);
+
+    heap_stats(&free8, &free32, &free8start, &free32start);
+    metrics_family(&w, "espilicam_heap_free_bytes", "gauge", "Free heap");
+    metrics_sample(&w, "espilicam_heap_free_bytes", NULL, esp_get_free_heap_size());
+    metrics_family(&w, "espilicam_heap_largest_free_block_bytes", "gauge", "Largest free heap block");
+    metrics_sample(&w, "espilicam_heap_largest_free_block_bytes", "caps=\"8bit\"", free8);
+    metrics_sample(&w, "espilicam_heap_largest_free_block_bytes", "caps=\"32bit\"", free32);
+    metrics_family(&w, "espilicam_heap_min_free_bytes", "gauge", "Lowest free heap since boot");
+    metrics_sample(&w, "espilicam_heap_min_free_bytes", "caps=\"8bit\"", free8start);
+    metrics_sample(&w, "espilicam_heap_min_free_bytes", "caps=\"32bit\"", free32start);
+    metrics_family(&w, "espilicam_task_stack_min_free_bytes", "gauge", "Stack high water mark");
+    metrics_task_stacks(&w, "espilicam_task_stack_min_free_bytes");
+
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        metrics_family(&w, "espilicam_wifi_rssi_dbm", "gauge", "Signal strength of the access point");
+        metrics_sample(&w, "espilicam_wifi_rssi_dbm", NULL, ap.rssi);
+    }
+
+    metrics_family(&w, "espilicam_stream_clients", "gauge", "Connected /stream and WebSocket clients");
+    metrics_sample(&w, "espilicam_stream_clients", NULL, broadcast_subscribers());
+    metrics_family(&w, "espilicam_stream_publish_dropped_total", "counter", "Frames not published for lack of a buffer");
+    metrics_sample(&w, "espilicam_stream_publish_dropped_total", NULL, broadcast_get_dropped());
+    client_samples(&w, "espilicam_client_frames_total", "counter", "Frames sent per client slot",
+        offsetof(metrics_client_t, frames));
+    client_samples(&w, "espilicam_client_bytes_total", "counter", "Bytes sent per client slot",
+        offsetof(metrics_client_t, bytes));
+    client_samples(&w, "espilicam_client_dropped_total", "counter", "Frames skipped per client slot",
+        offsetof(metrics_client_t, dropped));
+    client_samples(&w, "espilicam_client_level", "gauge", "Stream level per client slot, 0 is best",
+        offsetof(metrics_client_t, level));
+
+    udp_stream_get_stats(&udp_sent, &udp_dropped, &udp_errors);
+    metrics_family(&w, "espilicam_udp_frames_total", "counter", "Frames sent over the UDP stream");
+    metrics_sample(&w, "espilicam_udp_frames_total", NULL, udp_sent);
+    metrics_family(&w, "espilicam_udp_dropped_total", "counter", "Frames replaced before the UDP sender got to them");
+    metrics_sample(&w, "espilicam_udp_dropped_total", NULL, udp_dropped);
+    metrics_family(&w, "espilicam_udp_errors_total", "counter", "UDP packets that could not be sent");
+    metrics_sample(&w, "espilicam_udp_errors_total", NULL, udp_errors);
+    return http_response_end(&body, true) && keep_alive;
+}
+
+static bool stream_route(struct netconn *conn, const http_request_t *req)
+{
+    netconn_write(conn, http_hdr, sizeof(http_hdr) - 1, NETCONN_NOCOPY);
+    http_stream_serve(conn);
+    return false;
+}
+
+static bool ws_route(struct netconn *conn, const http_request_t *req)
+{
+    ws_serve(conn, req->head, req->head_len);
+    return false;
+}
+
+// /bmp, /jpg, /pgm and any other path (/get): the last completed frame as
+// captured, or converted as asked for
+static bool snapshot_serve(struct netconn *conn, const http_request_t *req)
+{
+    broadcast_frame_t *frame;
+    http_body_t body;
+    esp_err_t err;
+    uint32_t writes;
+    frame_format_t snap_format = FRAME_RAW;
+    size_t snap_offset = 0;
+    char outstr[120];
+    const char *type = outstr;
+    size_t type_len;
+    bool keep_alive, complete = true;
+
+    // without a better match, the frame as a file download
+    type_len = get_image_mime_info_str(outstr);
+    if (s_pixel_format == CAMERA_PF_JPEG) {
+        type = http_jpg_hdr;
+        type_len = sizeof(http_jpg_hdr) - 1;
+    } else if (s_pixel_format == CAMERA_PF_GRAYSCALE) {
+        if (http_path_is(req, "/pgm")) {
+            type = http_pgm_hdr;
+            type_len = sizeof(http_pgm_hdr) - 1;
+            snap_format = FRAME_PGM;
+        }
+    } else if (s_pixel_format == CAMERA_PF_YUV422 && http_path_is(req, "/jpg")) {
+        type = http_jpg_hdr;
+        type_len = sizeof(http_jpg_hdr) - 1;
+        snap_format = FRAME_JPEG;
+    } else if (s_pixel_format == CAMERA_PF_RGB565 || s_pixel_format == CAMERA_PF_YUV422) {
+        // YUV is sent converted to 565 2bpp
+        snap_format = FRAME_BMP565;
+        if (http_path_is(req, "/bmp")) {
+            type = http_bitmap_hdr;
+            type_len = sizeof(http_bitmap_hdr) - 1;
+        } else {
+            // lines only
+            snap_offset = sizeof(bitmap565);
+        }
+    }
+
+    ESP_LOGD(TAG, "Image requested.");
+    err = snapshot_frame(snap_format, &frame);
+    if (err == ESP_OK) {
+        keep_alive = http_response_begin(&body, conn, req, type, type_len, frame->len - snap_offset);
+        write_frame(&body.tx, frame, snap_offset);
+        return http_response_end(&body, true) && keep_alive;
+    }
+    // a frame that tears every time would tear on the way out as well
+    if (err != ESP_ERR_NO_MEM || !fb_read_begin(&writes)) {
+        netconn_write(conn, http_unavailable, sizeof(http_unavailable) - 1, NETCONN_NOCOPY);
+        return false;
+    }
+
+    // no cache buffer free, encode straight to the connection; a body the
+    // camera overwrote meanwhile is cut short
+    keep_alive = http_response_begin(&body, conn, req, type, type_len, -1);
+    if (snap_format == FRAME_JPEG) {
+        if (jpeg_encode_yuv422(camera_get_fb(), camera_get_fb_width(), camera_get_fb_height(),
+                CONFIG_HTTP_JPEG_QUALITY, http_body_write, &body) != ESP_OK) {
+            ESP_LOGD(TAG, "JPEG snapshot aborted");
+            complete = false;
+        }
+    } else if (snap_format == FRAME_BMP565) {
+        ESP_LOGD(TAG, "Converting framebuffer to RGB565 requested, sending...");
+        if (snap_offset == 0) {
+            bitmap565 bmp;
+            bmp_init_header565(&bmp, camera_get_fb_width(), camera_get_fb_height());
+            http_body_write(&body, (const uint8_t *) &bmp, sizeof(bitmap565));
+        }
+        uint8_t s_line[320*2];
+        for (int i = 0; i < 240 && body.tx.err == ERR_OK && fb_read_end(writes); i++) {
+            convert_fb32bit_line_to_bmp565(&currFbPtr[(i*320)/2], s_line, s_pixel_format, 320);
+            http_body_write(&body, s_line, 320*2);
+        }
+    } else {
+        if (snap_format == FRAME_PGM) {
+            char pgm_header[32];
+            snprintf(pgm_header, sizeof(pgm_header), "P5 %d %d %d\n", camera_get_fb_width(), camera_get_fb_height(), 255);
+            http_body_write(&body, (const uint8_t *) pgm_header, strlen(pgm_header));
+        }
+        // copied, lwIP must not reference a framebuffer in use
+        http_body_write(&body, (const uint8_t *) camera_get_fb(), camera_get_data_size());
+    }
+    if (!fb_read_end(writes)) {
+        ESP_LOGD(TAG, "Snapshot overwritten while sent, aborted");
+        complete = false;
+    }
+    return http_response_end(&body, complete) && keep_alive;
+}
+
+typedef bool (*http_serve_t)(struct netconn *conn, const http_request_t *req);
+
+typedef struct {
+    const char *path;
+    http_serve_t serve;     // returns whether the connection may be kept
+} http_route_t;
+
+// first match wins, the last entry serves every other path
+static const http_route_t http_routes[] = {
+    { "/stream", stream_route },
+    { "/ws", ws_route },
+    { "/thumb", thumb_serve },
+    { "/metrics", metrics_serve },
+    { NULL, snapshot_serve },
+};
+
+static QueueHandle_t http_conn_queue;
+// how often a kept-alive connection looks for connections waiting on it
+#define HTTP_IDLE_POLL_MS 100
+
+// serve the requests on a connection, pipelined ones included, until the
+// client closes it or stays idle for HTTP_KEEPALIVE_TIMEOUT_S, a response
+// can only be ended by closing, or an idle connection holds up one that
+// waits for a worker
+static void http_server_netconn_serve(struct netconn *conn)
+{
+    http_parser_t *parser = (http_parser_t *) malloc(sizeof(http_parser_t));
+    http_request_t req;
+    const http_route_t *route;
+    struct netbuf *inbuf = NULL;
+    u16_t offset = 0;
+    size_t space;
+    char *dest;
+    bool keep_alive = parser != NULL;
+    int idle_ms = 0, served = 0;
+    err_t err;
+
+    if (keep_alive) {
+        http_parser_init(parser);
+        netconn_set_recvtimeout(conn, HTTP_IDLE_POLL_MS);
+    }
+    while (keep_alive) {
+        switch (http_parser_next(parser, &req)) {
+            case HTTP_PARSE_ERROR:
+                netconn_write(conn, http_bad_request, sizeof(http_bad_request) - 1, NETCONN_NOCOPY);
+                keep_alive = false;
+                continue;
+            case HTTP_PARSE_DONE:
+                if (req.method != HTTP_GET) {
+                    netconn_write(conn, http_not_allowed, sizeof(http_not_allowed) - 1, NETCONN_NOCOPY);
+                    keep_alive = false;
+                    continue;
+                }
+                for (route = http_routes; route->path != NULL && !http_path_is(&req, route->path); route++)
+                    ;
+                keep_alive = route->serve(conn, &req);
+                http_parser_consume(parser);
+                served++;
+                idle_ms = 0;
+                continue;
+            case HTTP_PARSE_INCOMPLETE:
+                break;
+        }
+        if (inbuf == NULL) {
+            // a fresh connection gets its first request served regardless
+            if (served > 0 && parser->len == 0 && uxQueueMessagesWaiting(http_conn_queue) > 0)
+                break;
+            err = netconn_recv(conn, &inbuf);
+            if (err == ERR_TIMEOUT) {
+                idle_ms += HTTP_IDLE_POLL_MS;
+                keep_alive = idle_ms < CONFIG_HTTP_KEEPALIVE_TIMEOUT_S * 1000;
+                continue;
             }
-        // end GET request:
-        set_moviemode(s_moviemode);
+            if (err != ERR_OK)
+                break;
+            offset = 0;
+        }
+        // pipelined requests may not all fit, the rest waits in inbuf
+        dest = http_parser_space(parser, &space);
+        space = netbuf_copy_partial(inbuf, dest, space, offset);
+        http_parser_commit(parser, space);
+        offset += space;
+        if (offset >= netbuf_len(inbuf)) {
+            netbuf_delete(inbuf);
+            inbuf = NULL;
         }
     }
-    /* Close the connection (server closes in HTTP) */
+    if (inbuf != NULL)
+        netbuf_delete(inbuf);
+    free(parser);
     netconn_close(conn);
-    /* Delete the buffer (netconn_recv gives us ownership,
-     so we have to make sure to deallocate the buffer) */
-    netbuf_delete(inbuf);
+}
+
+
+// connection pool: accepted connections are served by the first free worker
+static void http_worker(void *pvParameters)
+{
+    struct netconn *conn;
+    while (1) {
+        if (xQueueReceive(http_conn_queue, &conn, portMAX_DELAY) == pdTRUE) {
+            http_server_netconn_serve(conn);
+            netconn_delete(conn);
+        }
+    }
 }
 
 static void http_server(void *pvParameters)
 {
     struct netconn *conn, *newconn;
     err_t err;
+    TaskHandle_t task;
+    http_conn_queue = xQueueCreate(CONFIG_HTTP_SERVER_TASKS, sizeof(struct netconn *));
+    for (int i = 0; i < CONFIG_HTTP_SERVER_TASKS; i++) {
+        if (xTaskCreatePinnedToCore(&http_worker, "http_worker", 4096, NULL, 5, &task, 1))
+            metrics_register_task(task);
+    }
     conn = netconn_new(NETCONN_TCP);
     netconn_bind(conn, NULL, 80);
     netconn_listen(conn);
     do {
         err = netconn_accept(conn, &newconn);
         if (err == ERR_OK) {
-            http_server_netconn_serve(newconn);
-            netconn_delete(newconn);
+            if (xQueueSend(http_conn_queue, &newconn, 0) != pdTRUE) {
+                // every worker busy and the backlog full
+                netconn_close(newconn);
+                netconn_delete(newconn);
+            }
         }
     } while (err == ERR_OK);
     netconn_close(conn);
@@ -1301,17 +2668,7 @@ static void heap_mem_log()
 {
     size_t free8start, free32start, free8, free32;
 
-    #ifdef ESPIDFV21RC
-        free8=xPortGetFreeHeapSizeCaps(MALLOC_CAP_8BIT);
-        free32=xPortGetFreeHeapSizeCaps(MALLOC_CAP_32BIT);
-        free8start=xPortGetMinimumEverFreeHeapSizeCaps(MALLOC_CAP_8BIT);
-        free32start=xPortGetMinimumEverFreeHeapSizeCaps(MALLOC_CAP_32BIT);
-    #else
-        free32=heap_caps_get_largest_free_block(MALLOC_CAP_32BIT);
-        free8=heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
-        free8start=heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
-        free32start=heap_caps_get_minimum_free_size(MALLOC_CAP_32BIT);
-    #endif
+    heap_stats(&free8, &free32, &free8start, &free32start);
 
     ESP_LOGI(TAG, "Free heap: %u", xPortGetFreeHeapSize());
     ESP_LOGI(TAG, "Free (largest free blocks) 8bit-capable memory : %d, 32-bit capable memory %d", free8, free32);
@@ -1320,6 +2677,7 @@ static void heap_mem_log()
 
 void app_main()
 {
+    TaskHandle_t task;
     esp_log_level_set("wifi", ESP_LOG_WARN);
     esp_log_level_set("gpio", ESP_LOG_WARN);
 
@@ -1415,33 +2773,90 @@ void app_main()
 
     vTaskDelay(2000 / portTICK_RATE_MS);
 
+    ESP_LOGD(TAG, "Starting WS2812B LED strip...");
+    ws2812_config_t led_config = {
+        .gpio_num = CONFIG_LED_STRIP_GPIO,
+        .channel = CONFIG_LED_STRIP_RMT_CHANNEL,
+        .led_count = CONFIG_LED_STRIP_COUNT,
+    };
+    err = ws2812_init(&led_config);
+    if (err != ESP_OK) {
+        // keep going, the camera and LCD are still useful without the strip
+        ESP_LOGE(TAG, "LED strip init failed with error 0x%x", err);
+    } else {
+        err = backlight_setup();
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Backlight init failed with error 0x%x", err);
+        } else {
+#if !CONFIG_NETLED_NONE
+            netled_config_t net_config = {
+#if CONFIG_NETLED_E131
+                .protocol = NETLED_PROTOCOL_E131,
+                .universe = CONFIG_NETLED_UNIVERSE,
+#else
+                .protocol = NETLED_PROTOCOL_DDP,
+#endif
+                .host = CONFIG_NETLED_HOST,
+                .led_count = CONFIG_LED_STRIP_COUNT,
+            };
+            err = netled_init(&net_config);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Network LED output init failed with error 0x%x", err);
+            }
+#endif
+            ESP_LOGD(TAG, "Starting LED refresh task...");
+            if (xTaskCreatePinnedToCore(&ledRefreshTask, "ledRefreshTask", 2048, NULL, 5, &task, 0))
+                metrics_register_task(task);
+        }
+    }
+
     dispSem=xSemaphoreCreateBinary();
     dispDoneSem=xSemaphoreCreateBinary();
     espilicam_event_group = xEventGroupCreate();
 
     xSemaphoreGive(dispDoneSem);
     ESP_LOGD(TAG, "Starting ILI9341 display task...");
-    xTaskCreatePinnedToCore(&push_framebuffer_to_tft, "push_framebuffer_to_tft", 4096, NULL, 5, NULL,1);
+    if (xTaskCreatePinnedToCore(&push_framebuffer_to_tft, "push_framebuffer_to_tft", 4096, NULL, 5, &task, 1))
+        metrics_register_task(task);
 
     captureSem=xSemaphoreCreateBinary();
     captureDoneSem=xSemaphoreCreateBinary();
 
     ESP_LOGD(TAG, "Starting OV7670 capture task...");
-    xTaskCreatePinnedToCore(&captureTask, "captureTask", 2048, NULL, 5, NULL,1);
+    if (xTaskCreatePinnedToCore(&captureTask, "captureTask", 3072, NULL, 5, &task, 1))
+        metrics_register_task(task);
 
     vTaskDelay(1000 / portTICK_RATE_MS);
 
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS; i++) {
+        s_client_metrics[i].level = -1;
+    }
+    err = broadcast_init(CONFIG_HTTP_STREAM_BUFFERS, CONFIG_HTTP_FRAME_CACHE_KB * 1024);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Stream broadcast init failed with error 0x%x", err);
+    }
+    err = tx_pool_init(CONFIG_HTTP_TX_BUFFERS, CONFIG_HTTP_TX_BUFFER_SEGMENTS);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "TX buffer pool init failed with error 0x%x", err);
+    }
+
     ESP_LOGD(TAG, "Starting http_server task...");
     // keep an eye on stack... 5784 min with 8048 stck size last count..
-    xTaskCreatePinnedToCore(&http_server, "http_server", 4096, NULL, 5, NULL,1);
+    if (xTaskCreatePinnedToCore(&http_server, "http_server", 4096, NULL, 5, &task, 1))
+        metrics_register_task(task);
 
     ESP_LOGI(TAG, "open http://" IPSTR "/bmp for single image/bitmap image", IP2STR(&s_ip_addr));
     ESP_LOGI(TAG, "open http://" IPSTR "/stream for multipart/x-mixed-replace stream of bitmaps", IP2STR(&s_ip_addr));
+    ESP_LOGI(TAG, "open http://" IPSTR "/jpg for a JPEG snapshot (YUV422 only)", IP2STR(&s_ip_addr));
     ESP_LOGI(TAG, "open http://" IPSTR "/get for raw image as stored in framebuffer ", IP2STR(&s_ip_addr));
+    ESP_LOGI(TAG, "open http://" IPSTR "/thumb?w=80&h=60 for a thumbnail (YUV422 only, &bmp=1 for a bitmap)", IP2STR(&s_ip_addr));
+    ESP_LOGI(TAG, "scrape http://" IPSTR "/metrics for Prometheus", IP2STR(&s_ip_addr));
 
     ESP_LOGD(TAG, "Starting telnetd task...");
+    cmd_table_init(my_opts);
     // keep an eye on this - stack free was at 4620 at min with 8048
-    xTaskCreatePinnedToCore(&telnetTask, "telnetTask", 5120, NULL, 5, NULL, 1);
+    if (xTaskCreatePinnedToCore(&telnetTask, "telnetTask", 5120, NULL, 5, &task, 1))
+        metrics_register_task(task);
 
     ESP_LOGI(TAG, "telnet to \"telnet " IPSTR "\" to access command console, type \"help\" for commands", IP2STR(&s_ip_addr));
 
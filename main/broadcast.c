@@ -0,0 +1,280 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "broadcast.h"
+
+static const char* TAG = "broadcast";
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static broadcast_frame_t* s_frames = NULL;
+static int s_frame_count = 0;
+static size_t s_max_bytes = 0;
+static size_t s_bytes = 0;                     // capacity of all buffers
+static broadcast_frame_t* s_latest[BROADCAST_MAX_CHANNELS];  // each holds one reference
+static uint32_t s_seq[BROADCAST_MAX_CHANNELS];
+static TaskHandle_t s_clients[BROADCAST_MAX_CLIENTS];
+static uint8_t s_client_channel[BROADCAST_MAX_CLIENTS];
+static int s_client_count = 0;
+static uint32_t s_stamp = 0;
+static uint32_t s_dropped = 0;
+
+esp_err_t broadcast_init(int max_buffers, size_t max_bytes)
+{
+    if (s_frames != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (max_buffers < 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_frames = (broadcast_frame_t*) calloc(max_buffers, sizeof(broadcast_frame_t));
+    if (!s_frames) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_frame_count = max_buffers;
+    s_max_bytes = max_bytes;
+    return ESP_OK;
+}
+
+int broadcast_subscribe()
+{
+    int slot = -1;
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS; ++i) {
+        if (s_clients[i] == NULL) {
+            s_clients[i] = xTaskGetCurrentTaskHandle();
+            s_client_channel[i] = 0;
+            s_client_count++;
+            slot = i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return slot;
+}
+
+void broadcast_unsubscribe(int slot)
+{
+    if (slot < 0 || slot >= BROADCAST_MAX_CLIENTS) {
+        return;
+    }
+    portENTER_CRITICAL(&s_lock);
+    if (s_clients[slot] != NULL) {
+        s_clients[slot] = NULL;
+        s_client_count--;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+int broadcast_subscribers()
+{
+    return s_client_count;
+}
+
+void broadcast_set_channel(int slot, int channel)
+{
+    if (slot < 0 || slot >= BROADCAST_MAX_CLIENTS ||
+        channel < 0 || channel >= BROADCAST_MAX_CHANNELS) {
+        return;
+    }
+    s_client_channel[slot] = channel;
+}
+
+bool broadcast_channel_wanted(int channel)
+{
+    bool wanted = false;
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS; ++i) {
+        if (s_clients[i] != NULL && s_client_channel[i] == channel) {
+            wanted = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return wanted;
+}
+
+static bool is_latest(const broadcast_frame_t* f)
+{
+    for (int ch = 0; ch < BROADCAST_MAX_CHANNELS; ++ch) {
+        if (s_latest[ch] == f) {
+            return true;
+        }
+    }
+    return false;
+}
+
+broadcast_frame_t* broadcast_find(uint32_t frame, int format)
+{
+    broadcast_frame_t* found = NULL;
+
+    if (s_frames == NULL) {
+        return NULL;
+    }
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < s_frame_count; ++i) {
+        broadcast_frame_t* f = &s_frames[i];
+        if (f->ready && f->frame == frame && f->format == format) {
+            f->refs++;
+            f->stamp = ++s_stamp;
+            found = f;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return found;
+}
+
+broadcast_frame_t* broadcast_begin(uint32_t frame, int format, size_t len)
+{
+    broadcast_frame_t* found = NULL;
+    broadcast_frame_t* empty = NULL;
+
+    if (s_frames == NULL) {
+        return NULL;
+    }
+    portENTER_CRITICAL(&s_lock);
+    // the least recently used idle buffer with room, else the latest frame
+    // if no client is sending it, else grow an idle buffer within budget;
+    // more buffers only come into play while clients are busy
+    for (int i = 0; i < s_frame_count; ++i) {
+        broadcast_frame_t* f = &s_frames[i];
+        if (f->refs != 0 || is_latest(f)) {
+            continue;
+        }
+        if (f->capacity >= len) {
+            if (found == NULL || f->stamp < found->stamp) {
+                found = f;
+            }
+        } else if (s_bytes - f->capacity + len <= s_max_bytes &&
+                   (empty == NULL || f->capacity > empty->capacity)) {
+            empty = f;
+        }
+    }
+    for (int ch = 0; found == NULL && ch < BROADCAST_MAX_CHANNELS; ++ch) {
+        broadcast_frame_t* f = s_latest[ch];
+        if (f != NULL && f->refs == 1 && f->capacity >= len) {
+            found = f;
+            f->refs--;
+            s_latest[ch] = NULL;
+        }
+    }
+    if (found == NULL) {
+        found = empty;
+    }
+    if (found != NULL) {
+        found->refs = 1;
+        found->ready = false;
+        found->frame = frame;
+        found->format = format;
+        found->stamp = ++s_stamp;
+        if (found->capacity < len) {
+            // reserve the bytes now, the buffer is reallocated below
+            s_bytes += len - found->capacity;
+        }
+    } else {
+        s_dropped++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (found == NULL) {
+        return NULL;
+    }
+
+    if (found->capacity < len) {
+        free(found->data);
+        found->data = (uint8_t*) malloc(len);
+        if (!found->data) {
+            ESP_LOGW(TAG, "No memory for a %d byte frame", len);
+            portENTER_CRITICAL(&s_lock);
+            s_bytes -= len;
+            found->capacity = 0;
+            found->refs = 0;
+            s_dropped++;
+            portEXIT_CRITICAL(&s_lock);
+            return NULL;
+        }
+        found->capacity = len;
+    }
+    found->len = len;
+    return found;
+}
+
+void broadcast_commit(broadcast_frame_t* frame)
+{
+    portENTER_CRITICAL(&s_lock);
+    frame->ready = true;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void broadcast_publish(broadcast_frame_t* frame, int channel)
+{
+    TaskHandle_t clients[BROADCAST_MAX_CLIENTS];
+    int n = 0;
+
+    portENTER_CRITICAL(&s_lock);
+    frame->ready = true;
+    if (s_latest[channel] != frame) {
+        if (s_latest[channel] != NULL) {
+            s_latest[channel]->refs--;
+        }
+        frame->refs++;
+        s_latest[channel] = frame;
+    }
+    frame->seq = ++s_seq[channel];
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS; ++i) {
+        if (s_clients[i] != NULL && s_client_channel[i] == channel) {
+            clients[n++] = s_clients[i];
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+    for (int i = 0; i < n; ++i) {
+        xTaskNotifyGive(clients[i]);
+    }
+}
+
+static broadcast_frame_t* take_latest(int slot, uint32_t last_seq)
+{
+    broadcast_frame_t* frame = NULL;
+    portENTER_CRITICAL(&s_lock);
+    broadcast_frame_t* latest = s_latest[s_client_channel[slot]];
+    if (latest != NULL && latest->seq != last_seq) {
+        frame = latest;
+        frame->refs++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return frame;
+}
+
+broadcast_frame_t* broadcast_wait(int slot, uint32_t last_seq, TickType_t timeout)
+{
+    broadcast_frame_t* frame = take_latest(slot, last_seq);
+    if (frame == NULL && ulTaskNotifyTake(pdTRUE, timeout) > 0) {
+        frame = take_latest(slot, last_seq);
+    }
+    return frame;
+}
+
+void broadcast_release(broadcast_frame_t* frame)
+{
+    portENTER_CRITICAL(&s_lock);
+    frame->refs--;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void broadcast_invalidate()
+{
+    if (s_frames == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < s_frame_count; ++i) {
+        s_frames[i].ready = false;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+uint32_t broadcast_get_dropped()
+{
+    return s_dropped;
+}
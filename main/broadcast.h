@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+/*
+ * Refcounted encoded frames: a small cache keyed by camera frame number and
+ * format, and one producer, many consumers fan-out of the latest frame.
+ *
+ * Each frame is encoded once into a buffer from the pool. Snapshot requests
+ * for a frame and format already encoded get the cached buffer. The capture
+ * task publishes frames for /stream clients, which every subscribed client
+ * task sends. Buffers still referenced by a slow client are never
+ * overwritten: the producer takes another one from the pool or drops the
+ * frame, and the slow client skips straight to the newest frame once it is
+ * done.
+ *
+ * Frames are published on channels, e.g. one per stream quality; each
+ * client follows one channel and is only woken for frames published on it.
+ */
+
+#define BROADCAST_MAX_CLIENTS 8
+#define BROADCAST_MAX_CHANNELS 4
+
+typedef struct {
+    uint32_t seq;       /*!< publish sequence number on its channel, starts at 1 */
+    uint32_t frame;     /*!< camera frame number */
+    int format;         /*!< encoding, defined by the caller */
+    size_t len;         /*!< bytes used in data */
+    uint8_t* data;
+    size_t capacity;
+    int refs;
+    bool ready;         /*!< encoded, may be found by broadcast_find */
+    uint32_t stamp;     /*!< last use, for recycling the oldest buffer */
+} broadcast_frame_t;
+
+/**
+ * @brief Initialize the pool
+ *
+ * Buffers are allocated on demand, grown when a larger encoding needs
+ * them, and kept for reuse.
+ *
+ * @param max_buffers frame buffers at most, at least 1
+ * @param max_bytes total size of all buffers at most
+ */
+esp_err_t broadcast_init(int max_buffers, size_t max_bytes);
+
+/**
+ * @brief Subscribe the calling task
+ *
+ * The task is notified (xTaskNotifyGive) on every publish.
+ *
+ * @return client slot, -1 if BROADCAST_MAX_CLIENTS are subscribed
+ */
+int broadcast_subscribe();
+
+/**
+ * @brief Unsubscribe a client slot
+ */
+void broadcast_unsubscribe(int slot);
+
+/**
+ * @brief Get the number of subscribed clients
+ */
+int broadcast_subscribers();
+
+/**
+ * @brief Make a client follow another channel, 0 after subscribing
+ */
+void broadcast_set_channel(int slot, int channel);
+
+/**
+ * @brief Check whether any client follows a channel
+ */
+bool broadcast_channel_wanted(int channel);
+
+/**
+ * @brief Look a frame up in the cache
+ *
+ * @return the frame with a reference held, NULL if it has not been encoded
+ *         in that format or its buffer was recycled
+ */
+broadcast_frame_t* broadcast_find(uint32_t frame, int format);
+
+/**
+ * @brief Get a buffer to encode a frame into
+ *
+ * @param frame camera frame number
+ * @param format encoding
+ * @param len bytes needed; len may be lowered once encoded
+ * @return buffer with at least len bytes of capacity and a reference held,
+ *         NULL if every buffer is in use or the byte budget is exhausted
+ */
+broadcast_frame_t* broadcast_begin(uint32_t frame, int format, size_t len);
+
+/**
+ * @brief Make a frame filled after broadcast_begin visible to broadcast_find
+ *
+ * The caller keeps its reference.
+ */
+void broadcast_commit(broadcast_frame_t* frame);
+
+/**
+ * @brief Commit a frame and hand it to the clients following a channel
+ *
+ * Replaces the frame previously published on the channel. The caller keeps
+ * its reference.
+ */
+void broadcast_publish(broadcast_frame_t* frame, int channel);
+
+/**
+ * @brief Wait for a frame newer than the one last sent on the client's channel
+ *
+ * @param slot client slot
+ * @param last_seq sequence number of the frame last sent, 0 for none
+ * @param timeout ticks to wait
+ * @return latest frame with a reference held, NULL on timeout
+ */
+broadcast_frame_t* broadcast_wait(int slot, uint32_t last_seq, TickType_t timeout);
+
+/**
+ * @brief Drop a reference
+ */
+void broadcast_release(broadcast_frame_t* frame);
+
+/**
+ * @brief Forget all cached frames, e.g. when the camera restarts counting
+ */
+void broadcast_invalidate();
+
+/**
+ * @brief Get the number of frames dropped because every buffer was in use
+ */
+uint32_t broadcast_get_dropped();
@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "http_parser.h"
+
+void http_parser_init(http_parser_t* p)
+{
+    p->len = 0;
+    p->scanned = 0;
+    p->head_len = 0;
+}
+
+char* http_parser_space(http_parser_t* p, size_t* space)
+{
+    *space = sizeof(p->buf) - p->len;
+    return p->buf + p->len;
+}
+
+void http_parser_commit(http_parser_t* p, size_t len)
+{
+    p->len += len;
+}
+
+// end of the head, after the empty line; bare LF line ends are accepted
+static size_t find_head_end(http_parser_t* p)
+{
+    for (size_t i = p->scanned; i < p->len; i++) {
+        if (p->buf[i] != '\n') {
+            continue;
+        }
+        if (i + 1 < p->len && p->buf[i + 1] == '\n') {
+            return i + 2;
+        }
+        if (i + 2 < p->len && p->buf[i + 1] == '\r' && p->buf[i + 2] == '\n') {
+            return i + 3;
+        }
+    }
+    // the last two bytes may start the empty line
+    p->scanned = p->len > 2 ? p->len - 2 : 0;
+    return 0;
+}
+
+static bool has_token(const char* value, size_t len, const char* token)
+{
+    size_t token_len = strlen(token);
+    for (size_t i = 0; i + token_len <= len; i++) {
+        if (strncasecmp(value + i, token, token_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_request_line(const char* line, size_t len, http_request_t* req)
+{
+    const char* end = line + len;
+    const char* sp1 = memchr(line, ' ', len);
+    if (sp1 == NULL) {
+        return false;
+    }
+    const char* target = sp1 + 1;
+    const char* sp2 = memchr(target, ' ', end - target);
+    if (sp2 == NULL || *target != '/' || end - sp2 < 9 || memcmp(sp2 + 1, "HTTP/1.", 7) != 0) {
+        return false;
+    }
+    if (sp1 - line == 3 && memcmp(line, "GET", 3) == 0) {
+        req->method = HTTP_GET;
+    } else if (sp1 - line == 4 && memcmp(line, "HEAD", 4) == 0) {
+        req->method = HTTP_HEAD;
+    } else {
+        req->method = HTTP_OTHER;
+    }
+    req->http11 = sp2[8] != '0';
+    req->keep_alive = req->http11;
+    req->path = target;
+    req->query = memchr(target, '?', sp2 - target);
+    if (req->query != NULL) {
+        req->path_len = req->query - target;
+        req->query++;
+        req->query_len = sp2 - req->query;
+    } else {
+        req->path_len = sp2 - target;
+        req->query_len = 0;
+    }
+    return true;
+}
+
+http_parse_result_t http_parser_next(http_parser_t* p, http_request_t* req)
+{
+    size_t head_len = find_head_end(p);
+    if (head_len == 0) {
+        return p->len == sizeof(p->buf) ? HTTP_PARSE_ERROR : HTTP_PARSE_INCOMPLETE;
+    }
+
+    const char* line = p->buf;
+    const char* end = p->buf + head_len;
+    bool first = true;
+    while (line < end) {
+        const char* eol = memchr(line, '\n', end - line);
+        size_t len = eol - line;
+        if (len > 0 && line[len - 1] == '\r') {
+            len--;
+        }
+        if (first) {
+            if (!parse_request_line(line, len, req)) {
+                return HTTP_PARSE_ERROR;
+            }
+            first = false;
+        } else if (len > 11 && strncasecmp(line, "Connection:", 11) == 0) {
+            if (has_token(line + 11, len - 11, "close")) {
+                req->keep_alive = false;
+            } else if (has_token(line + 11, len - 11, "keep-alive")) {
+                req->keep_alive = true;
+            }
+        } else if (len > 15 && strncasecmp(line, "Content-Length:", 15) == 0) {
+            if (atoi(line + 15) != 0) {
+                return HTTP_PARSE_ERROR;
+            }
+        } else if (len > 18 && strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+            return HTTP_PARSE_ERROR;
+        }
+        line = eol + 1;
+    }
+    req->head = p->buf;
+    req->head_len = head_len;
+    p->head_len = head_len;
+    return HTTP_PARSE_DONE;
+}
+
+void http_parser_consume(http_parser_t* p)
+{
+    size_t skip = p->head_len;
+    // clients may send an empty line between requests
+    while (skip < p->len && (p->buf[skip] == '\r' || p->buf[skip] == '\n')) {
+        skip++;
+    }
+    p->len -= skip;
+    memmove(p->buf, p->buf + skip, p->len);
+    p->head_len = 0;
+    p->scanned = 0;
+}
+
+bool http_path_is(const http_request_t* req, const char* path)
+{
+    return req->path_len == strlen(path) && memcmp(req->path, path, req->path_len) == 0;
+}
+
+int http_query_int(const http_request_t* req, const char* name, int def)
+{
+    size_t name_len = strlen(name);
+    const char* p = req->query;
+    const char* end = req->query + req->query_len;
+    while (p != NULL && p < end) {
+        const char* amp = memchr(p, '&', end - p);
+        if (amp == NULL) {
+            amp = end;
+        }
+        if (amp - p > name_len && memcmp(p, name, name_len) == 0 && p[name_len] == '=') {
+            return atoi(p + name_len + 1);
+        }
+        p = amp + 1;
+    }
+    return def;
+}
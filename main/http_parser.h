@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Incremental HTTP/1.x request parser.
+ *
+ * Received bytes are appended to the parser's buffer as they arrive; the
+ * end of the request head is searched for only in the new bytes. Once a
+ * head is complete it is parsed in place: the request refers into the
+ * buffer until it is consumed. Bytes behind it, i.e. pipelined requests,
+ * stay buffered for the next call.
+ *
+ * Only requests without a body are accepted, which covers GET.
+ */
+
+#define HTTP_MAX_REQUEST 1024       //!< request line and headers
+
+typedef enum {
+    HTTP_GET,
+    HTTP_HEAD,
+    HTTP_OTHER,
+} http_method_t;
+
+typedef enum {
+    HTTP_PARSE_ERROR = -1,          //!< malformed, too large or with a body
+    HTTP_PARSE_INCOMPLETE = 0,
+    HTTP_PARSE_DONE = 1,
+} http_parse_result_t;
+
+typedef struct {
+    http_method_t method;
+    const char* path;               /*!< not terminated, without the query */
+    size_t path_len;
+    const char* query;              /*!< after '?', NULL without one */
+    size_t query_len;
+    bool http11;
+    bool keep_alive;                /*!< from the version and Connection */
+    const char* head;               /*!< request line and headers */
+    size_t head_len;
+} http_request_t;
+
+typedef struct {
+    char buf[HTTP_MAX_REQUEST];
+    size_t len;                     /*!< bytes buffered */
+    size_t scanned;                 /*!< searched for the end of the head */
+    size_t head_len;                /*!< of the parsed request, 0 if none */
+} http_parser_t;
+
+void http_parser_init(http_parser_t* p);
+
+/**
+ * @brief Get the free part of the buffer, to receive into
+ *
+ * @param[out] space bytes free
+ */
+char* http_parser_space(http_parser_t* p, size_t* space);
+
+/**
+ * @brief Account for len bytes received into http_parser_space
+ */
+void http_parser_commit(http_parser_t* p, size_t len);
+
+/**
+ * @brief Parse the next request if its head is complete
+ *
+ * @return HTTP_PARSE_DONE with req filled, HTTP_PARSE_INCOMPLETE if more
+ *         bytes are needed, HTTP_PARSE_ERROR if the connection should be
+ *         answered with 400 and closed
+ */
+http_parse_result_t http_parser_next(http_parser_t* p, http_request_t* req);
+
+/**
+ * @brief Drop the request returned by http_parser_next, keep what follows
+ */
+void http_parser_consume(http_parser_t* p);
+
+/**
+ * @brief Check for a path, ignoring the query
+ */
+bool http_path_is(const http_request_t* req, const char* path);
+
+/**
+ * @brief Get an integer query parameter
+ *
+ * @return its value, def if the request has none
+ */
+int http_query_int(const http_request_t* req, const char* name, int def);
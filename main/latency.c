@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "latency.h"
+
+static const char* TAG = "latency";
+
+// a trial starts when the mean luma jumps by this much between two frames,
+// and the next one can only start after it has dropped by as much again
+#define LATENCY_FLASH_STEP 48
+
+typedef enum {
+    LATENCY_IDLE = 0,
+    LATENCY_WAIT_FLASH,     // screen dark, waiting for the flash
+    LATENCY_WAIT_ANALYSIS,  // flash captured
+    LATENCY_WAIT_LATCH,     // LED targets set
+    LATENCY_WAIT_DARK,      // trial done, waiting for the screen to go dark
+} latency_phase_t;
+
+enum {
+    STAGE_CAPTURE = 0,      // VSYNC to filter done
+    STAGE_ANALYSIS,         // filter done to LED targets set
+    STAGE_OUTPUT,           // LED targets set to latch
+    STAGE_TOTAL,            // VSYNC to latch
+    STAGE_COUNT
+};
+
+static const char* stage_names[STAGE_COUNT] = { "capture", "analysis", "output", "total" };
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static latency_phase_t s_phase = LATENCY_IDLE;
+static int s_wanted = 0;
+static int s_trials = 0;
+static uint8_t s_last_luma = 0;
+static uint8_t s_flash_luma = 0;
+static uint32_t s_vsync, s_filter, s_analysis, s_show_count;
+static uint32_t s_results[STAGE_COUNT][LATENCY_MAX_TRIALS];
+
+void latency_start(int trials)
+{
+    if (trials > LATENCY_MAX_TRIALS) {
+        trials = LATENCY_MAX_TRIALS;
+    }
+    portENTER_CRITICAL(&s_lock);
+    s_wanted = trials;
+    s_trials = 0;
+    // the first flash needs a dark frame before it
+    s_last_luma = 255;
+    s_phase = trials > 0 ? LATENCY_WAIT_FLASH : LATENCY_IDLE;
+    portEXIT_CRITICAL(&s_lock);
+    ESP_LOGI(TAG, "Collecting %d trials, flash a white image on a dark screen", trials);
+}
+
+bool latency_active()
+{
+    return s_phase != LATENCY_IDLE;
+}
+
+void latency_frame(uint8_t mean_luma, uint32_t vsync_us, uint32_t filter_us)
+{
+    portENTER_CRITICAL(&s_lock);
+    if (s_phase == LATENCY_WAIT_FLASH && mean_luma >= s_last_luma + LATENCY_FLASH_STEP) {
+        s_vsync = vsync_us;
+        s_filter = filter_us;
+        s_flash_luma = mean_luma;
+        s_phase = LATENCY_WAIT_ANALYSIS;
+    } else if (s_phase == LATENCY_WAIT_DARK && mean_luma + LATENCY_FLASH_STEP <= s_flash_luma) {
+        s_phase = LATENCY_WAIT_FLASH;
+    }
+    s_last_luma = mean_luma;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void latency_analysis_done(uint32_t analysis_us, uint32_t show_count)
+{
+    portENTER_CRITICAL(&s_lock);
+    if (s_phase == LATENCY_WAIT_ANALYSIS) {
+        s_analysis = analysis_us;
+        s_show_count = show_count;
+        s_phase = LATENCY_WAIT_LATCH;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void latency_latched(uint32_t latched_count, uint32_t latch_us)
+{
+    bool done = false;
+    portENTER_CRITICAL(&s_lock);
+    // the first frame shown after the analysis carries its result
+    if (s_phase == LATENCY_WAIT_LATCH && (int32_t) (latched_count - s_show_count) > 0) {
+        s_results[STAGE_CAPTURE][s_trials] = s_filter - s_vsync;
+        s_results[STAGE_ANALYSIS][s_trials] = s_analysis - s_filter;
+        s_results[STAGE_OUTPUT][s_trials] = latch_us - s_analysis;
+        s_results[STAGE_TOTAL][s_trials] = latch_us - s_vsync;
+        s_trials++;
+        s_phase = (s_trials < s_wanted) ? LATENCY_WAIT_DARK : LATENCY_IDLE;
+        done = (s_phase == LATENCY_IDLE);
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (done) {
+        ESP_LOGI(TAG, "%d trials done", s_trials);
+    }
+}
+
+static int cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+int latency_report(char* buf, size_t len)
+{
+    uint32_t sorted[LATENCY_MAX_TRIALS];
+    int n, count;
+
+    count = s_trials;
+    n = snprintf(buf, len, "%d/%d trials, us: min median p90 max\n", count, s_wanted);
+    for (int stage = 0; stage < STAGE_COUNT && count > 0 && n < len; ++stage) {
+        memcpy(sorted, s_results[stage], count * sizeof(uint32_t));
+        qsort(sorted, count, sizeof(uint32_t), cmp_u32);
+        n += snprintf(buf + n, len - n, "%-8s %u %u %u %u\n", stage_names[stage],
+                sorted[0], sorted[count / 2], sorted[(count * 9) / 10], sorted[count - 1]);
+    }
+    return n < len ? n : len - 1;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Glass-to-LED latency measurement.
+ *
+ * Point the camera at the TV and flash a white test image on a dark screen.
+ * Each flash seen by the camera is one trial, timestamped at VSYNC, when the
+ * frame is filtered, when the backlight analysis is done and when the first
+ * LED frame containing the result latches. Trials are collected until the
+ * requested number is reached.
+ */
+
+#define LATENCY_MAX_TRIALS 64
+
+/**
+ * @brief Discard previous results and collect the given number of trials.
+ */
+void latency_start(int trials);
+
+/**
+ * @brief Check whether trials are being collected.
+ */
+bool latency_active();
+
+/**
+ * @brief Feed a captured frame (capture task)
+ *
+ * @param mean_luma average luma of the frame
+ * @param vsync_us start of the frame
+ * @param filter_us last line filtered
+ */
+void latency_frame(uint8_t mean_luma, uint32_t vsync_us, uint32_t filter_us);
+
+/**
+ * @brief Mark the end of the analysis of the frame last fed (capture task)
+ *
+ * @param analysis_us analysis done, LED targets handed over
+ * @param show_count LED frames shown so far
+ */
+void latency_analysis_done(uint32_t analysis_us, uint32_t show_count);
+
+/**
+ * @brief Complete a pending trial once its LED frame has latched
+ *
+ * @param latched_count LED frames shown so far as of the last latch
+ * @param latch_us time of the last latch
+ */
+void latency_latched(uint32_t latched_count, uint32_t latch_us);
+
+/**
+ * @brief Write min/median/90th percentile/max of every stage to buf
+ *
+ * @return number of characters written
+ */
+int latency_report(char* buf, size_t len);
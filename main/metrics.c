@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "metrics.h"
+
+// keeps the compiler from moving the histogram updates past seq
+#define barrier() __asm__ __volatile__("" ::: "memory")
+
+static const uint32_t s_bounds_us[METRICS_BUCKETS] = METRICS_BUCKET_BOUNDS_US;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t s_tasks[METRICS_MAX_TASKS];
+static volatile int s_task_count = 0;
+
+void metrics_observe(metrics_histogram_t* h, uint32_t us)
+{
+    int i = 0;
+    while (i < METRICS_BUCKETS && us > s_bounds_us[i]) {
+        i++;
+    }
+    h->seq++;
+    barrier();
+    h->counts[i]++;
+    h->sum_us += us;
+    barrier();
+    h->seq++;
+}
+
+void metrics_register_task(TaskHandle_t task)
+{
+    // tasks are registered as they are started, from more than one task
+    portENTER_CRITICAL(&s_lock);
+    if (task != NULL && s_task_count < METRICS_MAX_TASKS) {
+        s_tasks[s_task_count] = task;
+        s_task_count++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void metrics_writer_init(metrics_writer_t* w, metrics_out_t out, void* ctx)
+{
+    w->out = out;
+    w->ctx = ctx;
+}
+
+static void emit(metrics_writer_t* w, int n)
+{
+    if (n >= sizeof(w->line)) {
+        n = sizeof(w->line) - 1;
+    }
+    if (n > 0) {
+        w->out(w->ctx, w->line, n);
+    }
+}
+
+void metrics_family(metrics_writer_t* w, const char* name, const char* type, const char* help)
+{
+    emit(w, snprintf(w->line, sizeof(w->line), "# HELP %s %s\n# TYPE %s %s\n",
+                     name, help, name, type));
+}
+
+void metrics_sample(metrics_writer_t* w, const char* name, const char* labels, int64_t value)
+{
+    if (labels != NULL) {
+        emit(w, snprintf(w->line, sizeof(w->line), "%s{%s} %" PRId64 "\n", name, labels, value));
+    } else {
+        emit(w, snprintf(w->line, sizeof(w->line), "%s %" PRId64 "\n", name, value));
+    }
+}
+
+void metrics_histogram(metrics_writer_t* w, const char* name, const char* help,
+                       const metrics_histogram_t* h)
+{
+    metrics_histogram_t copy;
+    uint32_t seq, total = 0;
+
+    // the writer may run on the other core, or be preempted by us
+    do {
+        while ((seq = h->seq) & 1) {
+            vTaskDelay(1);
+        }
+        barrier();
+        memcpy(copy.counts, h->counts, sizeof(copy.counts));
+        copy.sum_us = h->sum_us;
+        barrier();
+    } while (seq != h->seq);
+
+    metrics_family(w, name, "histogram", help);
+    for (int i = 0; i <= METRICS_BUCKETS; i++) {
+        total += copy.counts[i];
+        if (i < METRICS_BUCKETS) {
+            emit(w, snprintf(w->line, sizeof(w->line), "%s_bucket{le=\"%u.%06u\"} %u\n", name,
+                             s_bounds_us[i] / 1000000, s_bounds_us[i] % 1000000, total));
+        } else {
+            emit(w, snprintf(w->line, sizeof(w->line), "%s_bucket{le=\"+Inf\"} %u\n", name, total));
+        }
+    }
+    emit(w, snprintf(w->line, sizeof(w->line), "%s_sum %" PRIu64 ".%06u\n%s_count %u\n", name,
+                     copy.sum_us / 1000000, (unsigned) (copy.sum_us % 1000000), name, total));
+}
+
+void metrics_task_stacks(metrics_writer_t* w, const char* name)
+{
+    char labels[32];
+    for (int i = 0; i < s_task_count; i++) {
+        snprintf(labels, sizeof(labels), "task=\"%s\"", pcTaskGetTaskName(s_tasks[i]));
+        metrics_sample(w, name, labels, uxTaskGetStackHighWaterMark(s_tasks[i]));
+    }
+}
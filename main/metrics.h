@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Counters and histograms for the /metrics endpoint, in the Prometheus text
+ * exposition format.
+ *
+ * Every counter has a single writer, the task or ISR doing the work, so
+ * updates are plain stores of aligned 32 bit words and never take a lock.
+ * Histograms have more than one word; their writer bumps a sequence number
+ * around each update and readers copy them again until it is even and
+ * unchanged.
+ */
+
+#define METRICS_BUCKETS 9
+#define METRICS_MAX_TASKS 12
+
+// upper bounds of the histogram buckets, a 10th bucket catches the rest
+#define METRICS_BUCKET_BOUNDS_US { 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000 }
+
+typedef struct {
+    volatile uint32_t seq;                  /*!< odd while being updated */
+    uint32_t counts[METRICS_BUCKETS + 1];   /*!< per bucket, not cumulative */
+    uint64_t sum_us;
+} metrics_histogram_t;
+
+// per stream client, written by the client's task
+typedef struct {
+    volatile uint32_t frames;
+    volatile uint32_t bytes;
+    volatile uint32_t dropped;
+    volatile int32_t level;
+} metrics_client_t;
+
+// lines are formatted into a small buffer and handed to out one by one
+typedef void (*metrics_out_t)(void* ctx, const char* text, size_t len);
+
+typedef struct {
+    metrics_out_t out;
+    void* ctx;
+    char line[160];
+} metrics_writer_t;
+
+/**
+ * @brief Add an observation; only one task may update a histogram
+ */
+void metrics_observe(metrics_histogram_t* h, uint32_t us);
+
+/**
+ * @brief Remember a task for the stack watermark metric
+ */
+void metrics_register_task(TaskHandle_t task);
+
+void metrics_writer_init(metrics_writer_t* w, metrics_out_t out, void* ctx);
+
+/**
+ * @brief Write the HELP and TYPE lines of a metric family
+ *
+ * @param type "counter", "gauge" or "histogram"
+ */
+void metrics_family(metrics_writer_t* w, const char* name, const char* type, const char* help);
+
+/**
+ * @brief Write one sample
+ *
+ * @param labels label list without braces, e.g. "client=\"0\"", or NULL
+ */
+void metrics_sample(metrics_writer_t* w, const char* name, const char* labels, int64_t value);
+
+/**
+ * @brief Write a histogram family, in seconds
+ */
+void metrics_histogram(metrics_writer_t* w, const char* name, const char* help,
+                       const metrics_histogram_t* h);
+
+/**
+ * @brief Write the stack high water mark of every registered task
+ */
+void metrics_task_stacks(metrics_writer_t* w, const char* name);
@@ -0,0 +1,91 @@
+#include <string.h>
+#include "stream_ctl.h"
+
+void stream_ctl_init(stream_ctl_t* ctl, int max_level, uint32_t now_us)
+{
+    memset(ctl, 0, sizeof(stream_ctl_t));
+    ctl->max_level = max_level;
+    ctl->changed_us = now_us;
+}
+
+void stream_ctl_set_max_level(stream_ctl_t* ctl, int max_level)
+{
+    ctl->max_level = max_level;
+    if (ctl->level > max_level) {
+        ctl->level = max_level;
+    }
+}
+
+bool stream_ctl_frame(stream_ctl_t* ctl, uint32_t now_us)
+{
+    if (ctl->last_frame_us != 0) {
+        uint32_t interval = now_us - ctl->last_frame_us;
+        if (ctl->interval_us == 0) {
+            ctl->interval_us = interval;
+        } else {
+            ctl->interval_us += ((int32_t) (interval - ctl->interval_us)) / 8;
+        }
+    }
+    ctl->last_frame_us = now_us;
+    if (ctl->to_skip > 0) {
+        ctl->to_skip--;
+        return false;
+    }
+    ctl->to_skip = ctl->skip;
+    return true;
+}
+
+bool stream_ctl_update(stream_ctl_t* ctl, uint32_t send_us, size_t backlog, uint32_t now_us)
+{
+    if (ctl->interval_us == 0) {
+        return false;
+    }
+    // time available per frame sent
+    uint32_t budget = ctl->interval_us * (ctl->skip + 1);
+    // the better setting would have to fit in half the budget it gets
+    uint32_t better = ctl->skip > 0 ? ctl->interval_us * ctl->skip : ctl->interval_us;
+    bool hold = now_us - ctl->changed_us < STREAM_CTL_HOLD_US;
+
+    if (backlog > 0 || send_us > budget) {
+        ctl->congested++;
+        ctl->clear = false;
+    } else {
+        ctl->congested = 0;
+        if (send_us * 2 < better) {
+            if (!ctl->clear) {
+                ctl->clear = true;
+                ctl->clear_since_us = now_us;
+            }
+        } else {
+            ctl->clear = false;
+        }
+    }
+    if (hold) {
+        return false;
+    }
+
+    if (ctl->congested >= STREAM_CTL_CONGESTED) {
+        if (ctl->level < ctl->max_level) {
+            ctl->level++;
+        } else if (ctl->skip < STREAM_CTL_MAX_SKIP) {
+            ctl->skip++;
+        } else {
+            return false;
+        }
+    } else if (ctl->clear && now_us - ctl->clear_since_us >= STREAM_CTL_CLEAR_US) {
+        if (ctl->skip > 0) {
+            ctl->skip--;
+        } else if (ctl->level > 0) {
+            ctl->level--;
+        } else {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    ctl->changed_us = now_us;
+    ctl->congested = 0;
+    ctl->clear = false;
+    ctl->to_skip = 0;
+    return true;
+}
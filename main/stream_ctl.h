@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Per client stream rate control.
+ *
+ * Each stream client measures how long a frame takes from the first write
+ * until the client has acknowledged it, and how much sent data is still
+ * unacknowledged when the next frame is ready. While that exceeds the time
+ * between frames the link is congested: the client moves to a cheaper
+ * encoding level (lower JPEG quality, then lower resolution), then skips
+ * frames. Once frames go through in well under the time available, skipping
+ * is undone first, then the encoding level. Changes are at least
+ * STREAM_CTL_HOLD_US apart, so each one can be seen in the measurements
+ * before the next.
+ *
+ * Capture never waits for a client: a client that falls behind only gets
+ * the newest frame once it is ready again.
+ */
+
+#define STREAM_CTL_HOLD_US      1000000
+#define STREAM_CTL_MAX_SKIP     7
+// congested frames in a row before the stream is made cheaper
+#define STREAM_CTL_CONGESTED    3
+// how long frames have to go through easily before the stream gets better
+#define STREAM_CTL_CLEAR_US     3000000
+
+typedef struct {
+    int level;              /*!< encoding level, 0 is the best */
+    int max_level;
+    int skip;               /*!< frames skipped after every frame sent */
+    uint32_t interval_us;   /*!< average time between frames, 0 until known */
+    uint32_t last_frame_us;
+    int to_skip;
+    int congested;
+    bool clear;
+    uint32_t clear_since_us;
+    uint32_t changed_us;
+} stream_ctl_t;
+
+/**
+ * @brief Start at the best level without skipping
+ */
+void stream_ctl_init(stream_ctl_t* ctl, int max_level, uint32_t now_us);
+
+/**
+ * @brief Change the cheapest level available, e.g. after a format change
+ */
+void stream_ctl_set_max_level(stream_ctl_t* ctl, int max_level);
+
+/**
+ * @brief Account for a new frame
+ *
+ * @return true to send it, false to skip it
+ */
+bool stream_ctl_frame(stream_ctl_t* ctl, uint32_t now_us);
+
+/**
+ * @brief Feed a measurement and adapt
+ *
+ * @param send_us time from writing a frame until it was acknowledged, or
+ *                until now if it still is not
+ * @param backlog bytes sent but not acknowledged when the next frame was ready
+ * @param now_us current time
+ * @return true if level or skip changed
+ */
+bool stream_ctl_update(stream_ctl_t* ctl, uint32_t send_us, size_t backlog, uint32_t now_us);
@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/tcp.h"
+#include "esp_log.h"
+#include "tx_pool.h"
+
+static const char* TAG = "tx_pool";
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t** s_free = NULL;
+static int s_free_count = 0;
+static size_t s_buffer_size = 0;
+
+esp_err_t tx_pool_init(int buffers, int segments)
+{
+    if (s_free != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (buffers < 1 || segments < 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_buffer_size = segments * TCP_MSS;
+    s_free = (uint8_t**) calloc(buffers, sizeof(uint8_t*));
+    if (!s_free) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < buffers; ++i) {
+        s_free[i] = (uint8_t*) malloc(s_buffer_size);
+        if (!s_free[i]) {
+            ESP_LOGW(TAG, "Only %d of %d buffers allocated", i, buffers);
+            break;
+        }
+        s_free_count++;
+    }
+    return s_free_count > 0 ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static void pool_put(void* buf)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_free[s_free_count++] = (uint8_t*) buf;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+static uint8_t* pool_take()
+{
+    uint8_t* buf = NULL;
+    portENTER_CRITICAL(&s_lock);
+    if (s_free_count > 0) {
+        buf = s_free[--s_free_count];
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return buf;
+}
+
+void tx_conn_init(tx_conn_t* tx, struct netconn* conn)
+{
+    memset(tx, 0, sizeof(tx_conn_t));
+    tx->conn = conn;
+}
+
+// run the callbacks of writes the peer has acknowledged, or of all of them
+static void complete(tx_conn_t* tx, bool all)
+{
+    while (tx->count > 0) {
+        tx_pending_t* p = &tx->pending[tx->head];
+        // lwIP frees queued segments together with the pcb
+        struct tcp_pcb* pcb = tx->conn->pcb.tcp;
+        if (!all && pcb != NULL && (int32_t) (pcb->lastack - p->end) < 0) {
+            break;
+        }
+        p->done(p->ctx);
+        tx->head = (tx->head + 1) % TX_MAX_PENDING;
+        tx->count--;
+    }
+}
+
+// wait until fewer than max writes are unacknowledged
+static void wait_pending(tx_conn_t* tx, int max)
+{
+    int waited = 0;
+    complete(tx, tx->err != ERR_OK);
+    while (tx->count > max) {
+        if (waited >= TX_ACK_TIMEOUT_MS) {
+            ESP_LOGW(TAG, "Data not acknowledged in %d ms", TX_ACK_TIMEOUT_MS);
+            tx->err = ERR_TIMEOUT;
+            complete(tx, true);
+            break;
+        }
+        vTaskDelay(10 / portTICK_RATE_MS);
+        waited += 10;
+        complete(tx, false);
+    }
+}
+
+static err_t write_nocopy(tx_conn_t* tx, const void* data, size_t len,
+                          tx_done_cb_t done, void* ctx)
+{
+    if (tx->err == ERR_OK) {
+        wait_pending(tx, TX_MAX_PENDING - 1);
+    }
+    if (tx->err == ERR_OK) {
+        tx->err = netconn_write(tx->conn, data, len, NETCONN_NOCOPY);
+    }
+    if (tx->err != ERR_OK || tx->conn->pcb.tcp == NULL) {
+        done(ctx);
+        return tx->err;
+    }
+    // the write returns once lwIP has queued all of it, nothing else writes
+    // to this connection in the meantime
+    tx_pending_t* p = &tx->pending[(tx->head + tx->count) % TX_MAX_PENDING];
+    p->end = tx->conn->pcb.tcp->snd_lbb;
+    p->done = done;
+    p->ctx = ctx;
+    tx->count++;
+    return ERR_OK;
+}
+
+static void send_buffer(tx_conn_t* tx)
+{
+    if (tx->buf != NULL) {
+        uint8_t* buf = tx->buf;
+        tx->buf = NULL;
+        if (tx->len == 0) {
+            pool_put(buf);
+        } else {
+            write_nocopy(tx, buf, tx->len, pool_put, buf);
+        }
+    }
+}
+
+// take a fresh pool buffer, waiting for our own or other writes to complete
+static bool take_buffer(tx_conn_t* tx)
+{
+    int waited = 0;
+    while (tx->err == ERR_OK) {
+        tx->buf = pool_take();
+        if (tx->buf != NULL) {
+            tx->len = 0;
+            return true;
+        }
+        if (waited >= TX_ACK_TIMEOUT_MS) {
+            ESP_LOGW(TAG, "No buffer free in %d ms", TX_ACK_TIMEOUT_MS);
+            tx->err = ERR_TIMEOUT;
+            break;
+        }
+        vTaskDelay(10 / portTICK_RATE_MS);
+        waited += 10;
+        complete(tx, false);
+    }
+    return false;
+}
+
+err_t tx_conn_write_nocopy(tx_conn_t* tx, const void* data, size_t len,
+                           tx_done_cb_t done, void* ctx)
+{
+    send_buffer(tx);
+    return write_nocopy(tx, data, len, done, ctx);
+}
+
+err_t tx_conn_write(tx_conn_t* tx, const void* data, size_t len)
+{
+    const uint8_t* p = (const uint8_t*) data;
+    while (len > 0 && tx->err == ERR_OK) {
+        if (tx->buf != NULL && tx->len == s_buffer_size) {
+            send_buffer(tx);
+        }
+        if (tx->buf == NULL && !take_buffer(tx)) {
+            break;
+        }
+        size_t n = s_buffer_size - tx->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(tx->buf + tx->len, p, n);
+        tx->len += n;
+        p += n;
+        len -= n;
+        if (tx->len == s_buffer_size) {
+            send_buffer(tx);
+        }
+    }
+    return tx->err;
+}
+
+uint8_t* tx_conn_reserve(tx_conn_t* tx, size_t len)
+{
+    uint8_t* p;
+    // a buffer filled in place is sent once more room is asked for
+    if (tx->buf != NULL && tx->len == s_buffer_size) {
+        send_buffer(tx);
+    }
+    if (tx->buf == NULL && !take_buffer(tx)) {
+        return NULL;
+    }
+    if (tx->len + len > s_buffer_size) {
+        return NULL;
+    }
+    p = tx->buf + tx->len;
+    tx->len += len;
+    return p;
+}
+
+err_t tx_conn_push(tx_conn_t* tx)
+{
+    send_buffer(tx);
+    return tx->err;
+}
+
+int tx_conn_poll(tx_conn_t* tx)
+{
+    complete(tx, tx->err != ERR_OK);
+    return tx->count;
+}
+
+size_t tx_conn_backlog(tx_conn_t* tx)
+{
+    struct tcp_pcb* pcb = tx->conn->pcb.tcp;
+    if (pcb == NULL) {
+        return 0;
+    }
+    return pcb->snd_lbb - pcb->lastack;
+}
+
+err_t tx_conn_flush(tx_conn_t* tx)
+{
+    send_buffer(tx);
+    wait_pending(tx, 0);
+    return tx->err;
+}
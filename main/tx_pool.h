@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "lwip/api.h"
+#include "esp_err.h"
+
+/*
+ * Zero-copy TCP sends from a pool of segment-sized buffers.
+ *
+ * Data is handed to lwIP with NETCONN_NOCOPY, so it must stay untouched
+ * until the peer has acknowledged it. Every write records the TCP sequence
+ * number its last byte ends at, together with a completion callback; the
+ * callback runs from the sending task once the connection's lastack has
+ * passed that number. Pool buffers are returned this way, and so are
+ * references on cached frames.
+ *
+ * Converters fill pool buffers of a multiple of TCP_MSS bytes, each sent
+ * with a single write, instead of copying every line into lwIP.
+ */
+
+#define TX_MAX_PENDING 8
+// how long a client may take to acknowledge data before it is given up on
+#define TX_ACK_TIMEOUT_MS 5000
+
+typedef void (*tx_done_cb_t)(void* ctx);
+
+typedef struct {
+    uint32_t end;           /*!< sequence number after the last byte */
+    tx_done_cb_t done;
+    void* ctx;
+} tx_pending_t;
+
+typedef struct {
+    struct netconn* conn;
+    err_t err;              /*!< first error, later writes are skipped */
+    tx_pending_t pending[TX_MAX_PENDING];
+    int head;
+    int count;
+    uint8_t* buf;           /*!< pool buffer being filled */
+    size_t len;
+} tx_conn_t;
+
+/**
+ * @brief Allocate the buffer pool
+ *
+ * @param buffers number of buffers
+ * @param segments size of each buffer in TCP segments (TCP_MSS)
+ */
+esp_err_t tx_pool_init(int buffers, int segments);
+
+/**
+ * @brief Start sending on a connection
+ */
+void tx_conn_init(tx_conn_t* tx, struct netconn* conn);
+
+/**
+ * @brief Queue data that stays valid until done is called
+ *
+ * Any partly filled pool buffer is sent first. If the write fails, done is
+ * called right away.
+ */
+err_t tx_conn_write_nocopy(tx_conn_t* tx, const void* data, size_t len,
+                           tx_done_cb_t done, void* ctx);
+
+/**
+ * @brief Copy data into pool buffers, sending each one once full
+ */
+err_t tx_conn_write(tx_conn_t* tx, const void* data, size_t len);
+
+/**
+ * @brief Get room for len bytes in the current pool buffer, to fill in place
+ *
+ * Full buffers are sent and a fresh one is taken when the current one has
+ * been filled exactly.
+ *
+ * @return NULL if len bytes do not fit in the current buffer; use
+ *         tx_conn_write to split the data instead
+ */
+uint8_t* tx_conn_reserve(tx_conn_t* tx, size_t len);
+
+/**
+ * @brief Send what is buffered, without waiting for acknowledgements
+ */
+err_t tx_conn_push(tx_conn_t* tx);
+
+/**
+ * @brief Run the callbacks of acknowledged writes
+ *
+ * @return writes still waiting for an acknowledgement
+ */
+int tx_conn_poll(tx_conn_t* tx);
+
+/**
+ * @brief Bytes written to the connection that are not acknowledged yet
+ */
+size_t tx_conn_backlog(tx_conn_t* tx);
+
+/**
+ * @brief Send what is buffered and wait until everything is acknowledged
+ *
+ * All completion callbacks have run on return, also on errors; after a
+ * timeout or error, lwIP may still reference the data of a connection that
+ * is about to be closed.
+ *
+ * @return first error on the connection, ERR_TIMEOUT after TX_ACK_TIMEOUT_MS
+ */
+err_t tx_conn_flush(tx_conn_t* tx);
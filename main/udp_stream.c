@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/api.h"
+#include "udp_stream.h"
+#include "delta.h"
+
+static const char* TAG = "udp_stream";
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t s_task = NULL;
+static struct netconn* s_conn = NULL;
+static struct netbuf* s_buf = NULL;             // header, chained to the line data
+static uint8_t s_header[UDP_STREAM_HEADER_LEN];
+static ip_addr_t s_addr;
+static uint16_t s_port;
+static volatile bool s_active = false;
+static volatile uint32_t s_kbps;
+static uint32_t s_ssrc;
+static uint16_t s_sequence = 0;
+static broadcast_frame_t* s_pending = NULL;     // holds one reference
+static udp_stream_info_t s_pending_info;
+static uint32_t s_sent = 0;
+static uint32_t s_dropped = 0;
+static uint32_t s_errors = 0;
+
+static inline void put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static inline uint16_t get16(const uint8_t* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static inline void put32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+// time a packet of len bytes takes on the wire, IP and UDP headers included
+static uint32_t packet_us(size_t len)
+{
+    return (uint32_t) (((uint64_t) (len + 28) * 8 * 1000) / s_kbps);
+}
+
+// the header is copied into s_header, the lines are only referenced
+static err_t send_packet(const uint8_t* data, size_t len)
+{
+    struct netbuf* lines = netbuf_new();
+    if (lines == NULL) {
+        return ERR_MEM;
+    }
+    netbuf_ref(s_buf, s_header, UDP_STREAM_HEADER_LEN);
+    netbuf_ref(lines, data, len);
+    // moves the line pbuf behind the header and frees the lines netbuf
+    netbuf_chain(s_buf, lines);
+    // lwIP is done with both once netconn_sendto returns
+    return netconn_sendto(s_conn, s_buf, &s_addr, s_port);
+}
+
+static void set_frame_header(broadcast_frame_t* frame, const udp_stream_info_t* info, int packets)
+{
+    s_header[0] = 0x80;
+    put32(s_header + 4, info->capture_us);
+    put32(s_header + 8, s_ssrc);
+    put32(s_header + 12, frame->frame);
+    put16(s_header + 20, info->width);
+    put16(s_header + 22, info->height);
+    s_header[24] = info->format;
+    s_header[25] = info->bytes_per_pixel;
+    put16(s_header + 26, packets);
+}
+
+// token bucket at tick resolution: packets go out in bursts of at most one
+// tick worth of the bitrate
+static void pace_packet(size_t len, uint32_t* next_us)
+{
+    uint32_t now = (uint32_t) esp_timer_get_time();
+    int32_t ahead = (int32_t) (*next_us - now);
+    if (ahead >= (int32_t) (portTICK_PERIOD_MS * 1000)) {
+        vTaskDelay(ahead / (portTICK_PERIOD_MS * 1000));
+    } else if (ahead < 0) {
+        // idle time is not saved up
+        *next_us = now;
+    }
+    *next_us += packet_us(len);
+}
+
+static void send_frame(broadcast_frame_t* frame, const udp_stream_info_t* info, uint32_t* next_us)
+{
+    size_t stride = frame->len / info->height;
+    int lines_per_packet = UDP_STREAM_MAX_PAYLOAD / stride;
+    if (lines_per_packet < 1) {
+        // lines wider than a datagram are not supported
+        s_errors++;
+        return;
+    }
+    int packets = (info->height + lines_per_packet - 1) / lines_per_packet;
+
+    set_frame_header(frame, info, packets);
+    for (int line = 0; line < info->height && s_active; line += lines_per_packet) {
+        int count = info->height - line;
+        if (count > lines_per_packet) {
+            count = lines_per_packet;
+        }
+        bool last = line + count >= info->height;
+        pace_packet(UDP_STREAM_HEADER_LEN + count * stride, next_us);
+        s_header[1] = (last ? 0x80 : 0) | UDP_STREAM_PAYLOAD_TYPE;
+        put16(s_header + 2, s_sequence++);
+        put16(s_header + 16, line);
+        put16(s_header + 18, count);
+        put32(s_header + 28, (uint32_t) esp_timer_get_time());
+        if (send_packet(frame->data + line * stride, count * stride) != ERR_OK) {
+            // typically out of buffers; the packet is lost, as on the network
+            s_errors++;
+        }
+    }
+    s_sent++;
+}
+
+// a packet per slice, the slice header goes into the packet header
+static void send_delta_frame(broadcast_frame_t* frame, const udp_stream_info_t* info, uint32_t* next_us)
+{
+    const uint8_t* end = frame->data + frame->len;
+    const uint8_t* slice;
+    int packets = 0;
+
+    for (slice = frame->data; slice < end; slice += DELTA_SLICE_HEADER + get16(slice + 2)) {
+        packets++;
+    }
+    set_frame_header(frame, info, packets);
+    for (slice = frame->data; slice < end && s_active; ) {
+        size_t len = get16(slice + 2);
+        bool last = slice + DELTA_SLICE_HEADER + len >= end;
+        pace_packet(UDP_STREAM_HEADER_LEN + len, next_us);
+        s_header[1] = (last ? 0x80 : 0) | UDP_STREAM_DELTA_PAYLOAD_TYPE;
+        put16(s_header + 2, s_sequence++);
+        memcpy(s_header + 16, slice, DELTA_SLICE_HEADER);
+        put32(s_header + 28, (uint32_t) esp_timer_get_time());
+        if (send_packet(slice + DELTA_SLICE_HEADER, len) != ERR_OK) {
+            s_errors++;
+        }
+        slice += DELTA_SLICE_HEADER + len;
+    }
+    s_sent++;
+}
+
+static void udp_stream_task(void* pvParameters)
+{
+    uint32_t next_us = (uint32_t) esp_timer_get_time();
+    broadcast_frame_t* frame;
+    udp_stream_info_t info;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        portENTER_CRITICAL(&s_lock);
+        frame = s_pending;
+        info = s_pending_info;
+        s_pending = NULL;
+        portEXIT_CRITICAL(&s_lock);
+        if (frame == NULL) {
+            continue;
+        }
+        if (s_active && info.delta) {
+            send_delta_frame(frame, &info, &next_us);
+        } else if (s_active) {
+            send_frame(frame, &info, &next_us);
+        }
+        broadcast_release(frame);
+    }
+}
+
+esp_err_t udp_stream_start(const char* host, uint16_t port, uint32_t kbps)
+{
+    ip_addr_t addr;
+    if (host == NULL || !ipaddr_aton(host, &addr) || port == 0 || kbps == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_task == NULL) {
+        s_conn = netconn_new(NETCONN_UDP);
+        s_buf = netbuf_new();
+        if (!s_conn || !s_buf) {
+            ESP_LOGE(TAG, "Not enough memory for the UDP connection");
+            if (s_conn) {
+                netconn_delete(s_conn);
+                s_conn = NULL;
+            }
+            if (s_buf) {
+                netbuf_delete(s_buf);
+                s_buf = NULL;
+            }
+            return ESP_ERR_NO_MEM;
+        }
+        s_ssrc = esp_random();
+        if (!xTaskCreatePinnedToCore(&udp_stream_task, "udp_stream", 2048, NULL, 5, &s_task, 1)) {
+            ESP_LOGE(TAG, "Failed to create UDP stream task");
+            s_task = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    s_active = false;
+    // the sender finishes its packet with the old address at worst
+    s_addr = addr;
+    s_port = port;
+    s_kbps = kbps;
+    s_active = true;
+    ESP_LOGI(TAG, "Streaming to %s:%d at %u kbps", host, port, kbps);
+    return ESP_OK;
+}
+
+void udp_stream_stop()
+{
+    broadcast_frame_t* frame;
+    s_active = false;
+    portENTER_CRITICAL(&s_lock);
+    frame = s_pending;
+    s_pending = NULL;
+    portEXIT_CRITICAL(&s_lock);
+    if (frame != NULL) {
+        broadcast_release(frame);
+    }
+    ESP_LOGI(TAG, "Stopped, %u frames sent, %u dropped, %u send errors",
+            s_sent, s_dropped, s_errors);
+}
+
+bool udp_stream_active()
+{
+    return s_active;
+}
+
+void udp_stream_set_bitrate(uint32_t kbps)
+{
+    if (kbps > 0) {
+        s_kbps = kbps;
+    }
+}
+
+void udp_stream_publish(broadcast_frame_t* frame, const udp_stream_info_t* info)
+{
+    broadcast_frame_t* replaced;
+    if (!s_active) {
+        broadcast_release(frame);
+        return;
+    }
+    portENTER_CRITICAL(&s_lock);
+    replaced = s_pending;
+    s_pending = frame;
+    s_pending_info = *info;
+    if (replaced != NULL) {
+        s_dropped++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (replaced != NULL) {
+        broadcast_release(replaced);
+    }
+    xTaskNotifyGive(s_task);
+}
+
+bool udp_stream_unpublish()
+{
+    broadcast_frame_t* frame;
+    portENTER_CRITICAL(&s_lock);
+    frame = s_pending;
+    s_pending = NULL;
+    if (frame != NULL) {
+        s_dropped++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (frame == NULL) {
+        return false;
+    }
+    broadcast_release(frame);
+    return true;
+}
+
+void udp_stream_get_stats(uint32_t* sent, uint32_t* dropped, uint32_t* errors)
+{
+    *sent = s_sent;
+    *dropped = s_dropped;
+    *errors = s_errors;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "broadcast.h"
+
+/*
+ * Raw frame streaming over UDP, for LAN monitoring.
+ *
+ * Frames are cut into datagrams of whole lines with an RTP style header
+ * followed by a frame header; the line data is referenced from the frame
+ * buffer, not copied. A sender task paces packets to the configured
+ * bitrate; when a frame is still being sent, only the newest one waiting
+ * goes out next. tools/udp_receiver.c reassembles the frames.
+ *
+ * Frames may also be block delta coded (delta.h), each slice in a packet of
+ * its own with payload type UDP_STREAM_DELTA_PAYLOAD_TYPE; keyframes are
+ * sent as raw frames. tools/delta_receiver.c decodes them.
+ *
+ * Packet layout, big endian:
+ *   0  RTP version 2 (0x80)
+ *   1  marker (0x80, last packet of a frame) | payload type 96
+ *   2  u16 packet sequence number
+ *   4  u32 RTP timestamp: frame VSYNC, microseconds (1 MHz clock)
+ *   8  u32 SSRC
+ *  12  u32 frame number
+ *  16  u16 first line, first block of the slice for delta frames
+ *  18  u16 lines in this packet, record bytes for delta frames
+ *  20  u16 frame width
+ *  22  u16 frame height
+ *  24  u8  camera pixel format (camera_pixelformat_t)
+ *  25  u8  bytes per pixel
+ *  26  u16 packets in this frame
+ *  28  u32 send time, microseconds on the same clock as the timestamp
+ *  32  line data, the slice's records for delta frames
+ */
+
+#define UDP_STREAM_HEADER_LEN   32
+#define UDP_STREAM_PAYLOAD_TYPE 96
+#define UDP_STREAM_DELTA_PAYLOAD_TYPE 97
+// keeps datagrams within a 1500 byte MTU
+#define UDP_STREAM_MAX_PAYLOAD  (1472 - UDP_STREAM_HEADER_LEN)
+
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    uint8_t format;         /*!< camera_pixelformat_t */
+    uint8_t bytes_per_pixel;
+    uint32_t capture_us;    /*!< VSYNC time of the frame */
+    bool delta;             /*!< block delta slices instead of lines */
+} udp_stream_info_t;
+
+/**
+ * @brief Start streaming to a receiver
+ *
+ * Starts the sender task the first time. Streaming again to another
+ * receiver replaces the previous one.
+ *
+ * @param host receiver IPv4 address
+ * @param port receiver UDP port
+ * @param kbps bitrate the packets are paced to, including UDP/IP headers
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad address
+ */
+esp_err_t udp_stream_start(const char* host, uint16_t port, uint32_t kbps);
+
+/**
+ * @brief Stop streaming, the frame being sent is finished first
+ */
+void udp_stream_stop();
+
+/**
+ * @brief Check whether frames should be handed to udp_stream_publish
+ */
+bool udp_stream_active();
+
+/**
+ * @brief Change the bitrate while streaming
+ */
+void udp_stream_set_bitrate(uint32_t kbps);
+
+/**
+ * @brief Hand a frame to the sender
+ *
+ * Takes over the caller's reference, which is dropped once the frame has
+ * been sent or replaced by a newer one.
+ *
+ * @param frame raw framebuffer contents, height lines of equal length, or
+ *        delta slices of at most UDP_STREAM_MAX_PAYLOAD record bytes
+ * @param info frame layout and capture time
+ */
+void udp_stream_publish(broadcast_frame_t* frame, const udp_stream_info_t* info);
+
+/**
+ * @brief Drop the frame waiting to be sent, if any
+ *
+ * Lets a delta coder put the blocks of a frame that would be replaced
+ * into the next one.
+ *
+ * @return true if a frame was dropped
+ */
+bool udp_stream_unpublish();
+
+/**
+ * @brief Get counters
+ *
+ * @param[out] sent frames sent completely
+ * @param[out] dropped frames replaced by a newer one before they were sent
+ * @param[out] errors packets that could not be sent
+ */
+void udp_stream_get_stats(uint32_t* sent, uint32_t* dropped, uint32_t* errors);
@@ -0,0 +1,146 @@
+#include <string.h>
+#include <strings.h>
+#include "mbedtls/sha1.h"
+#include "mbedtls/base64.h"
+#include "websocket.h"
+
+static const char s_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// copy the value of a header, without surrounding blanks
+static bool get_header(const char* req, size_t len, const char* name, char* value, size_t size)
+{
+    size_t name_len = strlen(name);
+    const char* end = req + len;
+    const char* line = req;
+
+    while (line < end) {
+        const char* eol = memchr(line, '\n', end - line);
+        if (eol == NULL) {
+            eol = end;
+        }
+        if (eol - line > name_len && line[name_len] == ':' &&
+                strncasecmp(line, name, name_len) == 0) {
+            const char* v = line + name_len + 1;
+            const char* v_end = eol;
+            while (v < v_end && (*v == ' ' || *v == '\t')) {
+                v++;
+            }
+            while (v_end > v && (v_end[-1] == '\r' || v_end[-1] == ' ' || v_end[-1] == '\t')) {
+                v_end--;
+            }
+            if (v_end - v >= size) {
+                return false;
+            }
+            memcpy(value, v, v_end - v);
+            value[v_end - v] = '\0';
+            return true;
+        }
+        line = eol + 1;
+    }
+    return false;
+}
+
+// case insensitive search for a token in a comma separated header value
+static bool has_token(const char* value, const char* token)
+{
+    size_t token_len = strlen(token);
+    for (const char* p = value; *p; ++p) {
+        if (strncasecmp(p, token, token_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ws_handshake(const char* req, size_t len, char* accept)
+{
+    char value[64];
+    unsigned char digest[20];
+    size_t out_len;
+    mbedtls_sha1_context ctx;
+
+    if (!get_header(req, len, "Upgrade", value, sizeof(value)) || !has_token(value, "websocket")) {
+        return false;
+    }
+    if (!get_header(req, len, "Connection", value, sizeof(value)) || !has_token(value, "upgrade")) {
+        return false;
+    }
+    // 16 random bytes in base64
+    if (!get_header(req, len, "Sec-WebSocket-Key", value, sizeof(value)) || strlen(value) != 24) {
+        return false;
+    }
+    mbedtls_sha1_init(&ctx);
+    mbedtls_sha1_starts_ret(&ctx);
+    mbedtls_sha1_update_ret(&ctx, (const unsigned char*) value, strlen(value));
+    mbedtls_sha1_update_ret(&ctx, (const unsigned char*) s_guid, sizeof(s_guid) - 1);
+    mbedtls_sha1_finish_ret(&ctx, digest);
+    mbedtls_sha1_free(&ctx);
+    return mbedtls_base64_encode((unsigned char*) accept, WS_ACCEPT_LEN + 1, &out_len,
+                                 digest, sizeof(digest)) == 0;
+}
+
+size_t ws_frame_header(uint8_t* hdr, ws_opcode_t opcode, size_t len)
+{
+    hdr[0] = 0x80 | opcode;
+    if (len < 126) {
+        hdr[1] = len;
+        return 2;
+    }
+    if (len < 65536) {
+        hdr[1] = 126;
+        hdr[2] = len >> 8;
+        hdr[3] = len & 0xFF;
+        return 4;
+    }
+    hdr[1] = 127;
+    memset(hdr + 2, 0, 4);
+    hdr[6] = (len >> 24) & 0xFF;
+    hdr[7] = (len >> 16) & 0xFF;
+    hdr[8] = (len >> 8) & 0xFF;
+    hdr[9] = len & 0xFF;
+    return 10;
+}
+
+int ws_parse_frame(uint8_t* buf, size_t len, ws_frame_t* frame)
+{
+    size_t pos = 2;
+    uint64_t payload_len;
+
+    if (len < 2) {
+        return 0;
+    }
+    // clients must mask, extensions are never negotiated
+    if ((buf[1] & 0x80) == 0 || (buf[0] & 0x70) != 0) {
+        return -1;
+    }
+    payload_len = buf[1] & 0x7F;
+    if (payload_len == 126) {
+        if (len < 4) {
+            return 0;
+        }
+        payload_len = (buf[2] << 8) | buf[3];
+        pos = 4;
+    } else if (payload_len == 127) {
+        if (len < 10) {
+            return 0;
+        }
+        payload_len = 0;
+        for (int i = 2; i < 10; ++i) {
+            payload_len = (payload_len << 8) | buf[i];
+        }
+        pos = 10;
+    }
+    if (payload_len > len || pos + 4 + payload_len > len) {
+        return 0;
+    }
+    const uint8_t* mask = buf + pos;
+    pos += 4;
+    for (size_t i = 0; i < payload_len; ++i) {
+        buf[pos + i] ^= mask[i & 3];
+    }
+    frame->fin = (buf[0] & 0x80) != 0;
+    frame->opcode = (ws_opcode_t) (buf[0] & 0x0F);
+    frame->payload = buf + pos;
+    frame->len = payload_len;
+    return pos + payload_len;
+}
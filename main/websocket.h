@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * WebSocket (RFC 6455) handshake and framing, server side.
+ *
+ * The HTTP server detects the upgrade request and answers it with the
+ * accept key; afterwards frames are built and parsed here and sent with the
+ * usual netconn writes. Server frames are never masked or fragmented.
+ */
+
+#define WS_ACCEPT_LEN       28      //!< base64 of a SHA-1 digest
+#define WS_MAX_HEADER_LEN   10
+
+typedef enum {
+    WS_OP_CONTINUATION = 0x0,
+    WS_OP_TEXT = 0x1,
+    WS_OP_BINARY = 0x2,
+    WS_OP_CLOSE = 0x8,
+    WS_OP_PING = 0x9,
+    WS_OP_PONG = 0xA,
+} ws_opcode_t;
+
+typedef struct {
+    ws_opcode_t opcode;
+    bool fin;
+    uint8_t* payload;       /*!< unmasked in place */
+    size_t len;
+} ws_frame_t;
+
+/**
+ * @brief Check for a WebSocket upgrade request and compute the accept key
+ *
+ * @param req request line and headers
+ * @param len bytes in req
+ * @param[out] accept WS_ACCEPT_LEN + 1 bytes, Sec-WebSocket-Accept value
+ * @return true for a valid upgrade request
+ */
+bool ws_handshake(const char* req, size_t len, char* accept);
+
+/**
+ * @brief Build a frame header
+ *
+ * @param[out] hdr WS_MAX_HEADER_LEN bytes
+ * @param opcode frame type
+ * @param len payload length
+ * @return header length
+ */
+size_t ws_frame_header(uint8_t* hdr, ws_opcode_t opcode, size_t len);
+
+/**
+ * @brief Parse a client frame at the start of buf
+ *
+ * Client frames are masked; the payload is unmasked in place.
+ *
+ * @return bytes used by the frame, 0 if buf does not hold a complete
+ *         frame yet, -1 for a protocol error
+ */
+int ws_parse_frame(uint8_t* buf, size_t len, ws_frame_t* frame);
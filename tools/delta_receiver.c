@@ -0,0 +1,350 @@
+/*
+ * Decoder for the ESPILICAM block delta UDP stream (telnet: udp <this host>[:port]
+ * with udpdelta above 0).
+ *
+ * Keeps the picture as decoded: raw keyframes replace it line by line,
+ * delta frames replace the 16x16 blocks that changed. Prints once a second:
+ * frame rate, bitrate, bytes per frame against the same frames sent raw,
+ * keyframes, blocks per delta frame, lost packets and incomplete frames.
+ *
+ * With -w, the packets received are recorded to a file as well. With -r,
+ * such a recording is decoded instead, as fast as it can be read, and the
+ * totals of the whole sequence are printed. With -o, the decoded picture is
+ * written to a PPM file once a second and at the end of a recording.
+ *
+ * Build: gcc -O2 -Wall -o delta_receiver delta_receiver.c
+ * Usage: ./delta_receiver [-p port] [-o latest.ppm] [-w rec.bin | -r rec.bin]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+// must match main/udp_stream.h and components/camera/include/delta.h
+#define HEADER_LEN          32
+#define MAX_DATAGRAM        1472
+#define PAYLOAD_TYPE        96
+#define DELTA_PAYLOAD_TYPE  97
+#define BLOCK               16
+#define PF_RGB565           0
+#define PF_YUV422           1
+#define PF_GRAYSCALE        2
+
+typedef struct {
+    int delta;
+    int marker;
+    uint16_t seq;
+    uint32_t capture_us;
+    uint32_t frame;
+    uint16_t first;         // line, or block for delta packets
+    uint16_t count;         // lines, or record bytes for delta packets
+    uint16_t width;
+    uint16_t height;
+    uint8_t format;
+    uint8_t bpp;
+    uint16_t packets;
+} packet_t;
+
+typedef struct {
+    uint16_t width, height;
+    uint8_t format, bpp;
+    uint8_t *data;
+    size_t size;
+} picture_t;
+
+typedef struct {
+    uint64_t bytes;         // datagrams, without UDP/IP headers
+    uint64_t raw_bytes;     // the same frames sent raw
+    uint32_t packets, lost, frames, keyframes, blocks, incomplete;
+} stats_t;
+
+static uint16_t get16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+static uint32_t get32(const uint8_t *p) { return ((uint32_t) get16(p) << 16) | get16(p + 2); }
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int parse(const uint8_t *buf, ssize_t len, packet_t *p)
+{
+    if (len < HEADER_LEN || (buf[0] & 0xC0) != 0x80)
+        return -1;
+    if ((buf[1] & 0x7F) != PAYLOAD_TYPE && (buf[1] & 0x7F) != DELTA_PAYLOAD_TYPE)
+        return -1;
+    p->delta = (buf[1] & 0x7F) == DELTA_PAYLOAD_TYPE;
+    p->marker = buf[1] >> 7;
+    p->seq = get16(buf + 2);
+    p->capture_us = get32(buf + 4);
+    p->frame = get32(buf + 12);
+    p->first = get16(buf + 16);
+    p->count = get16(buf + 18);
+    p->width = get16(buf + 20);
+    p->height = get16(buf + 22);
+    p->format = buf[24];
+    p->bpp = buf[25];
+    p->packets = get16(buf + 26);
+    return p->width && p->height && p->bpp ? 0 : -1;
+}
+
+// bytes the sender takes for a raw frame, packet headers included
+static size_t raw_frame_bytes(const packet_t *p)
+{
+    size_t stride = (size_t) p->width * p->bpp;
+    size_t lines = (MAX_DATAGRAM - HEADER_LEN) / stride;
+    size_t packets = lines ? (p->height + lines - 1) / lines : 0;
+    return stride * p->height + packets * HEADER_LEN;
+}
+
+static void copy_lines(picture_t *pic, const packet_t *p, const uint8_t *data, size_t len)
+{
+    size_t stride = (size_t) pic->width * pic->bpp;
+    size_t offset = (size_t) p->first * stride;
+    if (offset + len <= pic->size && len == (size_t) p->count * stride)
+        memcpy(pic->data + offset, data, len);
+}
+
+// records: u16 blocks skipped, then the block's rows; returns blocks decoded
+static int decode_slice(picture_t *pic, const packet_t *p, const uint8_t *data, size_t len)
+{
+    int blocks_x = (pic->width + BLOCK - 1) / BLOCK;
+    int blocks = blocks_x * ((pic->height + BLOCK - 1) / BLOCK);
+    int block = p->first, decoded = 0;
+    size_t pos = 0;
+
+    if (len != p->count)
+        return 0;
+    while (pos + 2 <= len) {
+        block += get16(data + pos);
+        pos += 2;
+        if (block >= blocks)
+            break;
+        int bx = block % blocks_x, by = block / blocks_x;
+        int cols = pic->width - bx * BLOCK, rows = pic->height - by * BLOCK;
+        if (cols > BLOCK)
+            cols = BLOCK;
+        if (rows > BLOCK)
+            rows = BLOCK;
+        size_t row_bytes = (size_t) cols * pic->bpp;
+        if (pos + rows * row_bytes > len)
+            break;
+        for (int y = 0; y < rows; y++) {
+            size_t offset = ((size_t) (by * BLOCK + y) * pic->width + bx * BLOCK) * pic->bpp;
+            memcpy(pic->data + offset, data + pos, row_bytes);
+            pos += row_bytes;
+        }
+        block++;
+        decoded++;
+    }
+    return decoded;
+}
+
+static uint8_t clamp(int v) { return v < 0 ? 0 : v > 255 ? 255 : v; }
+
+// framebuffer words are little endian, two pixels each: y1 v y2 u for
+// YUV422, the second pixel's 565 value byte swapped first for RGB565
+static void write_ppm(const char *path, const picture_t *a)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    fprintf(f, "P6 %d %d 255\n", a->width, a->height);
+    for (size_t i = 0; i + 3 < a->size && a->format != PF_GRAYSCALE; i += 4) {
+        const uint8_t *w = a->data + i;
+        uint8_t rgb[6];
+        if (a->format == PF_YUV422) {
+            int u = w[3] - 128, v = w[1] - 128;
+            for (int k = 0; k < 2; k++) {
+                int y = 1192 * ((k ? w[2] : w[0]) - 16);
+                rgb[3 * k] = clamp((y + 1634 * v) >> 10);
+                rgb[3 * k + 1] = clamp((y - 832 * v - 400 * u) >> 10);
+                rgb[3 * k + 2] = clamp((y + 2066 * u) >> 10);
+            }
+        } else {
+            uint16_t px[2] = { (w[2] << 8) | w[3], (w[0] << 8) | w[1] };
+            for (int k = 0; k < 2; k++) {
+                rgb[3 * k] = (px[k] >> 11) << 3;
+                rgb[3 * k + 1] = ((px[k] >> 5) & 0x3F) << 2;
+                rgb[3 * k + 2] = (px[k] & 0x1F) << 3;
+            }
+        }
+        fwrite(rgb, 1, 6, f);
+    }
+    for (size_t i = 0; i < a->size && a->format == PF_GRAYSCALE; i++) {
+        uint8_t rgb[3] = { a->data[i], a->data[i], a->data[i] };
+        fwrite(rgb, 1, 3, f);
+    }
+    fclose(f);
+}
+
+static void report(const stats_t *s, double seconds)
+{
+    uint32_t expected = s->packets + s->lost;
+    uint32_t deltas = s->frames - s->keyframes;
+    double per_frame = s->frames ? (double) s->bytes / s->frames : 0.0;
+    printf("%5.1f fps %6.2f Mbit/s | %7.0f bytes/frame, %5.1fx less than raw"
+           " | %u keyframes, %.1f blocks/delta frame"
+           " | lost %u/%u packets (%.2f%%), %u incomplete\n",
+           s->frames / seconds, s->bytes * 8 / seconds / 1e6, per_frame,
+           s->bytes ? (double) s->raw_bytes / s->bytes : 0.0,
+           s->keyframes, deltas ? (double) s->blocks / deltas : 0.0,
+           s->lost, expected, expected ? 100.0 * s->lost / expected : 0.0, s->incomplete);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    int port = 5004, opt, sock = -1;
+    const char *ppm = NULL, *record = NULL, *replay = NULL;
+    FILE *rec = NULL;
+    while ((opt = getopt(argc, argv, "p:o:w:r:")) != -1) {
+        if (opt == 'p') {
+            port = atoi(optarg);
+        } else if (opt == 'o') {
+            ppm = optarg;
+        } else if (opt == 'w') {
+            record = optarg;
+        } else if (opt == 'r') {
+            replay = optarg;
+        } else {
+            fprintf(stderr, "usage: %s [-p port] [-o latest.ppm] [-w rec.bin | -r rec.bin]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (replay) {
+        // u16 big endian length, then the datagram
+        rec = fopen(replay, "rb");
+        if (!rec) {
+            perror(replay);
+            return 1;
+        }
+    } else {
+        struct sockaddr_in addr = { 0 };
+        sock = socket(AF_INET, SOCK_DGRAM, 0);
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        int rcvbuf = 4 << 20;
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        struct timeval tv = { 0, 200000 };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            perror("bind");
+            return 1;
+        }
+        if (record && !(rec = fopen(record, "wb"))) {
+            perror(record);
+            return 1;
+        }
+        printf("listening on UDP port %d\n", port);
+    }
+
+    picture_t pic = { 0 };
+    stats_t iv = { 0 };
+    uint8_t buf[2048];
+    packet_t p;
+    int have_seq = 0, active = 0;
+    uint16_t next_seq = 0, received = 0;
+    uint32_t frame = 0, first_us = 0, last_us = 0;
+    double report_at = now_s() + 1.0;
+
+    while (1) {
+        ssize_t len;
+        if (replay) {
+            uint8_t prefix[2];
+            if (fread(prefix, 1, 2, rec) != 2)
+                break;
+            len = get16(prefix);
+            if ((size_t) len > sizeof(buf) || fread(buf, 1, len, rec) != (size_t) len)
+                break;
+        } else {
+            len = recv(sock, buf, sizeof(buf), 0);
+            if (len > 0 && rec) {
+                uint8_t prefix[2] = { len >> 8, len & 0xFF };
+                fwrite(prefix, 1, 2, rec);
+                fwrite(buf, 1, len, rec);
+            }
+        }
+
+        if (len > 0 && parse(buf, len, &p) == 0) {
+            iv.packets++;
+            iv.bytes += len;
+            if (have_seq && p.seq != next_seq) {
+                // late or duplicate packets show up as a large forward gap
+                uint16_t gap = p.seq - next_seq;
+                if (gap < 0x8000)
+                    iv.lost += gap;
+            }
+            have_seq = 1;
+            next_seq = p.seq + 1;
+
+            size_t size = (size_t) p.width * p.height * p.bpp;
+            if (size != pic.size || p.format != pic.format || p.width != pic.width) {
+                // delta frames before the next keyframe refer to nothing
+                pic.data = realloc(pic.data, size);
+                memset(pic.data, 0, size);
+                pic.size = size;
+                pic.width = p.width;
+                pic.height = p.height;
+                pic.format = p.format;
+                pic.bpp = p.bpp;
+            }
+            if (active && p.frame != frame) {
+                iv.incomplete++;
+                active = 0;
+            }
+            if (!active) {
+                active = 1;
+                frame = p.frame;
+                received = 0;
+            }
+            received++;
+            if (p.delta)
+                iv.blocks += decode_slice(&pic, &p, buf + HEADER_LEN, len - HEADER_LEN);
+            else
+                copy_lines(&pic, &p, buf + HEADER_LEN, len - HEADER_LEN);
+
+            if (p.marker) {
+                if (received != p.packets)
+                    iv.incomplete++;
+                iv.frames++;
+                iv.keyframes += !p.delta;
+                iv.raw_bytes += raw_frame_bytes(&p);
+                if (iv.frames == 1)
+                    first_us = p.capture_us;
+                last_us = p.capture_us;
+                active = 0;
+            }
+        }
+
+        double t = now_s();
+        if (!replay && t >= report_at) {
+            report(&iv, 1.0);
+            if (ppm && pic.data)
+                write_ppm(ppm, &pic);
+            memset(&iv, 0, sizeof(iv));
+            report_at = t + 1.0;
+        }
+    }
+
+    // end of a recording: iv holds the whole sequence, timed by the camera
+    double seconds = (uint32_t) (last_us - first_us) * 1e-6;
+    if (iv.frames > 1)
+        seconds *= (double) iv.frames / (iv.frames - 1);
+    printf("%u frames, %.1f s\n", iv.frames, seconds);
+    report(&iv, seconds > 0 ? seconds : 1.0);
+    if (ppm && pic.data)
+        write_ppm(ppm, &pic);
+    fclose(rec);
+    return 0;
+}
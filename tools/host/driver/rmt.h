@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef enum {
+    RMT_CHANNEL_0, RMT_CHANNEL_1, RMT_CHANNEL_2, RMT_CHANNEL_3,
+    RMT_CHANNEL_4, RMT_CHANNEL_5, RMT_CHANNEL_6, RMT_CHANNEL_7,
+} rmt_channel_t;
+
+typedef enum { RMT_MODE_TX, RMT_MODE_RX } rmt_mode_t;
+typedef enum { RMT_IDLE_LEVEL_LOW, RMT_IDLE_LEVEL_HIGH } rmt_idle_level_t;
+
+typedef struct {
+    bool loop_en;
+    bool carrier_en;
+    rmt_idle_level_t idle_level;
+    bool idle_output_en;
+} rmt_tx_config_t;
+
+typedef struct {
+    rmt_mode_t rmt_mode;
+    rmt_channel_t channel;
+    uint8_t clk_div;
+    int gpio_num;
+    uint8_t mem_block_num;
+    rmt_tx_config_t tx_config;
+} rmt_config_t;
+
+// same layout as the IDF: duration0, level0, duration1, level1 from bit 0
+typedef struct {
+    union {
+        struct {
+            uint32_t duration0 :15;
+            uint32_t level0 :1;
+            uint32_t duration1 :15;
+            uint32_t level1 :1;
+        };
+        uint32_t val;
+    };
+} rmt_item32_t;
+
+// there is no RMT peripheral, so the driver cannot be set up
+static inline esp_err_t rmt_config(const rmt_config_t* conf) { return ESP_FAIL; }
+static inline esp_err_t rmt_driver_install(rmt_channel_t channel, size_t rx_buf_size, int flags) { return ESP_FAIL; }
+static inline esp_err_t rmt_driver_uninstall(rmt_channel_t channel) { return ESP_OK; }
+static inline esp_err_t rmt_wait_tx_done(rmt_channel_t channel, TickType_t ticks) { return ESP_OK; }
+static inline esp_err_t rmt_write_items(rmt_channel_t channel, const rmt_item32_t* items, int count,
+                                        bool wait) { return ESP_OK; }
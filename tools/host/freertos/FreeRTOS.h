@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint32_t TickType_t;
+typedef int portMUX_TYPE;
+
+#define portMAX_DELAY                   ((TickType_t) 0xFFFFFFFF)
+#define portMUX_INITIALIZER_UNLOCKED    0
+#define portENTER_CRITICAL(mux)         ((void) (mux))
+#define portEXIT_CRITICAL(mux)          ((void) (mux))
+#define pdTRUE                          1
+#define pdFALSE                         0
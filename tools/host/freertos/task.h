@@ -0,0 +1,12 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+// tasks are never started on the host
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+static inline int xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack, void* arg,
+                                          int prio, TaskHandle_t* handle, int core) { return pdFALSE; }
+static inline void xTaskNotifyGive(TaskHandle_t task) { }
+static inline uint32_t ulTaskNotifyTake(int clear, TickType_t ticks) { return 0; }
@@ -0,0 +1,162 @@
+/*
+ * Host benchmark for the YUV422 JPEG encoder (components/camera/jpeg_encoder.c).
+ *
+ * Encodes a frame repeatedly at each quality given and prints the JPEG
+ * size, the compression ratio against the raw framebuffer, bits per pixel,
+ * time per frame and throughput in MB/s of framebuffer encoded. The frame
+ * is a synthetic QVGA test picture (gradients, hard edges, colour and some
+ * sensor-like noise), or a raw framebuffer dump with -i: width / 2 little
+ * endian words per row, y1 | v << 8 | y2 << 16 | u << 24, as the camera
+ * writes it. Host timings only compare encoder changes with each other;
+ * the ESP32 is many times slower.
+ *
+ * With -o, the output of the last quality is written to a file to check
+ * it decodes.
+ *
+ * Build: gcc -O2 -Wall -Ihost -I../components/camera/include
+ *            -o jpeg_bench jpeg_bench.c ../components/camera/jpeg_encoder.c
+ * Usage: ./jpeg_bench [-i frame.yuv -w width -h height] [-q 30,60,90] [-n frames] [-o out.jpg]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "jpeg_encoder.h"
+
+typedef struct {
+    uint8_t *data;
+    size_t len, size;
+} output_t;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int write_output(void *ctx, const uint8_t *data, size_t len)
+{
+    output_t *out = ctx;
+    if (out->len + len > out->size) {
+        out->size = (out->len + len) * 2;
+        out->data = realloc(out->data, out->size);
+        if (!out->data)
+            return -1;
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+    return 0;
+}
+
+static uint8_t clamp(int v) { return v < 0 ? 0 : v > 255 ? 255 : v; }
+
+// diagonal luma ramp under a checkerboard, chroma waves, and noise
+static void test_frame(uint32_t *fb, int width, int height)
+{
+    uint32_t seed = 1;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += 2) {
+            int luma[2];
+            for (int k = 0; k < 2; k++) {
+                int l = ((x + k) * 200 / width + y * 55 / height);
+                if (((x + k) / 40 + y / 40) & 1)
+                    l = 235 - l / 2;
+                seed = seed * 1103515245 + 12345;
+                luma[k] = clamp(l + (int) ((seed >> 16) % 9) - 4);
+            }
+            int u = 128 + (x * 2 % 160 - 80) * (y < height / 2 ? 1 : -1) / 2;
+            int v = 128 + (y * 3 % 120 - 60);
+            fb[(y * width + x) / 2] = luma[0] | (v << 8) | (luma[1] << 16) | ((uint32_t) u << 24);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int width = 320, height = 240, frames = 50, opt;
+    const char *input = NULL, *output = NULL, *qualities = "30,60,90";
+    while ((opt = getopt(argc, argv, "i:w:h:q:n:o:")) != -1) {
+        if (opt == 'i') {
+            input = optarg;
+        } else if (opt == 'w') {
+            width = atoi(optarg);
+        } else if (opt == 'h') {
+            height = atoi(optarg);
+        } else if (opt == 'q') {
+            qualities = optarg;
+        } else if (opt == 'n') {
+            frames = atoi(optarg);
+        } else if (opt == 'o') {
+            output = optarg;
+        } else {
+            fprintf(stderr, "usage: %s [-i frame.yuv -w width -h height] [-q 30,60,90] [-n frames] [-o out.jpg]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (width <= 0 || height <= 0 || (width & 1) || frames <= 0) {
+        fprintf(stderr, "width must be even, width, height and frames positive\n");
+        return 1;
+    }
+
+    size_t raw = (size_t) width * height * 2;
+    uint32_t *fb = malloc(raw);
+    if (!fb)
+        return 1;
+    if (input) {
+        FILE *f = fopen(input, "rb");
+        if (!f) {
+            perror(input);
+            return 1;
+        }
+        if (fread(fb, 1, raw, f) != raw) {
+            fprintf(stderr, "%s: shorter than %dx%d YUV422\n", input, width, height);
+            return 1;
+        }
+        fclose(f);
+    } else {
+        test_frame(fb, width, height);
+    }
+
+    printf("%dx%d YUV422, %zu bytes raw, %d frames per quality\n", width, height, raw, frames);
+    printf("quality    bytes   ratio    bpp   ms/frame    MB/s\n");
+    output_t out = { 0 };
+    for (const char *q = qualities; *q; ) {
+        int quality = atoi(q);
+        // one run to warm up and size the output
+        out.len = 0;
+        esp_err_t err = jpeg_encode_yuv422(fb, width, height, quality, write_output, &out);
+        if (err != ESP_OK) {
+            fprintf(stderr, "quality %d: error 0x%x\n", quality, err);
+            return 1;
+        }
+        double start = now_s();
+        for (int i = 0; i < frames; i++) {
+            out.len = 0;
+            jpeg_encode_yuv422(fb, width, height, quality, write_output, &out);
+        }
+        double s = (now_s() - start) / frames;
+        printf("%7d %8zu %6.1f:1 %6.2f %10.3f %7.1f\n", quality, out.len, (double) raw / out.len,
+               out.len * 8.0 / (width * height), s * 1000.0, raw / s / 1e6);
+
+        q = strchr(q, ',');
+        if (!q)
+            break;
+        q++;
+    }
+
+    if (output) {
+        FILE *f = fopen(output, "wb");
+        if (!f || fwrite(out.data, 1, out.len, f) != out.len) {
+            perror(output);
+            return 1;
+        }
+        fclose(f);
+    }
+    free(out.data);
+    free(fb);
+    return 0;
+}
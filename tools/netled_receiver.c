@@ -0,0 +1,335 @@
+/*
+ * Receiver for the ESPILICAM network LED output (components/ledstrip/netled.c),
+ * E1.31 (sACN) by default or DDP with -d.
+ *
+ * Checks every header field the sender fills in and how the packets of a
+ * frame follow each other: E1.31 frames are consecutive universes sharing
+ * one sequence number, DDP frames are packets at consecutive offsets
+ * sharing one sequence number, the last one with the push flag. Prints
+ * once a second: frame rate, time between frames, LEDs per frame, frames
+ * lost going by the sequence numbers, incomplete frames, packets out of
+ * order and invalid packets with the last reason.
+ *
+ * -u is the first E1.31 universe, -n the LED count the sender was set up
+ * with; without -n the frame size is taken from the packets. E1.31 sent to
+ * multicast is received by joining the groups of the universes, all of
+ * them with -n, otherwise the first.
+ *
+ * Build: gcc -O2 -Wall -o netled_receiver netled_receiver.c
+ * Usage: ./netled_receiver [-d] [-p port] [-u universe] [-n leds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+// must match components/ledstrip/include/netled.h
+#define E131_PORT           5568
+#define E131_HEADER_LEN     126
+#define E131_CHANNELS       510
+#define DDP_PORT            4048
+#define DDP_HEADER_LEN      10
+#define DDP_CHANNELS        1440
+
+typedef struct {
+    uint16_t universe;
+    uint8_t seq;
+    uint8_t priority;
+    size_t channels;
+} e131_t;
+
+typedef struct {
+    int push;
+    uint8_t seq;
+    uint32_t offset;
+    uint16_t length;
+} ddp_t;
+
+typedef struct {
+    int active;
+    int broken;                 // a universe or offset was skipped
+    uint8_t seq;
+    size_t next;                // E1.31: next universe index, DDP: next byte offset
+    size_t bytes;
+} frame_t;
+
+typedef struct {
+    uint64_t bytes;
+    uint32_t packets, frames, lost, incomplete, out_of_order, invalid;
+    double gap_ms_sum, gap_ms_max;
+    uint32_t gaps;
+    size_t leds;
+    const char *error;
+} interval_t;
+
+static uint16_t get16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+static uint32_t get32(const uint8_t *p) { return ((uint32_t) get16(p) << 16) | get16(p + 2); }
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ANSI E1.31-2016 data packet; returns why the packet is invalid, or NULL
+static const char *check_e131(const uint8_t *buf, ssize_t len, e131_t *p)
+{
+    static const uint8_t acn_id[12] = { 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0 };
+
+    if (len < E131_HEADER_LEN)
+        return "E1.31 packet shorter than the header";
+    if (get16(buf) != 0x0010 || get16(buf + 2) != 0 || memcmp(buf + 4, acn_id, sizeof(acn_id)) != 0)
+        return "bad ACN preamble or packet identifier";
+    if (get16(buf + 16) != (0x7000 | (len - 16)) || get32(buf + 18) != 0x00000004)
+        return "bad root layer length or vector";
+    if (get16(buf + 38) != (0x7000 | (len - 38)) || get32(buf + 40) != 0x00000002)
+        return "bad framing layer length or vector";
+    if (memchr(buf + 44, '\0', 64) == NULL)
+        return "source name not terminated";
+    if (buf[108] > 200)
+        return "priority above 200";
+    if (get16(buf + 109) != 0 || buf[112] != 0)
+        return "unexpected synchronization address or options";
+    if (get16(buf + 115) != (0x7000 | (len - 115)) || buf[117] != 0x02 || buf[118] != 0xA1)
+        return "bad DMP layer length, vector or address type";
+    if (get16(buf + 119) != 0 || get16(buf + 121) != 1 || get16(buf + 123) != len - E131_HEADER_LEN + 1)
+        return "bad DMP first address, increment or value count";
+    if (buf[125] != 0)
+        return "non-zero DMX start code";
+    p->universe = get16(buf + 113);
+    if (p->universe < 1 || p->universe > 63999)
+        return "universe outside 1-63999";
+    p->seq = buf[111];
+    p->priority = buf[108];
+    p->channels = len - E131_HEADER_LEN;
+    if (p->channels == 0 || p->channels > E131_CHANNELS || p->channels % 3 != 0)
+        return "universe not a whole number of RGB LEDs up to 170";
+    return NULL;
+}
+
+// http://www.3waylabs.com/ddp/; returns why the packet is invalid, or NULL
+static const char *check_ddp(const uint8_t *buf, ssize_t len, ddp_t *p)
+{
+    if (len < DDP_HEADER_LEN)
+        return "DDP packet shorter than the header";
+    if ((buf[0] & 0xC0) != 0x40)
+        return "DDP version not 1";
+    if (buf[0] & 0x3E)
+        return "unexpected DDP flags (timecode, storage, reply or query)";
+    if (buf[2] != 0x0B || buf[3] != 0x01)
+        return "data type not 8 bit RGB or output not the default device";
+    p->push = buf[0] & 0x01;
+    p->seq = buf[1] & 0x0F;
+    p->offset = get32(buf + 4);
+    p->length = get16(buf + 8);
+    if (p->seq == 0 || (buf[1] & 0xF0))
+        return "sequence number outside 1-15";
+    if (p->length != len - DDP_HEADER_LEN)
+        return "length does not match the packet";
+    if (p->length == 0 || p->length > DDP_CHANNELS || p->length % 3 != 0 || p->offset % 3 != 0)
+        return "packet not a whole number of RGB LEDs up to 480";
+    if (!p->push && p->length != DDP_CHANNELS)
+        return "short packet without the push flag";
+    return NULL;
+}
+
+typedef struct {
+    int ddp;
+    int universe;               // first E1.31 universe
+    size_t universes;           // E1.31 universes per frame, 0 while unknown
+    size_t frame_bytes;         // 0 while unknown
+    frame_t frame;
+    interval_t iv;
+    int have_seq;
+    uint8_t last_seq;           // sequence number of the last frame started
+    double last_frame_t;
+} receiver_t;
+
+static void finish_frame(receiver_t *r, double t)
+{
+    frame_t *f = &r->frame;
+    interval_t *iv = &r->iv;
+
+    if (f->broken || (r->frame_bytes && f->bytes != r->frame_bytes)) {
+        iv->incomplete++;
+    } else {
+        iv->frames++;
+        iv->leds = f->bytes / 3;
+        if (r->last_frame_t > 0) {
+            double gap_ms = (t - r->last_frame_t) * 1000.0;
+            iv->gap_ms_sum += gap_ms;
+            if (gap_ms > iv->gap_ms_max)
+                iv->gap_ms_max = gap_ms;
+            iv->gaps++;
+        }
+        r->last_frame_t = t;
+    }
+    f->active = 0;
+}
+
+static void receive(receiver_t *r, const uint8_t *buf, ssize_t len, double t)
+{
+    frame_t *f = &r->frame;
+    const char *error;
+    e131_t e = { 0 };
+    ddp_t d = { 0 };
+    uint8_t seq;
+    size_t pos, size;       // universe index or byte offset, and data bytes
+    int last;
+
+    r->iv.packets++;
+    r->iv.bytes += len;
+    if (r->ddp) {
+        error = check_ddp(buf, len, &d);
+        seq = d.seq;
+        pos = d.offset;
+        size = d.length;
+        last = d.push;
+    } else {
+        error = check_e131(buf, len, &e);
+        if (!error && (e.universe < r->universe ||
+                       (r->universes && e.universe >= r->universe + r->universes)))
+            error = "universe outside the ones set up";
+        if (!error && r->universes && e.universe < r->universe + r->universes - 1 &&
+            e.channels != E131_CHANNELS)
+            error = "short universe before the last one";
+        seq = e.seq;
+        pos = e.universe - r->universe;
+        size = e.channels;
+        // without -n, a short universe ends the frame
+        last = r->universes ? pos == r->universes - 1 : size < E131_CHANNELS;
+    }
+    if (error) {
+        r->iv.invalid++;
+        r->iv.error = error;
+        return;
+    }
+
+    // all packets of a frame carry the same sequence number
+    if (!f->active || seq != f->seq) {
+        if (r->have_seq && !r->ddp) {
+            // E1.31 receivers drop packets up to 20 sequence numbers back
+            int8_t step = seq - r->last_seq;
+            if (step <= 0 && step > -20) {
+                r->iv.out_of_order++;
+                return;
+            }
+        }
+        if (f->active) {
+            // without -n, E1.31 frames of whole universes end here
+            f->broken |= r->ddp || r->universes;
+            finish_frame(r, t);
+        }
+        if (r->have_seq) {
+            if (r->ddp)
+                r->iv.lost += (seq - r->last_seq % 15 - 1 + 15) % 15;
+            else
+                r->iv.lost += (uint8_t) (seq - r->last_seq - 1);
+        }
+        r->have_seq = 1;
+        r->last_seq = seq;
+        f->active = 1;
+        f->broken = 0;
+        f->seq = seq;
+        f->next = 0;
+        f->bytes = 0;
+    }
+
+    if (pos != f->next) {
+        if (pos < f->next)
+            r->iv.out_of_order++;
+        f->broken = 1;
+    }
+    f->next = r->ddp ? pos + size : pos + 1;
+    f->bytes += size;
+    if (last)
+        finish_frame(r, t);
+}
+
+static void join_group(int sock, uint16_t universe)
+{
+    struct ip_mreq mreq = { 0 };
+    mreq.imr_multiaddr.s_addr = htonl(0xEFFF0000 | universe);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        perror("IP_ADD_MEMBERSHIP");
+}
+
+int main(int argc, char **argv)
+{
+    receiver_t r = { 0 };
+    int port = 0, opt;
+    size_t leds = 0;
+    r.universe = 1;
+    while ((opt = getopt(argc, argv, "dp:u:n:")) != -1) {
+        if (opt == 'd') {
+            r.ddp = 1;
+        } else if (opt == 'p') {
+            port = atoi(optarg);
+        } else if (opt == 'u') {
+            r.universe = atoi(optarg);
+        } else if (opt == 'n') {
+            leds = strtoul(optarg, NULL, 0);
+        } else {
+            fprintf(stderr, "usage: %s [-d] [-p port] [-u universe] [-n leds]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (r.universe < 1 || r.universe > 63999) {
+        fprintf(stderr, "universe must be 1-63999\n");
+        return 1;
+    }
+    if (port == 0)
+        port = r.ddp ? DDP_PORT : E131_PORT;
+    r.frame_bytes = leds * 3;
+    r.universes = (r.frame_bytes + E131_CHANNELS - 1) / E131_CHANNELS;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return 1;
+    }
+    if (!r.ddp) {
+        for (size_t i = 0; i < (r.universes ? r.universes : 1); i++)
+            join_group(sock, r.universe + i);
+    }
+    printf("listening for %s on UDP port %d\n", r.ddp ? "DDP" : "E1.31", port);
+
+    uint8_t buf[2048];
+    double report_at = now_s() + 1.0;
+
+    while (1) {
+        struct timeval tv = { 0, 200000 };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        ssize_t len = recv(sock, buf, sizeof(buf), 0);
+        double t = now_s();
+
+        if (len > 0)
+            receive(&r, buf, len, t);
+
+        if (t >= report_at) {
+            interval_t *iv = &r.iv;
+            printf("%5.1f fps, %.1f/%.1f ms between frames (avg/max), %zu LEDs | %u packets, %.2f Mbit/s"
+                   " | %u lost, %u incomplete, %u out of order, %u invalid%s%s\n",
+                   iv->frames / 1.0, iv->gaps ? iv->gap_ms_sum / iv->gaps : 0.0, iv->gap_ms_max, iv->leds,
+                   iv->packets, iv->bytes * 8 / 1e6, iv->lost, iv->incomplete, iv->out_of_order, iv->invalid,
+                   iv->error ? ": " : "", iv->error ? iv->error : "");
+            fflush(stdout);
+            memset(iv, 0, sizeof(*iv));
+            report_at = t + 1.0;
+        }
+    }
+    return 0;
+}
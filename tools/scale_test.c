@@ -0,0 +1,113 @@
+/*
+ * Host test for the YUV422 box scaler (components/camera/scale.c).
+ *
+ * Scales flat frames of a few colours from QVGA and VGA to sizes from 2x1
+ * up to the source size, and checks every output pixel keeps the colour
+ * exactly: any rounding loss in the per-box division shows up as a drift
+ * in Y, or as a tint when U and V drift. At 160x120 the output is also
+ * compared with scale_yuv422_half on a noisy frame, since both average the
+ * same 2x2 boxes.
+ *
+ * Build: gcc -O2 -Wall -Ihost -I../components/camera/include
+ *            -o scale_test scale_test.c ../components/camera/scale.c
+ * Usage: ./scale_test
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "scale.h"
+
+static int s_failures = 0;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            s_failures++; \
+        } \
+    } while (0)
+
+static uint32_t yuv_word(int y1, int y2, int u, int v)
+{
+    return y1 | (v << 8) | (y2 << 16) | ((uint32_t) u << 24);
+}
+
+static void check_flat(int width, int height, int y, int u, int v)
+{
+    static const int sizes[][2] = {
+        { 2, 1 }, { 2, 2 }, { 4, 2 }, { 8, 6 }, { 16, 12 }, { 40, 30 }, { 80, 60 },
+        { 100, 75 }, { 160, 120 }, { 318, 239 }, { 320, 240 }, { 2, 240 }, { 320, 1 },
+    };
+    const uint32_t word = yuv_word(y, y, u, v);
+    uint32_t* src = (uint32_t*) malloc(width * height * 2);
+    uint32_t* dst = (uint32_t*) malloc(width * height * 2);
+
+    for (int i = 0; i < width * height / 2; i++) {
+        src[i] = word;
+    }
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        int dw = sizes[k][0], dh = sizes[k][1];
+        if (dw > width || dh > height) {
+            continue;
+        }
+        esp_err_t err = scale_yuv422_box(src, width, height, dst, dw, dh);
+        CHECK(err == ESP_OK, "%dx%d to %dx%d: error 0x%x", width, height, dw, dh, err);
+        int bad = 0;
+        for (int i = 0; err == ESP_OK && i < dw * dh / 2; i++) {
+            bad += dst[i] != word;
+        }
+        CHECK(bad == 0, "%dx%d to %dx%d of Y=%d U=%d V=%d: %d of %d words differ, first Y=%d U=%d V=%d",
+              width, height, dw, dh, y, u, v, bad, dw * dh / 2,
+              dst[0] & 0xFF, dst[0] >> 24, (dst[0] >> 8) & 0xFF);
+    }
+    free(src);
+    free(dst);
+}
+
+static void check_half(int width, int height)
+{
+    uint32_t* src = (uint32_t*) malloc(width * height * 2);
+    uint32_t* box = (uint32_t*) malloc(width * height / 2);
+    uint32_t* half = (uint32_t*) malloc(width * height / 2);
+    uint32_t seed = 1;
+
+    for (int i = 0; i < width * height / 2; i++) {
+        seed = seed * 1103515245 + 12345;
+        src[i] = seed;
+    }
+    scale_yuv422_half(src, width, height, half);
+    scale_yuv422_box(src, width, height, box, width / 2, height / 2);
+    int diff = 0;
+    for (int i = 0; i < width * height / 8; i++) {
+        diff += box[i] != half[i];
+    }
+    CHECK(diff == 0, "%dx%d halved: %d words differ from scale_yuv422_half", width, height, diff);
+    free(src);
+    free(box);
+    free(half);
+}
+
+int main()
+{
+    // white, black, and a saturated colour
+    static const int colours[][3] = { { 255, 128, 128 }, { 16, 128, 128 }, { 81, 90, 240 }, { 0, 255, 0 } };
+
+    for (size_t c = 0; c < sizeof(colours) / sizeof(colours[0]); c++) {
+        check_flat(320, 240, colours[c][0], colours[c][1], colours[c][2]);
+        check_flat(640, 480, colours[c][0], colours[c][1], colours[c][2]);
+    }
+    check_half(320, 240);
+
+    uint32_t word = 0;
+    CHECK(scale_yuv422_box(&word, 2, 1, &word, 4, 1) == ESP_ERR_INVALID_ARG, "upscaling accepted");
+    CHECK(scale_yuv422_box(&word, 2, 1, &word, 1, 1) == ESP_ERR_INVALID_ARG, "odd width accepted");
+
+    if (s_failures > 0) {
+        printf("%d checks failed\n", s_failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
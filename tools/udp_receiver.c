@@ -0,0 +1,285 @@
+/*
+ * Receiver for the ESPILICAM raw UDP stream (telnet: udp <this host>[:port]).
+ *
+ * Reassembles frames and prints once a second: frame rate, bitrate, lost
+ * packets, incomplete frames, frames the camera skipped and latency. The
+ * sender side latency (VSYNC to last packet sent) is exact; the network
+ * delay is measured against the camera's clock, whose offset is unknown,
+ * so it is reported above the smallest delay seen so far.
+ *
+ * With -o, the newest complete frame is written to a PPM file once a
+ * second.
+ *
+ * Block delta frames (telnet: udpdelta) are skipped; tools/delta_receiver.c
+ * decodes those.
+ *
+ * Build: gcc -O2 -Wall -o udp_receiver udp_receiver.c
+ * Usage: ./udp_receiver [-p port] [-o latest.ppm]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+// must match main/udp_stream.h
+#define HEADER_LEN      32
+#define PAYLOAD_TYPE    96
+#define PF_RGB565       0
+#define PF_YUV422       1
+#define PF_GRAYSCALE    2
+
+typedef struct {
+    int marker;
+    uint16_t seq;
+    uint32_t capture_us;
+    uint32_t frame;
+    uint16_t line;
+    uint16_t lines;
+    uint16_t width;
+    uint16_t height;
+    uint8_t format;
+    uint8_t bpp;
+    uint16_t packets;
+    uint32_t send_us;
+} packet_t;
+
+typedef struct {
+    int active;
+    uint32_t frame;
+    uint16_t width, height;
+    uint8_t format, bpp;
+    uint16_t packets, received;
+    uint32_t capture_us, last_send_us;
+    uint8_t *data;
+    size_t size;
+} assembly_t;
+
+typedef struct {
+    uint64_t bytes;
+    uint32_t packets, lost, frames, incomplete, skipped;
+    double sender_ms_sum, sender_ms_max;
+    double net_ms_sum, net_ms_max;
+    uint32_t latency_count;
+} interval_t;
+
+static uint16_t get16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+static uint32_t get32(const uint8_t *p) { return ((uint32_t) get16(p) << 16) | get16(p + 2); }
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int parse(const uint8_t *buf, ssize_t len, packet_t *p)
+{
+    if (len < HEADER_LEN || (buf[0] & 0xC0) != 0x80 || (buf[1] & 0x7F) != PAYLOAD_TYPE)
+        return -1;
+    p->marker = buf[1] >> 7;
+    p->seq = get16(buf + 2);
+    p->capture_us = get32(buf + 4);
+    p->frame = get32(buf + 12);
+    p->line = get16(buf + 16);
+    p->lines = get16(buf + 18);
+    p->width = get16(buf + 20);
+    p->height = get16(buf + 22);
+    p->format = buf[24];
+    p->bpp = buf[25];
+    p->packets = get16(buf + 26);
+    p->send_us = get32(buf + 28);
+    return 0;
+}
+
+static uint8_t clamp(int v) { return v < 0 ? 0 : v > 255 ? 255 : v; }
+
+// framebuffer words are little endian, two pixels each: y1 v y2 u for
+// YUV422, the second pixel's 565 value byte swapped first for RGB565
+static void write_ppm(const char *path, const assembly_t *a)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    fprintf(f, "P6 %d %d 255\n", a->width, a->height);
+    for (size_t i = 0; i + 3 < a->size && a->format != PF_GRAYSCALE; i += 4) {
+        const uint8_t *w = a->data + i;
+        uint8_t rgb[6];
+        if (a->format == PF_YUV422) {
+            int u = w[3] - 128, v = w[1] - 128;
+            for (int k = 0; k < 2; k++) {
+                int y = 1192 * ((k ? w[2] : w[0]) - 16);
+                rgb[3 * k] = clamp((y + 1634 * v) >> 10);
+                rgb[3 * k + 1] = clamp((y - 832 * v - 400 * u) >> 10);
+                rgb[3 * k + 2] = clamp((y + 2066 * u) >> 10);
+            }
+        } else {
+            uint16_t px[2] = { (w[2] << 8) | w[3], (w[0] << 8) | w[1] };
+            for (int k = 0; k < 2; k++) {
+                rgb[3 * k] = (px[k] >> 11) << 3;
+                rgb[3 * k + 1] = ((px[k] >> 5) & 0x3F) << 2;
+                rgb[3 * k + 2] = (px[k] & 0x1F) << 3;
+            }
+        }
+        fwrite(rgb, 1, 6, f);
+    }
+    for (size_t i = 0; i < a->size && a->format == PF_GRAYSCALE; i++) {
+        uint8_t rgb[3] = { a->data[i], a->data[i], a->data[i] };
+        fwrite(rgb, 1, 3, f);
+    }
+    fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    int port = 5004, opt;
+    const char *ppm = NULL;
+    while ((opt = getopt(argc, argv, "p:o:")) != -1) {
+        if (opt == 'p') {
+            port = atoi(optarg);
+        } else if (opt == 'o') {
+            ppm = optarg;
+        } else {
+            fprintf(stderr, "usage: %s [-p port] [-o latest.ppm]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    int rcvbuf = 4 << 20;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return 1;
+    }
+    printf("listening on UDP port %d\n", port);
+
+    assembly_t a = { 0 }, done = { 0 };
+    interval_t iv = { 0 };
+    uint8_t buf[2048];
+    packet_t p;
+    int have_seq = 0, have_frame = 0;
+    uint16_t next_seq = 0;
+    uint32_t last_frame = 0;
+    double min_delay = 1e30, clock_offset = 0;
+    double report_at = now_s() + 1.0;
+
+    while (1) {
+        struct timeval tv = { 0, 200000 };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        ssize_t len = recv(sock, buf, sizeof(buf), 0);
+        double t = now_s();
+
+        if (len > 0 && parse(buf, len, &p) == 0) {
+            iv.packets++;
+            iv.bytes += len;
+            if (have_seq && p.seq != next_seq) {
+                // late or duplicate packets show up as a large forward gap
+                uint16_t gap = p.seq - next_seq;
+                if (gap < 0x8000)
+                    iv.lost += gap;
+            }
+            have_seq = 1;
+            next_seq = p.seq + 1;
+
+            // a new frame closes the one being assembled
+            if (a.active && p.frame != a.frame) {
+                iv.incomplete++;
+                a.active = 0;
+            }
+            if (!a.active) {
+                if (have_frame && p.frame - last_frame > 1 && p.frame > last_frame)
+                    iv.skipped += p.frame - last_frame - 1;
+                have_frame = 1;
+                last_frame = p.frame;
+                size_t size = (size_t) p.width * p.height * p.bpp;
+                if (size != a.size) {
+                    a.data = realloc(a.data, size);
+                    a.size = size;
+                }
+                a.active = 1;
+                a.frame = p.frame;
+                a.width = p.width;
+                a.height = p.height;
+                a.format = p.format;
+                a.bpp = p.bpp;
+                a.packets = p.packets;
+                a.received = 0;
+                a.capture_us = p.capture_us;
+            }
+            size_t stride = (size_t) p.width * p.bpp;
+            size_t offset = (size_t) p.line * stride;
+            size_t payload = len - HEADER_LEN;
+            if (a.data && offset + payload <= a.size && payload == (size_t) p.lines * stride) {
+                memcpy(a.data + offset, buf + HEADER_LEN, payload);
+                a.received++;
+                a.last_send_us = p.send_us;
+            }
+
+            // camera clock in seconds, unwrapped against our clock
+            double delay = t - p.send_us * 1e-6 - clock_offset;
+            if (min_delay == 1e30) {
+                clock_offset = delay;
+                delay = 0;
+            }
+            if (delay > 2000 || delay < -2000) {
+                // the 32 bit microsecond clock wrapped, start over
+                clock_offset += delay;
+                min_delay = delay = 0;
+            }
+            if (delay < min_delay)
+                min_delay = delay;
+
+            if (p.marker && a.active) {
+                if (a.received == a.packets) {
+                    double sender_ms = (uint32_t) (a.last_send_us - a.capture_us) / 1000.0;
+                    double net_ms = (delay - min_delay) * 1000.0;
+                    iv.frames++;
+                    iv.sender_ms_sum += sender_ms;
+                    iv.net_ms_sum += net_ms;
+                    if (sender_ms > iv.sender_ms_max)
+                        iv.sender_ms_max = sender_ms;
+                    if (net_ms > iv.net_ms_max)
+                        iv.net_ms_max = net_ms;
+                    iv.latency_count++;
+                    if (ppm) {
+                        // keep the frame, assemble the next one in the old buffer
+                        assembly_t old = done;
+                        done = a;
+                        a.data = old.data;
+                        a.size = old.size;
+                    }
+                } else {
+                    iv.incomplete++;
+                }
+                a.active = 0;
+            }
+        }
+
+        if (t >= report_at) {
+            uint32_t expected = iv.packets + iv.lost;
+            printf("%5.1f fps %6.2f Mbit/s | lost %u/%u packets (%.2f%%), %u incomplete, %u skipped by camera"
+                   " | camera->sent %.1f/%.1f ms, network +%.1f/%.1f ms (avg/max)\n",
+                   iv.frames / 1.0, iv.bytes * 8 / 1e6, iv.lost, expected,
+                   expected ? 100.0 * iv.lost / expected : 0.0, iv.incomplete, iv.skipped,
+                   iv.latency_count ? iv.sender_ms_sum / iv.latency_count : 0.0, iv.sender_ms_max,
+                   iv.latency_count ? iv.net_ms_sum / iv.latency_count : 0.0, iv.net_ms_max);
+            fflush(stdout);
+            if (ppm && done.data)
+                write_ppm(ppm, &done);
+            memset(&iv, 0, sizeof(iv));
+            report_at = t + 1.0;
+        }
+    }
+    return 0;
+}
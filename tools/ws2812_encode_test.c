@@ -0,0 +1,122 @@
+/*
+ * Host test for the WS2812 bit encoder (components/ledstrip/ws2812.c).
+ *
+ * Encodes a few frames with ws2812_encode and checks every RMT item: high
+ * phase first, MSB first, T0H/T0L or T1H/T1L as the bit says, and the
+ * reset stretch on the low phase of the last item only. The tick counts
+ * are checked against the WS2812B datasheet timings as well.
+ *
+ * Build: gcc -O2 -Wall -Ihost -I../components/ledstrip/include
+ *            -o ws2812_encode_test ws2812_encode_test.c ../components/ledstrip/ws2812.c
+ * Usage: ./ws2812_encode_test
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "ws2812.h"
+
+// one RMT tick in ns, from the 80MHz APB clock
+#define TICK_NS         (1000 / (80 / WS2812_RMT_CLK_DIV))
+// datasheet tolerance of each phase
+#define TOLERANCE_NS    150
+// WS2812B parts from V5 on latch after 280us low
+#define MIN_RESET_NS    280000
+// duration fields of an RMT item are 15 bits
+#define MAX_DURATION    0x7FFF
+
+static int s_failures = 0;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            s_failures++; \
+        } \
+    } while (0)
+
+static void check_phase(const char* name, int ticks, int nominal_ns)
+{
+    int ns = ticks * TICK_NS;
+    CHECK(abs(ns - nominal_ns) <= TOLERANCE_NS, "%s is %d ns, datasheet %d +-%d ns",
+          name, ns, nominal_ns, TOLERANCE_NS);
+}
+
+static void check_timings()
+{
+    CHECK(TICK_NS == 25, "tick is %d ns", TICK_NS);
+    check_phase("T0H", WS2812_T0H_TICKS, 400);
+    check_phase("T0L", WS2812_T0L_TICKS, 850);
+    check_phase("T1H", WS2812_T1H_TICKS, 800);
+    check_phase("T1L", WS2812_T1L_TICKS, 450);
+    CHECK(WS2812_RESET_TICKS * TICK_NS >= MIN_RESET_NS, "reset is %d ns, at least %d ns needed",
+          WS2812_RESET_TICKS * TICK_NS, MIN_RESET_NS);
+    CHECK(WS2812_T0L_TICKS + WS2812_RESET_TICKS <= MAX_DURATION &&
+          WS2812_T1L_TICKS + WS2812_RESET_TICKS <= MAX_DURATION,
+          "stretched low phase does not fit an RMT item");
+}
+
+// encode grb and compare every item against the bits it stands for
+static void check_frame(const char* name, const uint8_t* grb, size_t led_count)
+{
+    size_t item_count = led_count * WS2812_BITS_PER_LED;
+    // one item past the frame to catch writes beyond it
+    rmt_item32_t* items = (rmt_item32_t*) malloc((item_count + 1) * sizeof(rmt_item32_t));
+    const uint32_t guard = 0xDEADBEEF;
+
+    memset(items, 0xA5, (item_count + 1) * sizeof(rmt_item32_t));
+    items[item_count].val = guard;
+    ws2812_encode(grb, led_count, items);
+
+    for (size_t i = 0; i < item_count; ++i) {
+        int bit = (grb[i / 8] >> (7 - i % 8)) & 1;
+        int high = bit ? WS2812_T1H_TICKS : WS2812_T0H_TICKS;
+        int low = bit ? WS2812_T1L_TICKS : WS2812_T0L_TICKS;
+        if (i == item_count - 1) {
+            low += WS2812_RESET_TICKS;
+        }
+        CHECK(items[i].level0 == 1 && items[i].level1 == 0,
+              "%s: item %zu levels %d/%d, expected 1/0", name, i, items[i].level0, items[i].level1);
+        CHECK(items[i].duration0 == high,
+              "%s: item %zu (bit %d) high for %d ticks, expected %d", name, i, bit,
+              items[i].duration0, high);
+        CHECK(items[i].duration1 == low,
+              "%s: item %zu (bit %d) low for %d ticks, expected %d", name, i, bit,
+              items[i].duration1, low);
+    }
+    CHECK(items[item_count].val == guard, "%s: item past the frame written", name);
+    free(items);
+}
+
+int main()
+{
+    uint8_t grb[3 * 64];
+
+    check_timings();
+
+    // the last bit decides which low phase is stretched
+    const uint8_t ones[3] = { 0xFF, 0xFF, 0xFF };
+    const uint8_t zeros[3] = { 0x00, 0x00, 0x00 };
+    const uint8_t msb[3] = { 0x80, 0x01, 0x5A };
+    check_frame("all ones", ones, 1);
+    check_frame("all zeros", zeros, 1);
+    check_frame("bit order", msb, 1);
+
+    for (size_t i = 0; i < sizeof(grb); ++i) {
+        grb[i] = (uint8_t) (i * 37 + 11);
+    }
+    check_frame("64 LEDs", grb, 64);
+
+    // an empty frame writes nothing
+    rmt_item32_t item = { .val = 0x12345678 };
+    ws2812_encode(grb, 0, &item);
+    CHECK(item.val == 0x12345678, "empty frame wrote an item");
+
+    if (s_failures > 0) {
+        printf("%d checks failed\n", s_failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}